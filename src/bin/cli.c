@@ -62,6 +62,10 @@ struct option long_options[] =
   {"cache-strategy", required_argument, 0, 'f'},
   {"help",           no_argument,       0, 'h'},
   {"verbose",        no_argument,       0, 'v'},
+  {"output",         required_argument, 0, 'o'},
+  {"files-from",     required_argument, 0, 'F'},
+  {"area",           required_argument, 0, 'a'},
+  {"scale",          required_argument, 0, 'S'},
   {0, 0, 0, 0}
   };
   
@@ -174,7 +178,42 @@ char *clean_dirpath(char *path)
   return path;
 }
 
-int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, int *size, int *metric, int *strategy, char **path, int *winsize,  int *verbose, int *help)
+//one input file per line, empty lines are skipped
+static int _files_read(const char *list, Eina_List **files)
+{
+  FILE *f;
+  char *line = NULL;
+  size_t n = 0;
+  ssize_t len;
+  struct stat statbuf;
+  
+  f = fopen(list, "r");
+  if (!f) {
+    printf("ERROR parsing command line: could not open file list %s\n", list);
+    return -1;
+  }
+  
+  while ((len = getline(&line, &n, f)) != -1) {
+    while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+      line[--len] = '\0';
+    if (!len)
+      continue;
+    if (stat(line, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+      printf("ERROR parsing command line: %s (from %s) is not a regular file\n", line, list);
+      free(line);
+      fclose(f);
+      return -1;
+    }
+    *files = eina_list_append(*files, eina_file_path_sanitize(line));
+  }
+  
+  free(line);
+  fclose(f);
+  
+  return 0;
+}
+
+int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, int *size, int *metric, int *strategy, char **path, Eina_List **files, char **output, Rect *area, int *winsize,  int *verbose, int *help)
 {
   int i;
   int c;
@@ -198,8 +237,17 @@ int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, in
   
   if (path)
     *path = NULL;
+  if (files)
+    *files = NULL;
+  if (output)
+    *output = NULL;
+  //scale -1: no area rendering requested, width 0: full image
+  if (area) {
+    memset(area, 0, sizeof(Rect));
+    area->corner.scale = -1;
+  }
   
-  while ((c = getopt_long(argc, argv, "b:s:m:f:w:vh", long_options, &option_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "b:s:m:f:w:o:F:a:S:vh", long_options, &option_index)) != -1) {
     switch (c) {
       case 'b' :
 	if (!bench) {
@@ -277,6 +325,45 @@ int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, in
       case 'v' :
 	(*verbose)++;
 	break;
+      case 'o' :
+	if (!output) {
+	  printf("ERROR parsing command line: output template is not supported!\n");
+	  return -1;
+	}
+	*output = optarg;
+	break;
+      case 'F' :
+	if (!files) {
+	  printf("ERROR parsing command line: file list is not supported!\n");
+	  return -1;
+	}
+	if (_files_read(optarg, files))
+	  return -1;
+	break;
+      case 'a' :
+	if (!area) {
+	  printf("ERROR parsing command line: area rendering is not supported!\n");
+	  return -1;
+	}
+	if (sscanf(optarg, "%d,%d,%d,%d", &area->corner.x, &area->corner.y, &area->width, &area->height) != 4
+	    || area->corner.x < 0 || area->corner.y < 0 || area->width < 1 || area->height < 1) {
+	  printf("ERROR parsing command line: require area as x,y,width,height (was %s)\n", optarg);
+	  return -1;
+	}
+	if (area->corner.scale == -1)
+	  area->corner.scale = 0;
+	break;
+      case 'S' :
+	if (!area) {
+	  printf("ERROR parsing command line: area rendering is not supported!\n");
+	  return -1;
+	}
+	area->corner.scale = atoi(optarg);
+	if (area->corner.scale < 0) {
+	  printf("ERROR parsing command line: require scale >= 0 (was %s)\n", optarg);
+	  return -1;
+	}
+	break;
       case 'm' :
 	subopts = optarg;
 	while (*subopts != '\0') {
@@ -352,6 +439,8 @@ int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, in
           return -1;
         }
         *path = remain;
+        if (files)
+          *files = eina_list_append(*files, remain);
         /*if (dir) {
           *dir = strdup(remain);
           for(i=strlen(remain)-1;i>0;i--)
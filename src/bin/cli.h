@@ -42,7 +42,7 @@ typedef struct {
   void *val;  //... to this value
 } Bench_Step;
 
-int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, int *size, int *metric, int *strategy, char **path, int *winsize, int *verbose, int *help);
+int parse_cli(int argc, char **argv, Eina_List **filters, Bench_Step **bench, int *size, int *metric, int *strategy, char **path, Eina_List **files, char **output, Rect *area, int *winsize, int *verbose, int *help);
 void print_init_info(Bench_Step *bench, int size, int metric, int strategy, char *path);
 void bench_time_mark(int type);
 void bench_delay_start(struct timespec *delay);
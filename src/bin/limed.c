@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * limed - tile server, keeps configured chains and the tile cache warm
+ *
+ * listens on a unix domain socket, one request per line, tab separated:
+ *
+ *   scale\tx\ty\tfile[\tchain]\n
+ *
+ * x and y are tile indices of the TILE_SIZE grid at scale, chain is a
+ * filter chain as accepted by limedo (without source and sink)
+ * the answer is the tile as binary ppm (cropped at the image border) or
+ * a single line "ERR message\n", a connection may send any number of
+ * requests, e.g.:
+ *
+ *   printf '2\t0\t0\t/photos/a.jpg\tsharpen\n' | socat - UNIX-CONNECT:/tmp/limed > t.ppm
+ */
+
+#include "Lime.h"
+#include "filter_memsink.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define TILE_SIZE 256
+//configured chains kept warm, unused ones are evicted lru
+#define CHAINS_MAX 16
+#define QUEUE_MAX 256
+#define CONNECTIONS_MAX 64
+
+typedef struct {
+  char *key; //file\tsize\tmtime\tchain, a replaced file gets a new chain
+  Eina_List *filters;
+  Filter *sink;
+  int refs;
+  uint64_t used;
+} _Chain;
+
+typedef struct {
+  char *key; //scale\tx\ty\tfile\tchain
+  char *file, *chain;
+  int scale, x, y;
+  int waiters;
+  int done;
+  uint8_t *ppm;
+  int len;
+  char *err;
+} _Job;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+//in-flight jobs, identical requests wait for the same job
+static Eina_Hash *jobs;
+static Eina_List *queue;
+static int queue_len;
+
+static Eina_Hash *chains;
+static int chain_count;
+static uint64_t chain_clock;
+
+static int connections;
+static int verbose;
+
+void print_help(void)
+{
+  printf("usage: limed - lime tile server\n");
+  printf("   limed [options] socket\n");
+  printf("requests are lines of \"scale<TAB>x<TAB>y<TAB>file[<TAB>chain]\", x/y are %dpx tile indices,\n", TILE_SIZE);
+  printf("   the answer is the tile as binary ppm or a line \"ERR message\"\n");
+  printf("options:\n");
+  printf("   --help,           -h  show this help\n");
+  printf("   --cache-size,     -s  set cache size in megabytes (default: 100)\n");
+  printf("   --jobs,           -j  number of render threads (default: number of cpus)\n");
+  printf("   --verbose,        -v  print every request\n");
+}
+
+static void _job_del(_Job *job)
+{
+  free(job->key);
+  free(job->file);
+  free(job->chain);
+  free(job->ppm);
+  free(job->err);
+  free(job);
+}
+
+static void _chain_del(_Chain *chain)
+{
+  Filter *f;
+
+  EINA_LIST_FREE(chain->filters, f)
+    filter_del(f);
+  free(chain->key);
+  free(chain);
+}
+
+//called with lock held
+static void _chains_evict(void)
+{
+  Eina_Iterator *iter;
+  _Chain *chain, *lru;
+
+  while (chain_count > CHAINS_MAX) {
+    lru = NULL;
+    iter = eina_hash_iterator_data_new(chains);
+    EINA_ITERATOR_FOREACH(iter, chain)
+      if (!chain->refs && (!lru || chain->used < lru->used))
+        lru = chain;
+    eina_iterator_free(iter);
+
+    //all in use
+    if (!lru)
+      return;
+
+    eina_hash_del_by_key(chains, lru->key);
+    chain_count--;
+    _chain_del(lru);
+  }
+}
+
+static _Chain *_chain_new(const char *key, const char *file, const char *chain_str, struct stat *st)
+{
+  _Chain *chain;
+  Eina_List *filters = NULL, *l;
+  Filter *f, *load, *last = NULL;
+
+  if (chain_str[0]) {
+    filters = lime_filter_chain_deserialize((char*)chain_str);
+    if (!filters)
+      return NULL;
+  }
+
+  //clients only get to read images, sinks like savetiff or savedzi write and delete files
+  EINA_LIST_FOREACH(filters, l, f)
+    if (strcmp(f->fc->shortname, "load") && lime_setting_type_get(f, "filename") != -1) {
+      printf("limed: rejected chain with %s\n", f->fc->shortname);
+      EINA_LIST_FREE(filters, f)
+        filter_del(f);
+      return NULL;
+    }
+
+  if (!filters || strcmp(((Filter*)eina_list_data_get(filters))->fc->shortname, "load")) {
+    load = lime_filter_new("load");
+    filters = eina_list_prepend(filters, load);
+  }
+  else
+    load = eina_list_data_get(filters);
+  lime_setting_string_set(load, "filename", file);
+  //tile hashes start at the loader and only contain the path, so a replaced
+  //file must not hit the tiles of the old one in the cache
+  load->hash.prevhash = st->st_size ^ st->st_mtim.tv_sec ^ st->st_mtim.tv_nsec;
+
+  f = lime_filter_new("memsink");
+  lime_setting_int_set(f, "add alpha", 1);
+  filters = eina_list_append(filters, f);
+
+  EINA_LIST_FOREACH(filters, l, f) {
+    if (last)
+      lime_filter_connect(last, f);
+    last = f;
+  }
+
+  chain = calloc(sizeof(_Chain), 1);
+  chain->key = strdup(key);
+  chain->filters = filters;
+  chain->sink = last;
+
+  return chain;
+}
+
+static _Chain *_chain_get(const char *file, const char *chain_str)
+{
+  _Chain *chain;
+  struct stat st;
+  char *key;
+
+  //stat on every request, chains of a replaced file are never used again and age out
+  if (stat(file, &st) || !S_ISREG(st.st_mode))
+    return NULL;
+
+  key = malloc(strlen(file)+strlen(chain_str)+80);
+  sprintf(key, "%s\t%lld\t%lld.%09ld\t%s", file, (long long)st.st_size,
+          (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, chain_str);
+
+  pthread_mutex_lock(&lock);
+  chain = eina_hash_find(chains, key);
+  if (!chain) {
+    chain = _chain_new(key, file, chain_str, &st);
+    if (chain) {
+      eina_hash_add(chains, key, chain);
+      chain_count++;
+    }
+  }
+  if (chain) {
+    chain->refs++;
+    chain->used = chain_clock++;
+    _chains_evict();
+  }
+  pthread_mutex_unlock(&lock);
+
+  free(key);
+
+  return chain;
+}
+
+static void _chain_put(_Chain *chain)
+{
+  pthread_mutex_lock(&lock);
+  chain->refs--;
+  _chains_evict();
+  pthread_mutex_unlock(&lock);
+}
+
+static void _job_fail(_Job *job, const char *msg)
+{
+  job->err = malloc(strlen(msg)+6);
+  sprintf(job->err, "ERR %s\n", msg);
+}
+
+static void _job_render(_Job *job, int thread_id, uint32_t *buf)
+{
+  _Chain *chain;
+  Dim *dim;
+  Rect area;
+  uint32_t px;
+  uint8_t *rgb;
+  int w, h, i, j, head;
+
+  chain = _chain_get(job->file, job->chain);
+  if (!chain) {
+    _job_fail(job, "could not create filter chain (missing file or invalid chain)");
+    return;
+  }
+
+  if (lime_config_test(chain->sink) || !(dim = filter_core_by_type(chain->sink, MT_IMGSIZE))) {
+    _job_fail(job, "could not configure filter chain");
+    _chain_put(chain);
+    return;
+  }
+
+  //lime_render_area() asserts on requests outside the image, compare tile
+  //indices so large ones can't overflow
+  if (job->scale > dim->scaledown_max) {
+    _job_fail(job, "tile outside of image");
+    _chain_put(chain);
+    return;
+  }
+  w = DIV_SHIFT_ROUND_UP(dim->width, job->scale);
+  h = DIV_SHIFT_ROUND_UP(dim->height, job->scale);
+  if (job->x >= (w+TILE_SIZE-1)/TILE_SIZE || job->y >= (h+TILE_SIZE-1)/TILE_SIZE) {
+    _job_fail(job, "tile outside of image");
+    _chain_put(chain);
+    return;
+  }
+
+  area.corner.scale = job->scale;
+  area.corner.x = job->x*TILE_SIZE;
+  area.corner.y = job->y*TILE_SIZE;
+  area.width = TILE_SIZE;
+  area.height = TILE_SIZE;
+
+  lime_lock();
+  filter_memsink_buffer_set(chain->sink, (uint8_t*)buf, thread_id);
+  lime_unlock();
+
+  lime_render_area(&area, chain->sink, thread_id);
+
+  lime_lock();
+  filter_memsink_buffer_set(chain->sink, NULL, thread_id);
+  lime_unlock();
+
+  _chain_put(chain);
+
+  w = w - area.corner.x < TILE_SIZE ? w - area.corner.x : TILE_SIZE;
+  h = h - area.corner.y < TILE_SIZE ? h - area.corner.y : TILE_SIZE;
+
+  job->ppm = malloc(32+w*h*3);
+  head = sprintf((char*)job->ppm, "P6\n%d %d\n255\n", w, h);
+  rgb = job->ppm + head;
+  //memsink delivers 0xAARRGGBB
+  for(j=0;j<h;j++)
+    for(i=0;i<w;i++) {
+      px = buf[j*TILE_SIZE+i];
+      *(rgb++) = px >> 16;
+      *(rgb++) = px >> 8;
+      *(rgb++) = px;
+    }
+  job->len = head + w*h*3;
+}
+
+static void *_worker(void *arg)
+{
+  int thread_id = lime_thread_id_get();
+  uint32_t *buf = malloc(TILE_SIZE*TILE_SIZE*4);
+  _Job *job;
+
+  while (1) {
+    pthread_mutex_lock(&lock);
+    while (!queue)
+      pthread_cond_wait(&job_cond, &lock);
+    job = eina_list_data_get(queue);
+    queue = eina_list_remove_list(queue, queue);
+    queue_len--;
+    pthread_mutex_unlock(&lock);
+
+    _job_render(job, thread_id, buf);
+
+    pthread_mutex_lock(&lock);
+    job->done = 1;
+    eina_hash_del_by_key(jobs, job->key);
+    if (!job->waiters)
+      _job_del(job);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&lock);
+  }
+
+  return NULL;
+}
+
+static int _write_all(int fd, const void *buf, int len)
+{
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (len) {
+    n = write(fd, p, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+//returns 0 if the answer could be written
+static int _request(int fd, char *line)
+{
+  char *fields[5] = {NULL};
+  char *key, *save = NULL, *tok;
+  int count = 0, scale, x, y, ret;
+  _Job *job;
+
+  for(tok=strtok_r(line, "\t", &save);tok && count<5;tok=strtok_r(NULL, "\t", &save))
+    fields[count++] = tok;
+
+  if (count < 4 || sscanf(fields[0], "%d", &scale) != 1 || sscanf(fields[1], "%d", &x) != 1
+      || sscanf(fields[2], "%d", &y) != 1 || scale < 0 || x < 0 || y < 0) {
+    const char *msg = "ERR expected scale<TAB>x<TAB>y<TAB>file[<TAB>chain]\n";
+    return _write_all(fd, msg, strlen(msg));
+  }
+  if (!fields[4])
+    fields[4] = "";
+
+  if (verbose)
+    printf("[REQ] %s scale %d tile %d %d chain \"%s\"\n", fields[3], scale, x, y, fields[4]);
+
+  key = malloc(strlen(fields[3])+strlen(fields[4])+64);
+  sprintf(key, "%d\t%d\t%d\t%s\t%s", scale, x, y, fields[3], fields[4]);
+
+  pthread_mutex_lock(&lock);
+  job = eina_hash_find(jobs, key);
+  if (!job) {
+    if (queue_len >= QUEUE_MAX) {
+      pthread_mutex_unlock(&lock);
+      free(key);
+      return _write_all(fd, "ERR busy\n", 9);
+    }
+    job = calloc(sizeof(_Job), 1);
+    job->key = key;
+    job->file = strdup(fields[3]);
+    job->chain = strdup(fields[4]);
+    job->scale = scale;
+    job->x = x;
+    job->y = y;
+    eina_hash_add(jobs, key, job);
+    queue = eina_list_append(queue, job);
+    queue_len++;
+    pthread_cond_signal(&job_cond);
+  }
+  else
+    free(key);
+
+  job->waiters++;
+  while (!job->done)
+    pthread_cond_wait(&done_cond, &lock);
+  pthread_mutex_unlock(&lock);
+
+  if (job->err)
+    ret = _write_all(fd, job->err, strlen(job->err));
+  else
+    ret = _write_all(fd, job->ppm, job->len);
+
+  pthread_mutex_lock(&lock);
+  job->waiters--;
+  if (!job->waiters)
+    _job_del(job);
+  pthread_mutex_unlock(&lock);
+
+  return ret;
+}
+
+static void *_connection(void *arg)
+{
+  int fd = (intptr_t)arg;
+  FILE *in = fdopen(dup(fd), "r");
+  char *line = NULL;
+  size_t n = 0;
+  ssize_t len;
+
+  if (in) {
+    while ((len = getline(&line, &n, in)) != -1) {
+      while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+        line[--len] = '\0';
+      if (!len)
+        continue;
+      if (_request(fd, line))
+        break;
+    }
+    fclose(in);
+  }
+
+  free(line);
+  close(fd);
+
+  pthread_mutex_lock(&lock);
+  connections--;
+  pthread_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  struct option long_options[] = {
+    {"cache-size", required_argument, 0, 's'},
+    {"jobs",       required_argument, 0, 'j'},
+    {"verbose",    no_argument,       0, 'v'},
+    {"help",       no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+  struct sockaddr_un addr;
+  pthread_t thread;
+  pthread_attr_t attr;
+  int c, i, fd, sock, cache_size = 100, threads = 0;
+
+  while ((c = getopt_long(argc, argv, "s:j:vh", long_options, NULL)) != -1)
+    switch (c) {
+      case 's' :
+        cache_size = atoi(optarg);
+        if (cache_size < 1) {
+          printf("ERROR parsing command line: require cache-size >= 1MB (was %s)\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'j' :
+        threads = atoi(optarg);
+        if (threads < 1) {
+          printf("ERROR parsing command line: require jobs >= 1 (was %s)\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'v' :
+        verbose++;
+        break;
+      case 'h' :
+        print_help();
+        return EXIT_SUCCESS;
+      default :
+        print_help();
+        return EXIT_FAILURE;
+    }
+
+  if (optind != argc-1 || strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+    print_help();
+    return EXIT_FAILURE;
+  }
+
+  if (!threads)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+
+  lime_init();
+  lime_cache_set(cache_size, 0);
+
+  jobs = eina_hash_string_superfast_new(NULL);
+  chains = eina_hash_string_superfast_new(NULL);
+
+  //clients that hang up must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, argv[optind]);
+  unlink(addr.sun_path);
+  if (sock == -1 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(sock, 16)) {
+    printf("ERROR: could not listen on %s: %s\n", argv[optind], strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  printf("[INIT] CACHE size %dMB, %d render threads, listening on %s\n", cache_size, threads, argv[optind]);
+
+  for(i=0;i<threads;i++)
+    pthread_create(&thread, NULL, &_worker, NULL);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (1) {
+    fd = accept(sock, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      printf("ERROR: accept failed: %s\n", strerror(errno));
+      break;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (connections >= CONNECTIONS_MAX) {
+      pthread_mutex_unlock(&lock);
+      _write_all(fd, "ERR busy\n", 9);
+      close(fd);
+      continue;
+    }
+    connections++;
+    pthread_mutex_unlock(&lock);
+
+    if (pthread_create(&thread, &attr, &_connection, (void*)(intptr_t)fd)) {
+      close(fd);
+      pthread_mutex_lock(&lock);
+      connections--;
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  close(sock);
+  unlink(addr.sun_path);
+  lime_shutdown();
+
+  return EXIT_FAILURE;
+}
@@ -19,34 +19,292 @@
 
 #include "Lime.h"
 #include "cli.h"
+#include "filter_memsink.h"
+
+#include <pthread.h>
+#include <libgen.h>
+#include <limits.h>
+
+//two chains: while one decodes file N+1 the other filters and encodes file N
+#define LANES 2
+//area rendering goes through memsink in tiles on the same grid as limeview
+#define AREA_TILE 256
+
+typedef struct {
+  Eina_List *filters;
+  Filter *load, *sink;
+  pthread_t thread;
+} _Lane;
+
+typedef struct {
+  char **files;
+  int count;
+  int next;
+  char *output;
+  Rect area;
+  int verbose;
+} _Batch;
+
+static _Batch batch;
 
 void print_help(void)
 {
   printf("usage: limedo - execute filter chain\n");
-  printf("   limedo [options] [filter1[:set1=val1[:set2=val2]]][,filter2] ... inputfile\n");
+  printf("   limedo [options] [filter1[:set1=val1[:set2=val2]]][,filter2] ... inputfile [inputfile2 ...]\n");
   printf("filter may be one of:\n   \"gauss\", \"sharpen\", \"denoise\", \"contrast\", \"exposure\", \"convert\", \"assert\"\n");
   printf("source filter is set by the application\nsink filter is the last filter in the chain and has to be set to either\n   \"\"savetiff\" or \"compare\", e.g. \"savetiff=0,blablub.tif\" to save to blablub.tif in sRGB colorspace,\n   or \"compare=1\" to compare scales in LAB color space\n");
+  printf("with multiple input files the chain is executed once per file, the sink filename is then\n   set from the output template: %%f input name without extension, %%d input directory,\n   %%n zero based input index, %%%% literal %%, e.g. -o \"out/%%f.tif\"\n");
   printf("options:\n");
   printf("   --help,           -h  show this help\n");
   printf("   --cache-size,     -s  set cache size in megabytes (default: 100)\n");
   printf("   --cache-metric,   -m  set cache cache metric (lru/dist/time/hits), \n                         can be repeated for a combined metric (default: lru)\n");
   printf("   --cache-strategy, -f  set cache strategy (rand/rapx/prob, default rapx)\n");
+  printf("   --output,         -o  output filename template for the sink\n");
+  printf("   --files-from,     -F  read input files from a list, one per line\n");
+  printf("   --area,           -a  only render x,y,width,height (in coordinates of the selected scale)\n");
+  printf("   --scale,          -S  render at scale n (width/2^n), with --area or for the full image,\n                         the result is written as binary ppm to the --output file\n");
   printf("   --verbose,        -v  prints some more information, mainly cache usage statistics\n");
 }
 
+static char *_output_name(const char *tmpl, const char *file, int idx)
+{
+  char *str = malloc(PATH_MAX);
+  char *base = strdup(file);
+  char *dir = strdup(file);
+  char *name, *ext;
+  int len = 0;
+  
+  name = basename(base);
+  ext = strrchr(name, '.');
+  if (ext && ext != name)
+    *ext = '\0';
+  
+  str[0] = '\0';
+  for(;*tmpl && len < PATH_MAX-1;tmpl++) {
+    if (*tmpl != '%' || !tmpl[1]) {
+      str[len++] = *tmpl;
+      str[len] = '\0';
+      continue;
+    }
+    tmpl++;
+    switch (*tmpl) {
+      case 'f' :
+        len += snprintf(str+len, PATH_MAX-len, "%s", name);
+        break;
+      case 'd' :
+        len += snprintf(str+len, PATH_MAX-len, "%s", dirname(dir));
+        break;
+      case 'n' :
+        len += snprintf(str+len, PATH_MAX-len, "%04d", idx);
+        break;
+      default :
+        str[len++] = *tmpl;
+        str[len] = '\0';
+    }
+    if (len > PATH_MAX-1)
+      len = PATH_MAX-1;
+  }
+  
+  free(base);
+  free(dir);
+  
+  return str;
+}
+
+//same filters and settings, each lane is configured on its own
+static Eina_List *_chain_clone(Eina_List *filters)
+{
+  Eina_List *clone = NULL, *l;
+  Filter *f, *c;
+  Meta *m;
+  int i;
+  
+  EINA_LIST_FOREACH(filters, l, f) {
+    c = lime_filter_new(f->fc->shortname);
+    for(i=0;i<ea_count(f->settings);i++) {
+      m = ea_data(f->settings, i);
+      if (!m->data)
+        continue;
+      switch (m->type) {
+        case MT_INT :
+          lime_setting_int_set(c, m->name, *(int*)m->data);
+          break;
+        case MT_FLOAT :
+          lime_setting_float_set(c, m->name, *(float*)m->data);
+          break;
+        case MT_STRING :
+          lime_setting_string_set(c, m->name, m->data);
+          break;
+      }
+    }
+    clone = eina_list_append(clone, c);
+  }
+  
+  return clone;
+}
+
+static void _lane_connect(_Lane *lane)
+{
+  Eina_List *l;
+  Filter *f, *last = NULL;
+  
+  EINA_LIST_FOREACH(lane->filters, l, f) {
+    if (last)
+      lime_filter_connect(last, f);
+    
+    last = f;
+  }
+  
+  lane->load = eina_list_data_get(lane->filters);
+  lane->sink = last;
+}
+
+static int _ppm_write(const char *path, uint8_t *rgb, int w, int h)
+{
+  FILE *f = fopen(path, "wb");
+  int fail;
+  
+  if (!f) {
+    printf("ERROR: could not open %s for writing\n", path);
+    return -1;
+  }
+  
+  fprintf(f, "P6\n%d %d\n255\n", w, h);
+  fail = fwrite(rgb, 3, w*h, f) != w*h;
+  if (fclose(f) || fail) {
+    printf("ERROR: could not write %s\n", path);
+    return -1;
+  }
+  
+  return 0;
+}
+
+//only the memsink tiles intersecting the area are rendered, so the loaders
+//decode (and scale down) just the needed part of the image
+static int _area_render(_Lane *lane, const char *path)
+{
+  Rect area = batch.area, tile;
+  Dim *dim;
+  uint32_t *buf, px;
+  uint8_t *rgb;
+  int x, y, i, j, w, h, x1, y1, x2, y2, thread_id;
+  
+  if (lime_config_test(lane->sink) || !(dim = filter_core_by_type(lane->sink, MT_IMGSIZE))) {
+    printf("ERROR: could not configure filter chain for %s\n", path);
+    return -1;
+  }
+  
+  if (area.corner.scale > dim->scaledown_max) {
+    printf("ERROR: scale %d not available (max %d)\n", area.corner.scale, dim->scaledown_max);
+    return -1;
+  }
+  
+  w = DIV_SHIFT_ROUND_UP(dim->width, area.corner.scale);
+  h = DIV_SHIFT_ROUND_UP(dim->height, area.corner.scale);
+  if (!area.width) {
+    area.width = w;
+    area.height = h;
+  }
+  if (area.corner.x >= w || area.corner.y >= h) {
+    printf("ERROR: area outside of image (%dx%d at scale %d)\n", w, h, area.corner.scale);
+    return -1;
+  }
+  if (area.corner.x + area.width > w)
+    area.width = w - area.corner.x;
+  if (area.corner.y + area.height > h)
+    area.height = h - area.corner.y;
+  
+  buf = malloc(AREA_TILE*AREA_TILE*4);
+  rgb = malloc(area.width*area.height*3);
+  thread_id = lime_thread_id_get();
+  filter_memsink_buffer_set(lane->sink, (uint8_t*)buf, thread_id);
+  
+  tile.corner.scale = area.corner.scale;
+  tile.width = AREA_TILE;
+  tile.height = AREA_TILE;
+  for(y=area.corner.y/AREA_TILE;y*AREA_TILE<area.corner.y+area.height;y++)
+    for(x=area.corner.x/AREA_TILE;x*AREA_TILE<area.corner.x+area.width;x++) {
+      tile.corner.x = x*AREA_TILE;
+      tile.corner.y = y*AREA_TILE;
+      lime_render_area(&tile, lane->sink, thread_id);
+      
+      x1 = tile.corner.x > area.corner.x ? tile.corner.x : area.corner.x;
+      y1 = tile.corner.y > area.corner.y ? tile.corner.y : area.corner.y;
+      x2 = tile.corner.x+AREA_TILE < area.corner.x+area.width ? tile.corner.x+AREA_TILE : area.corner.x+area.width;
+      y2 = tile.corner.y+AREA_TILE < area.corner.y+area.height ? tile.corner.y+AREA_TILE : area.corner.y+area.height;
+      //memsink delivers 0xAARRGGBB
+      for(j=y1;j<y2;j++)
+        for(i=x1;i<x2;i++) {
+          px = buf[(j-tile.corner.y)*AREA_TILE + i-tile.corner.x];
+          rgb[((j-area.corner.y)*area.width + i-area.corner.x)*3+0] = px >> 16;
+          rgb[((j-area.corner.y)*area.width + i-area.corner.x)*3+1] = px >> 8;
+          rgb[((j-area.corner.y)*area.width + i-area.corner.x)*3+2] = px;
+        }
+    }
+  
+  filter_memsink_buffer_set(lane->sink, NULL, thread_id);
+  lime_thread_id_put(thread_id);
+  free(buf);
+  
+  i = _ppm_write(path, rgb, area.width, area.height);
+  free(rgb);
+  
+  return i;
+}
+
+static void *_lane_run(void *arg)
+{
+  _Lane *lane = arg;
+  char *out = NULL;
+  int idx;
+  
+  while ((idx = __sync_fetch_and_add(&batch.next, 1)) < batch.count) {
+    //the other lane is rendering, settings must not race its cache and stringshare use
+    //a new filename resets the configuration of the whole lane, as a different
+    //image can change size, colorspace and the inserted loader, nothing is reused
+    lime_lock();
+    if (batch.files[idx])
+      lime_setting_string_set(lane->load, "filename", batch.files[idx]);
+    if (batch.output && batch.files[idx]) {
+      out = _output_name(batch.output, batch.files[idx], idx);
+      if (batch.area.corner.scale == -1)
+        lime_setting_string_set(lane->sink, "filename", out);
+      if (batch.verbose)
+        printf("[BATCH] %d/%d %s -> %s\n", idx+1, batch.count, batch.files[idx], out);
+    }
+    else if (batch.output)
+      out = strdup(batch.output);
+    else if (batch.verbose && batch.files[idx])
+      printf("[BATCH] %d/%d %s\n", idx+1, batch.count, batch.files[idx]);
+    lime_unlock();
+    
+    if (batch.area.corner.scale != -1)
+      _area_render(lane, out);
+    else
+      lime_render(lane->sink);
+    
+    free(out);
+    out = NULL;
+  }
+  
+  return NULL;
+}
+
 int
 main(int argc, char **argv)
 {
   int cache_strategy, cache_metric, cache_size, help;
   Eina_List *filters = NULL,
+	    *files = NULL,
 	    *list_iter;
-  Filter *f, *last, *load, *sink; 
-  char *file = NULL;
-  int verbose;
+  Filter *load, *sink; 
+  char *file = NULL, *output = NULL;
+  _Lane lanes[LANES];
+  int i, lane_count, verbose;
   
   lime_init();
 
-  if (parse_cli(argc, argv, &filters, NULL, &cache_size, &cache_metric, &cache_strategy, &file, NULL, &verbose, &help))
+  if (parse_cli(argc, argv, &filters, NULL, &cache_size, &cache_metric, &cache_strategy, &file, &files, &output, &batch.area, NULL, &verbose, &help))
     return EXIT_FAILURE;
   
   if (help) {
@@ -59,35 +317,71 @@ main(int argc, char **argv)
   lime_cache_set(cache_size, cache_strategy | cache_metric);
   
   if (!strcmp(((Filter*)eina_list_data_get(filters))->fc->shortname, "load")) {
-    load = eina_list_data_get(filters);
-    if (file)
-      lime_setting_string_set(load, "filename", file);
+    //no input files: run once with the filename from the chain
+    if (!files)
+      files = eina_list_append(files, NULL);
   }
   else {
-    if (!file) { 
+    if (!files) { 
       printf("ERROR: need file to execute filter chain!\n");
       return EXIT_FAILURE;
     }
     load = lime_filter_new("load");
-    lime_setting_string_set(load, "filename", file);
     filters = eina_list_prepend(filters, load);
   }
   
-
-  last = NULL;
-  EINA_LIST_FOREACH(filters, list_iter, f) {
-    if (last)
-      lime_filter_connect(last, f);
-    
-    last = f;
+  sink = eina_list_data_get(eina_list_last(filters));
+  
+  if (batch.area.corner.scale != -1) {
+    if (!output) {
+      printf("ERROR: area rendering needs an output file (--output)!\n");
+      return EXIT_FAILURE;
+    }
+    if (lime_setting_type_get(sink, "filename") == MT_STRING) {
+      printf("ERROR: area rendering writes through memsink, remove the \"%s\" sink!\n", sink->fc->shortname);
+      return EXIT_FAILURE;
+    }
+    if (strcmp(sink->fc->shortname, "memsink")) {
+      sink = lime_filter_new("memsink");
+      filters = eina_list_append(filters, sink);
+    }
+    lime_setting_int_set(sink, "add alpha", 1);
   }
   
-  sink = last;
-
-  lime_render(sink);
+  batch.count = eina_list_count(files);
+  batch.files = malloc(sizeof(char*)*batch.count);
+  i = 0;
+  EINA_LIST_FOREACH(files, list_iter, file)
+    batch.files[i++] = file;
+  batch.output = output;
+  batch.verbose = verbose;
+  
+  if (batch.count > 1 && !output && lime_setting_type_get(sink, "filename") == MT_STRING) {
+    printf("ERROR: multiple input files need an output template (--output)!\n");
+    return EXIT_FAILURE;
+  }
+  
+  lane_count = batch.count < LANES ? batch.count : LANES;
+  
+  lanes[0].filters = filters;
+  for(i=1;i<lane_count;i++)
+    lanes[i].filters = _chain_clone(filters);
+  for(i=0;i<lane_count;i++)
+    _lane_connect(&lanes[i]);
+  
+  if (lane_count == 1)
+    _lane_run(&lanes[0]);
+  else {
+    for(i=0;i<lane_count;i++)
+      pthread_create(&lanes[i].thread, NULL, &_lane_run, &lanes[i]);
+    for(i=0;i<lane_count;i++)
+      pthread_join(lanes[i].thread, NULL);
+  }
   
   cache_stats_print();
   
+  free(batch.files);
+  
   lime_shutdown();
   
   return 0;
@@ -154,7 +154,6 @@ typedef struct {
 
 
 int max_workers;
-int max_thread_id;
 Evas_Object *clipper, *win, *scroller, *file_slider, *filter_list, *select_filter, *pos_label, *fsb, *load_progress, *load_label, *load_notify;
 Evas_Object *settings_rule_cam_lbl, *settings_rule_format_lbl, *settings_rule_list, *settings_rule_del_btn;
 Evas_Object *tab_group, *tab_filter, *tab_settings, *tab_tags, *tab_current, *tab_box, *tab_export, *tab_tags, *tags_list, *tags_filter_list, *seg_rating;
@@ -183,7 +182,6 @@ Limeview_Settings *settings = NULL;
 
 int bench_idx = 0;
 
-int *thread_ids;
 
 float scale_goal = 1.0;
 Bench_Step *bench;
@@ -193,7 +191,10 @@ Config_Data *config_curr = NULL;
 
 int worker = 0;
 int worker_config = 0;
+Config_Batch *config_batch = NULL;
 int worker_preload = 0;
+//set once the main loop exits, finished tiles no longer start new ones
+int quitting = 0;
 
 typedef struct {
   void (*action)(void *data, Evas_Object *obj);
@@ -327,7 +328,6 @@ typedef struct {
   int scale;
   uint8_t *buf;
   Rect area;
-  int t_id;
   int packx, packy, packw, packh;
   int show_direct;
 } _Img_Thread_Data;
@@ -1051,21 +1051,58 @@ void workerfinish_schedule(void (*func)(void *data, Evas_Object *obj), void *dat
   }
 }
 
-static void _process_tile(void *data, Ecore_Thread *th)
+static void _finished_tile(void *data, Ecore_Thread *th);
+static void _finished_tile_blind(void *data, Ecore_Thread *th);
+
+static void _finished_tile_main(void *data)
 {
-  _Img_Thread_Data *tdata = data;
-    
-  eina_sched_prio_drop();
-  lime_render_area(&tdata->area, tdata->config->sink, tdata->t_id);
+  _finished_tile(data, NULL);
 }
 
-static void _process_tile_bg(void *data, Ecore_Thread *th)
+static void _finished_tile_blind_main(void *data)
 {
-  _Img_Thread_Data *tdata = data;
-    
-  eina_sched_prio_drop();
-  eina_sched_prio_drop();
-  lime_render_area(&tdata->area, tdata->config->sink, tdata->t_id);
+  _finished_tile_blind(data, NULL);
+}
+
+//called from a lime render thread
+static void _tile_rendered(void *data, Lime_Future *future)
+{
+  ecore_main_loop_thread_safe_call_async(_finished_tile_main, data);
+}
+
+static void _tile_blind_rendered(void *data, Lime_Future *future)
+{
+  ecore_main_loop_thread_safe_call_async(_finished_tile_blind_main, data);
+}
+
+static void _tile_submit(_Img_Thread_Data *tdata, uint8_t *buf, int flags, Lime_Render_Cb cb)
+{
+  Lime_Render_Request req;
+  int thread_id, memsink;
+  
+  req.f = tdata->config->sink;
+  req.area = tdata->area;
+  req.buf = buf;
+  req.flags = flags;
+  req.cb = cb;
+  req.data = tdata;
+  
+  if (!lime_render_submit(&req, 1, NULL))
+    return;
+  
+  //no render thread could be started, render here, the callback then
+  //finishes the tile as usual
+  printf("could not start render threads, rendering synchronously\n");
+  memsink = !strcmp(req.f->fc->shortname, "memsink");
+  thread_id = lime_thread_id_get();
+  lime_render_areas(req.f, &req.area, memsink ? &buf : NULL, 1, thread_id);
+  if (memsink) {
+    lime_lock();
+    filter_memsink_buffer_set(req.f, NULL, thread_id);
+    lime_unlock();
+  }
+  lime_thread_id_put(thread_id);
+  cb(tdata, NULL);
 }
 
 void _insert_image(_Img_Thread_Data *tdata)
@@ -1122,8 +1159,6 @@ Eina_Bool _display_preview(void *data)
   return ECORE_CALLBACK_CANCEL;
 }
 
-static void _finished_tile_blind(void *data, Ecore_Thread *th);
-
 void limeview_config_ref(Config_Data *c)
 {
   assert(c->sink);
@@ -1144,6 +1179,9 @@ void run_preload_threads(void)
 {
   _Img_Thread_Data *tdata;
   
+  if (quitting)
+    return;
+  
   while (worker_preload+worker<max_workers && preload_pending()) {
     tdata = preload_get();
     //config was reset...
@@ -1153,10 +1191,8 @@ void run_preload_threads(void)
     //just delete all preloads!
     }
     worker_preload++;
-    tdata->t_id = lock_free_thread_id();
-    filter_memsink_buffer_set(tdata->config->sink, NULL, tdata->t_id);
     limeview_config_ref(tdata->config);
-    ecore_thread_run(_process_tile_bg, _finished_tile_blind, NULL, tdata);
+    _tile_submit(tdata, NULL, LIME_RENDER_BACKGROUND, _tile_blind_rendered);
   }
 }
 
@@ -1167,11 +1203,6 @@ _finished_tile_blind(void *data, Ecore_Thread *th)
   
   limeview_config_unref(tdata->config);
   
-  assert(tdata->t_id != -1);
-  
-  thread_ids[tdata->t_id] = 0;
-  tdata->t_id = -1;
-  
   worker_preload--;
   
   free(tdata);
@@ -1191,11 +1222,6 @@ _finished_tile(void *data, Ecore_Thread *th)
   double delay = bench_delay_get(delay_cur);
   
   limeview_config_unref(tdata->config);
-  
-  assert(tdata->t_id != -1);
-  
-  thread_ids[tdata->t_id] = 0;
-  tdata->t_id = -1;
  
 #ifdef BENCHMARK_PREVIEW
   if (tagfiles_idx(files) >= BENCHMARK_LENGTH)
@@ -1206,6 +1232,10 @@ _finished_tile(void *data, Ecore_Thread *th)
   
   worker--;
   
+  //tdata stays owned by the mat cache
+  if (quitting)
+    return;
+  
   if (!pending_action()) {
     if (first_preview)
       idle_render = ecore_idler_add(idle_run_render, NULL);
@@ -1278,19 +1308,6 @@ _finished_tile(void *data, Ecore_Thread *th)
   
 }
 
-int lock_free_thread_id(void)
-{
-  int i;
-  
-  for(i=0;i<max_thread_id;i++)
-    if (!thread_ids[i]) {
-      thread_ids[i] = 1;
-      return i;
-    }
-    
-  abort();
-}
-
 int fill_area_blind(int xm, int ym, int wm, int hm, int minscale, Config_Data *config)
 {
   int x,y,w,h;
@@ -1512,17 +1529,14 @@ int fill_area(int xm, int ym, int wm, int hm, int minscale, int preview)
 	  tdata->packh = TILE_SIZE*scalediv;
 	  tdata->config = config_curr;
 	  
-	  tdata->t_id = lock_free_thread_id();
-	  
 	  assert(buf);
-	  filter_memsink_buffer_set(config_curr->sink, tdata->buf, tdata->t_id);
 	  
 	  mat_cache_set(mat_cache, scale, i, j, tdata);
 	  	  
 	  worker++;
 	  
           limeview_config_ref(tdata->config);
-	  ecore_thread_run(_process_tile, _finished_tile, NULL, tdata);
+	  _tile_submit(tdata, tdata->buf, 0, _tile_rendered);
 	  started++;
 
 	  if (worker >= max_workers || (first_preview && started))
@@ -2042,14 +2056,24 @@ Config_Data *config_data_get(File_Group *group, int nth)
   return config;
 }
 
-void config_exe(void *data, Ecore_Thread *thread)
+void config_finish(void *data, Ecore_Thread *thread);
+
+void config_batch_finish(void *data)
+{
+  config_finish(data, NULL);
+}
+
+//called from a config batch thread
+void config_batch_done(void *data, Filter *f, int failed)
 {
   Config_Data *config = data;
   
-  config->failed = lime_config_test(config->sink);
+  config->failed = failed;
   
   config->configured = EINA_TRUE;
   config->running = EINA_FALSE;
+  
+  ecore_main_loop_thread_safe_call_async(config_batch_finish, config);
 }
 
 void config_finish(void *data, Ecore_Thread *thread)
@@ -2063,6 +2087,11 @@ void config_finish(void *data, Ecore_Thread *thread)
   worker_config--;
   assert(config->sink);
   
+  if (quitting) {
+    free(tdata);
+    return;
+  }
+  
   if (config->failed || !size) {
     free(tdata);
     nth = config->file_group_idx+1;
@@ -2160,7 +2189,10 @@ void config_thread_start(File_Group *group, int nth)
   worker_config++;
   config->running = EINA_TRUE;
   assert(config->sink);
-  ecore_thread_run(&config_exe, &config_finish, NULL, config);
+  if (config_batch)
+    lime_config_batch_add(config_batch, config->sink, &config_batch_done, config);
+  else
+    config_batch_done(config, config->sink, lime_config_test(config->sink));
 }
 
 //FIXME parallel configs might block limited worker threads with io!?
@@ -3881,17 +3913,19 @@ elm_main(int argc, char **argv)
   max_preload_workers = max_workers*(EXTRA_THREADING_FACTOR-1);
   if (PRELOAD_EXTRA_WORKERS < max_preload_workers)
     max_preload_workers = PRELOAD_EXTRA_WORKERS;
-  max_thread_id = max_workers+PRELOAD_CONFIG_RANGE+100;
   
   lime_init();
   eina_log_abort_on_critical_set(EINA_TRUE);
   
+  //preload configurations run in parallel to rendering
+  config_batch = lime_config_batch_new(max_workers);
+  if (!config_batch)
+    printf("could not start configuration threads, configuring synchronously\n");
+  
   mat_cache = mat_cache_new();
   delgrid();
   
-  thread_ids = calloc(sizeof(int)*(max_thread_id+1), 1);
-  
-  if (parse_cli(argc, argv, &filters, &bench, NULL, &cache_metric, &cache_strategy, &path, &winsize, &verbose, &help))
+  if (parse_cli(argc, argv, &filters, &bench, NULL, &cache_metric, &cache_strategy, &path, NULL, NULL, NULL, &winsize, &verbose, &help))
     return EXIT_FAILURE;
   
   if (help) {
@@ -4192,9 +4226,15 @@ elm_main(int argc, char **argv)
   elm_run();
   //bench_time_mark(BENCHMARK_PROCESSING);
   
-  //wait for stuff to finish
-  while (ecore_thread_active_get())
+  //wait for stuff to finish, tiles render on the lime pool and write into
+  //tile buffers and configs which are deleted below
+  quitting = 1;
+  preload_flush();
+  if (config_batch)
+    lime_config_batch_wait(config_batch);
+  while (worker || worker_preload || worker_config || ecore_thread_active_get())
     ecore_main_loop_iterate();
+  lime_config_batch_del(config_batch);
   //del configs
   step_image_config_reset_range(files, 0, tagfiles_count(files));
   
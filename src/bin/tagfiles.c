@@ -27,6 +27,7 @@
 #include <Efreet.h>
 
 #include "tagfiles.h"
+#include "exif_helpers.h"
 
 #define MAX_XMP_FILE 1024*1024
 
@@ -791,6 +792,12 @@ void tagfiles_preload_headers(Tagfiles *tagfiles, int direction, int range, int
   //}
 }
 
+//parse the exif data of the whole dir in the background, the viewer then only hits the cache
+static void _exif_index_start(const char *dir)
+{
+  lime_exif_index_queue(dir);
+}
+
 Eina_Bool _idle_ls_continue(void *data) 
 {
   Tagfiles *tagfiles = data;
@@ -799,6 +806,7 @@ Eina_Bool _idle_ls_continue(void *data)
   //FIXME do sort in extra thread instead of when idle?
   eina_inarray_sort(tagfiles->dirs_ls, (Eina_Compare_Cb)dir_strcmp_neg);
   dir = *(char**)eina_inarray_custom_pop(tagfiles->dirs_ls);
+  _exif_index_start(dir);
   eio_file_direct_ls(dir, &_ls_filter_cb, &_ls_main_cb,&_ls_done_cb, &_ls_error_cb, ls_info_new(dir, tagfiles));
     
   return ECORE_CALLBACK_CANCEL;
@@ -885,6 +893,7 @@ Tagfiles *tagfiles_new_from_dir(const char *path, void (*progress_cb)(Tagfiles *
   files->dirs_ls = eina_inarray_new(sizeof(char *), 32);
   files->files_sorted = EINA_TRUE;
   
+  _exif_index_start(dir);
   eio_file_direct_ls(dir, &_ls_filter_cb, &_ls_main_cb,&_ls_done_cb, &_ls_error_cb, ls_info_new(dir,files));
   
   return files;
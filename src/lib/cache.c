@@ -339,9 +339,13 @@ void cache_uncached_sub(int mem)
 
 void *cache_buffer_alloc(int mem)
 {
-  cache->buffers += mem;
-  if (cache->buffers > cache->buffers_peak)
-    cache->buffers_peak = cache->buffers;
+  //also called from configuration, which does not hold the global lock
+  uint64_t buffers = __sync_add_and_fetch(&cache->buffers, mem);
+  uint64_t peak = cache->buffers_peak;
+  
+  //retry if another thread raised the peak in between
+  while (buffers > peak && !__sync_bool_compare_and_swap(&cache->buffers_peak, peak, buffers))
+    peak = cache->buffers_peak;
   
   return malloc(mem);
 }
@@ -360,7 +364,7 @@ void *cache_buffer_alloc_mt(int mem)
 
 void cache_buffer_del(void *data, int mem)
 {
-  cache->buffers -= mem;
+  __sync_sub_and_fetch(&cache->buffers, mem);
   free(data);
 }
 
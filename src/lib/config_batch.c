@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "configuration.h"
+
+/*
+ * configure independent filter chains in parallel
+ * jobs are executed in the order they were added
+ */
+
+struct _Config_Batch {
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond; //new job or shutdown
+  pthread_cond_t idle_cond; //no jobs pending
+  Eina_List *jobs;
+  int pending; //queued + running
+  int shutdown;
+  int thread_count;
+  pthread_t *threads;
+};
+
+typedef struct {
+  Filter *f;
+  Config_Batch_Cb cb;
+  void *data;
+} _Job;
+
+static void *_batch_worker(void *arg)
+{
+  Config_Batch *batch = arg;
+  _Job *job;
+  int failed;
+
+  pthread_mutex_lock(&batch->lock);
+
+  while (1) {
+    while (!batch->jobs && !batch->shutdown)
+      pthread_cond_wait(&batch->job_cond, &batch->lock);
+
+    if (!batch->jobs)
+      break;
+
+    job = eina_list_data_get(batch->jobs);
+    batch->jobs = eina_list_remove_list(batch->jobs, batch->jobs);
+
+    pthread_mutex_unlock(&batch->lock);
+
+    //configurations of different chains only lock their own chain
+    failed = lime_config_test(job->f);
+
+    if (job->cb)
+      job->cb(job->data, job->f, failed);
+    free(job);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->pending--;
+    if (!batch->pending)
+      pthread_cond_broadcast(&batch->idle_cond);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
+
+  return NULL;
+}
+
+//threads <= 0: one thread per cpu
+Config_Batch *lime_config_batch_new(int threads)
+{
+  int i;
+  Config_Batch *batch = calloc(sizeof(Config_Batch), 1);
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->job_cond, NULL);
+  pthread_cond_init(&batch->idle_cond, NULL);
+
+  batch->threads = malloc(sizeof(pthread_t)*threads);
+
+  for(i=0;i<threads;i++) {
+    if (pthread_create(&batch->threads[i], NULL, &_batch_worker, batch)) {
+      printf("config batch: could only start %d of %d threads\n", i, threads);
+      break;
+    }
+    batch->thread_count++;
+  }
+
+  if (!batch->thread_count) {
+    free(batch->threads);
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->job_cond);
+    pthread_cond_destroy(&batch->idle_cond);
+    free(batch);
+    return NULL;
+  }
+
+  return batch;
+}
+
+//queue configuration of the chain ending in f, cb is called from a worker thread
+void lime_config_batch_add(Config_Batch *batch, Filter *f, Config_Batch_Cb cb, void *data)
+{
+  _Job *job = malloc(sizeof(_Job));
+
+  job->f = f;
+  job->cb = cb;
+  job->data = data;
+
+  pthread_mutex_lock(&batch->lock);
+  batch->jobs = eina_list_append(batch->jobs, job);
+  batch->pending++;
+  pthread_cond_signal(&batch->job_cond);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+//block until all queued configurations (and their callbacks) are done
+void lime_config_batch_wait(Config_Batch *batch)
+{
+  pthread_mutex_lock(&batch->lock);
+  while (batch->pending)
+    pthread_cond_wait(&batch->idle_cond, &batch->lock);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+//finishes all queued jobs first
+void lime_config_batch_del(Config_Batch *batch)
+{
+  int i;
+
+  if (!batch)
+    return;
+
+  pthread_mutex_lock(&batch->lock);
+  batch->shutdown = 1;
+  pthread_cond_broadcast(&batch->job_cond);
+  pthread_mutex_unlock(&batch->lock);
+
+  for(i=0;i<batch->thread_count;i++)
+    pthread_join(batch->threads[i], NULL);
+
+  free(batch->threads);
+  pthread_mutex_destroy(&batch->lock);
+  pthread_cond_destroy(&batch->job_cond);
+  pthread_cond_destroy(&batch->idle_cond);
+  free(batch);
+}
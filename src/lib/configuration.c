@@ -18,23 +18,29 @@
  */
 
 #include "configuration.h"
+#include "optimize.h"
 
 #include "filter_convert.h"
 #include "filter_loadjpeg.h"
 #include "filter_loadtiff.h"
+#include "filter_loadlime.h"
 #include "filter_interleave.h"
 #include "filter_fliprot.h"
 #include "filter_loadraw.h"
 #include "filter_curves.h"
 
-#define DEBUG_OUT_GRAPH 
+//#define DEBUG_OUT_GRAPH
 
 #define MAX_CONS_TRIES 4
 
+//metas and restrictions created during configuration are bump allocated from here
+#define CONFIG_ARENA_CHUNK (64*1024)
+
 //#define DEBUG_SPECIAL
 //#define PRINT_CONFIG_PROGRESS
 
-//TODO replace by non-global filter-located variable! this here is bad for multiple filter graphs!
+//configuration state of a single filter graph, located at the last filter of the chain
+//(filter_chain_last_filter(f)->c) and protected by that filters lock
 struct _Config {
    int configured;
    int refcount;
@@ -42,17 +48,36 @@ struct _Config {
    Eina_Array *applied_metas;
    Eina_Array *new_fs;
    Eina_Inarray *succ_inserts;
-   Eina_Array *config_meta_allocs;
-   Eina_Array *config_allocs;
+   Eina_Array *arena_chunks;
+   char *arena_pos;
+   size_t arena_remain;
+   Eina_Array *arena_arrays; //Meta_Arrays in the arena which may have grown out of their inline storage
+   //scratch arrays of test_filter_config_real(), emptied and reused by every run
+   Eina_Array *match_source;
+   Eina_Array *match_sink;
+   Eina_Array *copied;
+   Eina_Array *copy;
+   Eina_Array *matches_possible;
+   Eina_Array *matches_compat;
+   Eina_Array *restr_lookup;
 };
 
-typedef struct {
+struct _Tune_Restriction;
+
+//if a value is removed this has to be propagated back!
+typedef struct _Restr_Link {
+  Meta *my_node;
+  Meta *other_node;
+  struct _Tune_Restriction *other_restr;
+  struct _Restr_Link *next;
+} Restr_Link;
+
+//lives in the config arena
+typedef struct _Tune_Restriction {
   Meta *tune;
-  Eina_Array *allowed_values;
-  //if a value is removed this has to be propagated back!
-  Eina_Array *my_node;
-  Eina_Array *other_node;
-  Eina_Array *other_restr;
+  void **allowed_values; //NULL if removed
+  int allowed_count;
+  Restr_Link *links, *links_last;
   int remain;
 } Tune_Restriction;
 
@@ -83,27 +108,40 @@ void vizp_stop(FILE *f)
 
 void lime_filter_config_ref(Filter *f)
 {
-  Config * c = filter_chain_last_filter(f)->c;
+  Filter *last = filter_chain_last_filter(f);
+  Config * c;
+  
+  pthread_mutex_lock(&last->lock);
+  
+  c = last->c;
   
   assert(c);
     
   c->refcount++;
+  
+  pthread_mutex_unlock(&last->lock);
 }
 
+static void _config_reset(Filter *f);
+
 void lime_filter_config_unref(Filter *f)
 {
+  Filter *last;
+  Config *c;
+  
   if (!f)
     return;
   
-  pthread_mutex_lock(&f->lock);
+  last = filter_chain_last_filter(f);
+  pthread_mutex_lock(&last->lock);
   
-  Config * c = filter_chain_last_filter(f)->c;
+  c = last->c;
 
   assert(c);
     
   if (!c->refcount) {
     printf("FIXME lime_filter_config_unref called with refcount == 0!\n");
-    pthread_mutex_unlock(&f->lock);
+    pthread_mutex_unlock(&last->lock);
     return;
   }
   
@@ -112,9 +150,64 @@ void lime_filter_config_unref(Filter *f)
   c->refcount--;
   
   if (!c->refcount && c->delete)
-    lime_config_reset(f);
+    _config_reset(f);
+  
+  pthread_mutex_unlock(&last->lock);
+}
+
+//zeroed memory which lives until the config is reset
+static void *config_alloc(Config *c, size_t size)
+{
+  void *mem;
+  size_t chunk;
+  
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  
+  if (size > c->arena_remain) {
+    chunk = size > CONFIG_ARENA_CHUNK ? size : CONFIG_ARENA_CHUNK;
+    c->arena_pos = malloc(chunk);
+    if (!c->arena_pos)
+      abort();
+    ea_push(c->arena_chunks, c->arena_pos);
+    c->arena_remain = chunk;
+  }
+  
+  mem = c->arena_pos;
+  c->arena_pos += size;
+  c->arena_remain -= size;
+  
+  memset(mem, 0, size);
+  
+  return mem;
+}
+
+static Meta_Array *config_meta_array_new(Config *c)
+{
+  Meta_Array *ar = config_alloc(c, sizeof(Meta_Array));
+  
+  meta_array_init(ar);
+  ea_push(c->arena_arrays, ar);
   
-  pthread_mutex_unlock(&f->lock);
+  return ar;
+}
+
+//release everything allocated during configuration, keeps the first chunk for reuse
+static void config_arena_release(Config *c)
+{
+  while (ea_count(c->arena_arrays))
+    meta_array_clear(ea_pop(c->arena_arrays));
+  
+  while (ea_count(c->arena_chunks) > 1)
+    free(ea_pop(c->arena_chunks));
+  
+  if (ea_count(c->arena_chunks)) {
+    c->arena_pos = ea_data(c->arena_chunks, 0);
+    c->arena_remain = CONFIG_ARENA_CHUNK;
+  }
+  else {
+    c->arena_pos = NULL;
+    c->arena_remain = 0;
+  }
 }
 
 void meta_dep_set_data_calc(Meta *m, void *dep_data)
@@ -125,10 +218,7 @@ void meta_dep_set_data_calc(Meta *m, void *dep_data)
 
 Meta *meta_copy(Meta *m, Config *c)
 {
-  int i;
-  Meta *copy = calloc(sizeof(Meta), 1);
-  
-  eina_array_push(c->config_meta_allocs, copy);
+  Meta *copy = config_alloc(c, sizeof(Meta));
   
   //printf("copying %p\n", m);
   
@@ -140,11 +230,9 @@ Meta *meta_copy(Meta *m, Config *c)
   //Meta *replace; //the node that appears in the output instead of this input-node
   //Meta_Array *childs; //type: Meta
   //TODO select merging etc
-  if (m->select && ea_count(m->select)) {
-    copy->select = eina_array_new(ea_count(m->select));
-    for(i=0;i<ea_count(m->select);i++)
-      ea_push(copy->select, ea_data(m->select, i));
-  }
+  //selects are never modified through a copy, so share them
+  if (m->select && ea_count(m->select))
+    copy->select = m->select;
   copy->data = m->data;
   //copy->data_calc = m->data_calc;
   // Meta_Array *parents;
@@ -168,7 +256,7 @@ Meta *meta_copy_tree(Meta *m, Eina_Array *copied_ar, Eina_Array *copy_ar, Config
   ea_push(copy_ar, copy);
   
   if (m->childs) {
-    copy->childs = meta_array_new();
+    copy->childs = config_meta_array_new(c);
     for(i=0;i<m->childs->count;i++) {
       is_copy = 0;
       for(i_cp=0;i_cp<ea_count(copied_ar);i_cp++)
@@ -296,19 +384,21 @@ int metas_not_kompat_rec_all(Meta *source, Meta *sink, Eina_Array *match_source,
   return 0;
 }
  
-Eina_Array *get_sink_source_matches(Meta *source, Meta *sink, Eina_Array *match_source, Eina_Array *match_sink)
+//returns c->matches_compat, valid until the next call
+Eina_Array *get_sink_source_matches(Meta *source, Meta *sink, Eina_Array *match_source, Eina_Array *match_sink, Config *c)
 {
   int i;
   
-  Eina_Array *matches_possible = eina_array_new(8);
-  Eina_Array *matches_compat = eina_array_new(8);
+  Eina_Array *matches_possible = c->matches_possible;
+  Eina_Array *matches_compat = c->matches_compat;
+  
+  eina_array_clean(matches_possible);
+  eina_array_clean(matches_compat);
   
   //recursive-discover matches
   metas_pair_recursive(matches_possible, source, sink);
   
   if (!ea_count(matches_possible)) {
-    eina_array_free(matches_possible);
-    eina_array_free(matches_compat);
 #ifdef PRINT_CONFIG_PROGRESS
     printf("[no possible matches]");
 #endif
@@ -322,8 +412,6 @@ Eina_Array *get_sink_source_matches(Meta *source, Meta *sink, Eina_Array *match_
   }
     
   if (!ea_count(matches_compat)) {
-    eina_array_free(matches_possible);
-    eina_array_free(matches_compat);
 #ifdef PRINT_CONFIG_PROGRESS
     printf("[no compatible matches]");
 #endif
@@ -332,8 +420,6 @@ Eina_Array *get_sink_source_matches(Meta *source, Meta *sink, Eina_Array *match_
 
   assert(ea_count(matches_compat) == 1);
   
-  eina_array_free(matches_possible);
-  
   return matches_compat;
 }
 
@@ -402,6 +488,7 @@ int restr_remove_value(Tune_Restriction *restr, int idx)
   int i, j;
   Meta *my_node, *other_node;
   Tune_Restriction *other_restr;
+  Restr_Link *link;
   void *my_data;
 
   restr->remain--;
@@ -410,28 +497,28 @@ int restr_remove_value(Tune_Restriction *restr, int idx)
     printf("FIXME: tuning impossible!\n");
   }
   
-  my_data = eina_array_data_get(restr->allowed_values, idx);
+  my_data = restr->allowed_values[idx];
   restr->tune->data = my_data;
-  eina_array_data_set(restr->allowed_values, idx, NULL);
+  restr->allowed_values[idx] = NULL;
   
   //für alle my_nodes
   //calculate my_node->data_calc
   //search for corresponding tuning of other_node->dep
   //call restr_remove_value for corresponding other_node
   
-  for(i=0;i<ea_count(restr->my_node);i++) {
-    my_node = ea_data(restr->my_node, i);
-    other_node = ea_data(restr->other_node, i);
-    other_restr = ea_data(restr->other_restr, i);
+  for(link=restr->links;link;link=link->next) {
+    my_node = link->my_node;
+    other_node = link->other_node;
+    other_restr = link->other_restr;
     
     restr->tune->data = my_data;
     meta_data_calc(my_node);
     
     assert(other_restr->tune == other_node->dep);
     
-    for(j=0;j<ea_count(other_restr->allowed_values);j++) 
-      if (ea_data(other_restr->allowed_values, j)) {
-	other_restr->tune->data = ea_data(other_restr->allowed_values, j);
+    for(j=0;j<other_restr->allowed_count;j++) 
+      if (other_restr->allowed_values[j]) {
+	other_restr->tune->data = other_restr->allowed_values[j];
 	meta_data_calc(other_node);
 	
 	assert(my_node->data);
@@ -454,9 +541,9 @@ int restr_remove_value(Tune_Restriction *restr, int idx)
 
   
   if (restr->remain == 1) {
-    for(i=0;i<ea_count(restr->allowed_values);i++)
-      if (ea_data(restr->allowed_values, i))
-	restr->tune->data = ea_data(restr->allowed_values, i);
+    for(i=0;i<restr->allowed_count;i++)
+      if (restr->allowed_values[i])
+	restr->tune->data = restr->allowed_values[i];
   }
   else
     restr->tune->data = NULL;
@@ -467,9 +554,7 @@ int restr_remove_value(Tune_Restriction *restr, int idx)
 Tune_Restriction *restr_new(Meta *from, Config *c)
 {
   int i;
-  Tune_Restriction *restr = calloc(sizeof(Tune_Restriction), 1);
-  
-  eina_array_push(c->config_allocs, restr);
+  Tune_Restriction *restr = config_alloc(c, sizeof(Tune_Restriction));
   
   restr->tune = from;
   
@@ -478,18 +563,32 @@ Tune_Restriction *restr_new(Meta *from, Config *c)
   assert(from->data == NULL);
   assert(ea_count(from->select));
   
-  restr->allowed_values = eina_array_new(ea_count(from->select));
-  for(i=0;i<ea_count(from->select);i++)
-    ea_push(restr->allowed_values, ea_data(from->select, i));
+  restr->allowed_count = ea_count(from->select);
+  restr->allowed_values = config_alloc(c, sizeof(void*)*restr->allowed_count);
+  for(i=0;i<restr->allowed_count;i++)
+    restr->allowed_values[i] = ea_data(from->select, i);
   
-  restr->my_node = eina_array_new(8);
-  restr->other_node = eina_array_new(8);
-  restr->other_restr = eina_array_new(8);
-  restr->remain = ea_count(from->select);
+  restr->remain = restr->allowed_count;
   
   return restr;
 }
 
+static void restr_link_add(Tune_Restriction *restr, Meta *my_node, Meta *other_node, Tune_Restriction *other_restr, Config *c)
+{
+  Restr_Link *link = config_alloc(c, sizeof(Restr_Link));
+  
+  link->my_node = my_node;
+  link->other_node = other_node;
+  link->other_restr = other_restr;
+  
+  //propagation order is the order of creation
+  if (restr->links_last)
+    restr->links_last->next = link;
+  else
+    restr->links = link;
+  restr->links_last = link;
+}
+
 int tunes_restrict(Meta *a, Meta *b, Eina_Array *restrictions, Config *c)
 {
   int i, j;
@@ -525,9 +624,9 @@ int tunes_restrict(Meta *a, Meta *b, Eina_Array *restrictions, Config *c)
   if (!b->dep) {
     //restrict a's dep to b's only allowed value
 
-    for(i=0;i<ea_count(found_a->allowed_values);i++) 
-      if (ea_data(found_a->allowed_values, i)) {
-	meta_dep_set_data_calc(a, ea_data(found_a->allowed_values, i));
+    for(i=0;i<found_a->allowed_count;i++) 
+      if (found_a->allowed_values[i]) {
+	meta_dep_set_data_calc(a, found_a->allowed_values[i]);
     
 	if (metas_not_kompat(a, b))
 	  if (restr_remove_value(found_a, i))
@@ -540,9 +639,9 @@ int tunes_restrict(Meta *a, Meta *b, Eina_Array *restrictions, Config *c)
   if (!a->dep) {
     //restrict b's dep to a's only allowed value
 
-    for(i=0;i<ea_count(found_b->allowed_values);i++) 
-      if (ea_data(found_b->allowed_values, i)) {
-	meta_dep_set_data_calc(b, ea_data(found_b->allowed_values, i));
+    for(i=0;i<found_b->allowed_count;i++) 
+      if (found_b->allowed_values[i]) {
+	meta_dep_set_data_calc(b, found_b->allowed_values[i]);
 
 	if (metas_not_kompat(a, b))
           if (restr_remove_value(found_b, i))
@@ -552,27 +651,22 @@ int tunes_restrict(Meta *a, Meta *b, Eina_Array *restrictions, Config *c)
     return 0;
   }
   
-  ea_push(found_a->my_node, a);
-  ea_push(found_a->other_node, b);
-  ea_push(found_a->other_restr, found_b);
-  
-  ea_push(found_b->my_node, b);
-  ea_push(found_b->other_node, a);
-  ea_push(found_b->other_restr, found_a);
+  restr_link_add(found_a, a, b, found_b, c);
+  restr_link_add(found_b, b, a, found_a, c);
     
   //FIXME those two as function!
-  for(i=0;i<ea_count(found_a->allowed_values);i++) {
-    if (!ea_data(found_a->allowed_values, i))
+  for(i=0;i<found_a->allowed_count;i++) {
+    if (!found_a->allowed_values[i])
       continue;
     
     is_compatible = 0;
-    meta_dep_set_data_calc(a, ea_data(found_a->allowed_values, i));
+    meta_dep_set_data_calc(a, found_a->allowed_values[i]);
     
-    for(j=0;j<ea_count(found_b->allowed_values);j++) {
-      if (!ea_data(found_b->allowed_values, j))
+    for(j=0;j<found_b->allowed_count;j++) {
+      if (!found_b->allowed_values[j])
 	continue;
       
-      meta_dep_set_data_calc(b, ea_data(found_b->allowed_values, j));
+      meta_dep_set_data_calc(b, found_b->allowed_values[j]);
       if (!metas_not_kompat(a, b)) {
 	is_compatible = 1;
 	break;
@@ -584,18 +678,18 @@ int tunes_restrict(Meta *a, Meta *b, Eina_Array *restrictions, Config *c)
         return -1;
   }
   
-  for(i=0;i<ea_count(found_b->allowed_values);i++) {
-    if (!ea_data(found_b->allowed_values, i))
+  for(i=0;i<found_b->allowed_count;i++) {
+    if (!found_b->allowed_values[i])
       continue;
     
     is_compatible = 0;
-    meta_dep_set_data_calc(b, ea_data(found_b->allowed_values, i));
+    meta_dep_set_data_calc(b, found_b->allowed_values[i]);
     
-    for(j=0;j<ea_count(found_a->allowed_values);j++) {
-      if (!ea_data(found_a->allowed_values, j))
+    for(j=0;j<found_a->allowed_count;j++) {
+      if (!found_a->allowed_values[j])
 	continue;
       
-      meta_dep_set_data_calc(a, ea_data(found_a->allowed_values, j));
+      meta_dep_set_data_calc(a, found_a->allowed_values[j]);
       if (!metas_not_kompat(a, b)) {
 	is_compatible = 1;
 	break;
@@ -676,7 +770,7 @@ Meta *out_tree_construct(Meta *source, Eina_Array *src_con, Eina_Array *sink_con
             
           if (child) {
             if (!out->childs)
-              out->childs = meta_array_new();
+              out->childs = config_meta_array_new(c);
             meta_array_append(out->childs, child);
           }
         }
@@ -752,29 +846,20 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
   Meta *out;
   Meta *old_out;
   FILE *filters;
-  Eina_Array *match_source = eina_array_new(8);
-  Eina_Array *match_sink = eina_array_new(8);
-  Eina_Array *copied = eina_array_new(8);
-  Eina_Array *copy = eina_array_new(8);
+  Eina_Array *match_source = c->match_source;
+  Eina_Array *match_sink = c->match_sink;
+  Eina_Array *copied = c->copied;
+  Eina_Array *copy = c->copy;
   Eina_Array *matches_compat;
-  Eina_Array *restrictions = eina_array_new(8);
-  Eina_Array *trash = eina_array_new(32);
+  Eina_Array *restrictions = c->restr_lookup;
+  
+  eina_array_clean(restrictions);
   
   assert(f->node->con_trees_out != NULL);
   assert(ea_count(f->node->con_trees_out) == 1);
   
   if (f->input_fixed)
     if (f->input_fixed(f)) {
-      eina_array_free(match_source);
-      eina_array_free(match_sink);
-      for(i=0;i<ea_count(copied);i++)
-	free(ea_data(copied, i));
-      eina_array_free(copied);
-      eina_array_free(copy);
-      eina_array_free(restrictions);
-      //for(i=0;i<ea_count(trash);i++)
-	//free(ea_data(trash, i));
-      eina_array_free(trash);
       printf("input fixed failed for %s\n", f->fc->shortname);
       return 0;
     }
@@ -804,32 +889,16 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
     printf("->%s ", con->sink->filter->fc->shortname);
 #endif 
     
-    eina_array_free(match_source);
-    match_source = eina_array_new(8);
-    eina_array_free(match_sink);
-    match_sink = eina_array_new(8);
-    while(ea_count(copied))
-      eina_array_push(trash, eina_array_pop(copied));
-    eina_array_free(copied);
-    copied = eina_array_new(8);
-    eina_array_free(copy);
-    copy = eina_array_new(8);
+    eina_array_clean(match_source);
+    eina_array_clean(match_sink);
+    eina_array_clean(copied);
+    eina_array_clean(copy);
     
-    matches_compat = get_sink_source_matches(out, con->sink, match_source, match_sink);
+    matches_compat = get_sink_source_matches(out, con->sink, match_source, match_sink, c);
     
     if (!matches_compat) {
       //printf("failed\n");
       _ea_metas_data_zero(c->applied_metas);
-      eina_array_free(match_source);
-      eina_array_free(match_sink);
-      for(i=0;i<ea_count(copied);i++)
-	free(ea_data(copied, i));
-      eina_array_free(copied);
-      eina_array_free(copy);
-      eina_array_free(restrictions);
-      //for(i=0;i<ea_count(trash);i++)
-	//free(ea_data(trash, i));
-      eina_array_free(trash);
 #ifdef PRINT_CONFIG_PROGRESS
   printf(" failed: no compatible matches\n");
 #endif 
@@ -847,17 +916,6 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
     if (con->sink->filter->input_fixed)
       if (con->sink->filter->input_fixed(con->sink->filter)) {
 	_ea_metas_data_zero(c->applied_metas);
-	eina_array_free(matches_compat);
-	eina_array_free(match_source);
-	eina_array_free(match_sink);
-	for(i=0;i<ea_count(copied);i++)
-	  free(ea_data(copied, i));
-	eina_array_free(copied);
-	eina_array_free(copy);
-	eina_array_free(restrictions);
-	//for(i=0;i<ea_count(trash);i++)
-	  //free(ea_data(trash, i));
-	eina_array_free(trash);
 #ifdef PRINT_CONFIG_PROGRESS
   printf(" failed: input fixed failed\n");
 #endif 
@@ -871,20 +929,8 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
       out = NULL;
     
     for(i=0;i<ea_count(match_source);i++) {
-      //printf("%d",i);   meta_print(global_meta_check); printf("\n");
       if (tunes_restrict(ea_data(match_source, i), ea_data(match_sink, i), restrictions, c)) {
 	_ea_metas_data_zero(c->applied_metas);
-	eina_array_free(matches_compat);
-	eina_array_free(match_source);
-	eina_array_free(match_sink);
-	for(i=0;i<ea_count(copied);i++)
-	  free(ea_data(copied, i));
-	eina_array_free(copied);
-	eina_array_free(copy);
-	eina_array_free(restrictions);
-	//for(i=0;i<ea_count(trash);i++)
-	  //free(ea_data(trash, i));
-	eina_array_free(trash);
 #ifdef PRINT_CONFIG_PROGRESS
   printf(" failed: tunes restrict failed\n");
 #endif 
@@ -892,8 +938,10 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
       }
     }
     
-    //FIXME clean on reconfiguration!
-    con->sink->filter->node->con_ch_in = eina_array_new(4);
+    if (con->sink->filter->node->con_ch_in)
+      eina_array_clean(con->sink->filter->node->con_ch_in);
+    else
+      con->sink->filter->node->con_ch_in = eina_array_new(4);
     
     for(i=0;i<ea_count(match_source);i++)
       if (((Meta*)ea_data(match_source, i))->type == MT_CHANNEL) {
@@ -926,7 +974,6 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
       con = NULL;
     
     pos++;
-    eina_array_free(matches_compat);
   }
   
   int j;
@@ -935,8 +982,8 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
   //fix tunings
   for(i=0;i<ea_count(restrictions);i++) {
     restr = ea_data(restrictions, i);
-    for(j=ea_count(restr->allowed_values)-1;j>=0;j--) {
-      if (ea_data(restr->allowed_values, j) && restr->remain > 1)
+    for(j=restr->allowed_count-1;j>=0;j--) {
+      if (restr->allowed_values[j] && restr->remain > 1)
 	restr_remove_value(restr, j);
     }
   }
@@ -945,8 +992,8 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
   //for the graph painting
   for(i=0;i<ea_count(restrictions);i++) {
     restr = ea_data(restrictions, i);
-    for(j=0;j<ea_count(restr->allowed_values);j++)
-      eina_array_data_set(restr->tune->select, j, ea_data(restr->allowed_values, j));
+    for(j=0;j<restr->allowed_count;j++)
+      eina_array_data_set(restr->tune->select, j, restr->allowed_values[j]);
     vizp_meta(file, restr->tune);
   }
   
@@ -954,16 +1001,6 @@ int test_filter_config_real(Filter *f, int write_graph, Config *c)
   vizp_stop(filters);
   }
   
-  eina_array_free(match_source);
-  eina_array_free(match_sink);
-  for(i=0;i<ea_count(copied);i++)
-    free(ea_data(copied, i));
-  eina_array_free(copied);
-  eina_array_free(copy);
-  eina_array_free(restrictions);
-  //for(i=0;i<ea_count(trash);i++)
-    //free(ea_data(trash, i));
-  eina_array_free(trash);
   
   return -1;
 }
@@ -1108,9 +1145,16 @@ Config *config_new(void)
   
   c->applied_metas = eina_array_new(8);
   c->succ_inserts = eina_inarray_new(sizeof(Config_Chain), 8);
-  c->config_meta_allocs = eina_array_new(1024);
-  c->config_allocs = eina_array_new(1024);
+  c->arena_chunks = eina_array_new(4);
+  c->arena_arrays = eina_array_new(256);
   c->new_fs = eina_array_new(8);
+  c->match_source = eina_array_new(8);
+  c->match_sink = eina_array_new(8);
+  c->copied = eina_array_new(8);
+  c->copy = eina_array_new(8);
+  c->matches_possible = eina_array_new(8);
+  c->matches_compat = eina_array_new(8);
+  c->restr_lookup = eina_array_new(8);
   
   return c;
 }
@@ -1119,9 +1163,19 @@ void config_del(Config *c)
 {
   eina_array_free(c->applied_metas);
   eina_inarray_free(c->succ_inserts);
-  eina_array_free(c->config_meta_allocs);
-  eina_array_free(c->config_allocs);
+  config_arena_release(c);
+  while (ea_count(c->arena_chunks))
+    free(ea_pop(c->arena_chunks));
+  eina_array_free(c->arena_chunks);
+  eina_array_free(c->arena_arrays);
   eina_array_free(c->new_fs);
+  eina_array_free(c->match_source);
+  eina_array_free(c->match_sink);
+  eina_array_free(c->copied);
+  eina_array_free(c->copy);
+  eina_array_free(c->matches_possible);
+  eina_array_free(c->matches_compat);
+  eina_array_free(c->restr_lookup);
   
   free(c);
 }
@@ -1238,12 +1292,7 @@ void filter_deconfigure(Filter *f)
   _ea_metas_data_zero(c->applied_metas);
   _f_undo_tunings_chain(f);
   
-  if (c->config_meta_allocs)
-    while (eina_array_count(c->config_meta_allocs))
-      meta_del(eina_array_pop(c->config_meta_allocs));
-  if (c->config_allocs)
-    while (eina_array_count(c->config_allocs))
-      free(eina_array_pop(c->config_allocs));
+  config_arena_release(c);
   
   if (!f->node->con_trees_in || ! ea_count(f->node->con_trees_in))
     return;
@@ -1282,26 +1331,58 @@ void _config_reset_internal(Filter *f)
   }
 }
 
-void lime_config_reset(Filter *f)
+//must hold the lock of the last filter
+static void _config_reset(Filter *f)
 {    
   Config *c = filter_chain_last_filter(f)->c;
   
-  if (!c) {
-    pthread_mutex_unlock(&f->lock);
+  if (!c)
     return;
-  }
   
   if (c->refcount) {
     printf("lime config reset: existing references to config!\n");
-    pthread_mutex_unlock(&f->lock);
     c->delete = EINA_TRUE;
     return;
   }
   _config_reset_internal(f);
 }
 
-//insert nop filters if necessary
-int lime_config_test(Filter *f_sink)
+//the config belongs to the last filter of the chain, so does the lock
+void lime_config_reset(Filter *f)
+{
+  Filter *last = filter_chain_last_filter(f);
+  
+  pthread_mutex_lock(&last->lock);
+  _config_reset(f);
+  pthread_mutex_unlock(&last->lock);
+}
+
+//keep existing config after a setting change which does not affect metas
+int lime_config_rehash(Filter *f)
+{
+  Filter *last = filter_chain_last_filter(f);
+  Config *c;
+  
+  pthread_mutex_lock(&last->lock);
+  
+  c = last->c;
+  
+  //only rehash an idle, valid config, else do the full reset
+  if (!c || !c->configured || c->refcount || c->delete || !f->hash.len) {
+    pthread_mutex_unlock(&last->lock);
+    return -1;
+  }
+  
+  //new hash for f and all following filters, prepare() is called on next render
+  filter_hash_recalc(f);
+  
+  pthread_mutex_unlock(&last->lock);
+  
+  return 0;
+}
+
+//insert nop filters if necessary, must hold the lock of the last filter
+static int _config_test(Filter *f_sink)
 {
   Eina_Array *insert_f;
   int err_pos_start;
@@ -1310,14 +1391,11 @@ int lime_config_test(Filter *f_sink)
   Filter *f = f_sink;
   Config *c;
   
-  pthread_mutex_lock(&filter_chain_last_filter(f_sink)->lock);
-  
   c = filter_chain_last_filter(f)->c;
   
   if (c && c->configured) {
     if (c->delete)
       printf("FIXME config test: already configured (delete: %d)!\n", c->delete);
-    pthread_mutex_unlock(&filter_chain_last_filter(f_sink)->lock);
     return 0;
   }
   if (!c) {
@@ -1366,6 +1444,7 @@ int lime_config_test(Filter *f_sink)
   //ea_push(insert_f, filter_core_loadraw.filter_new_f);
   ea_push(insert_f, filter_core_convert.filter_new_f);
   ea_push(insert_f, filter_core_loadtiff.filter_new_f);
+  ea_push(insert_f, filter_core_loadlime.filter_new_f);
   ea_push(insert_f, filter_core_fliprot.filter_new_f);
   ea_push(insert_f, filter_core_curves.filter_new_f);
   
@@ -1377,17 +1456,18 @@ int lime_config_test(Filter *f_sink)
       _config_reset_internal(f_sink);
       eina_array_free(cons);
       eina_array_free(insert_f);
-      pthread_mutex_unlock(&filter_chain_last_filter(f_sink)->lock);
       return -1;
     }
   }
    
-  /*printf("configured!!\n");
-  meta_print(global_meta_check);
-  printf("\n");*/
-  
   c->configured = 1;
   
+#ifdef DEBUG_OUT_GRAPH
+  config_optimize(f, c->new_fs, 1);
+#else
+  config_optimize(f, c->new_fs, 0);
+#endif
+  
   filter_hash_recalc(f);
   
   /*printf("[CONFIG] actual filter chain:\n");
@@ -1400,6 +1480,33 @@ int lime_config_test(Filter *f_sink)
   
   eina_array_free(cons);
   eina_array_free(insert_f);
-  pthread_mutex_unlock(&filter_chain_last_filter(f_sink)->lock);
   return 0;
 }
+
+int lime_config_test(Filter *f_sink)
+{
+  Filter *last = filter_chain_last_filter(f_sink);
+  int ret;
+  
+  pthread_mutex_lock(&last->lock);
+  ret = _config_test(f_sink);
+  pthread_mutex_unlock(&last->lock);
+  
+  return ret;
+}
+
+//configure and reference in one step, no reset can come in between
+//returns -1 without a reference if the configuration failed
+int lime_config_test_ref(Filter *f_sink)
+{
+  Filter *last = filter_chain_last_filter(f_sink);
+  int ret;
+  
+  pthread_mutex_lock(&last->lock);
+  ret = _config_test(f_sink);
+  if (!ret)
+    last->c->refcount++;
+  pthread_mutex_unlock(&last->lock);
+  
+  return ret;
+}
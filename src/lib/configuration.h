@@ -26,14 +26,30 @@
 struct _Config;
 typedef struct _Config Config;
 
+struct _Config_Batch;
+typedef struct _Config_Batch Config_Batch;
+
 #include "filter.h"
 
 int lime_config_test(Filter *f);
+int lime_config_test_ref(Filter *f);
 
 void lime_config_reset(Filter *f);
+int lime_config_rehash(Filter *f);
 void lime_config_node_add(Fg_Node *node);
 void lime_config_node_del(Fg_Node *node);
 void lime_filter_config_ref(Filter *f);
 void lime_filter_config_unref(Filter *f);
 
+//called from a batch worker thread after lime_config_test() of f
+typedef void (*Config_Batch_Cb)(void *data, Filter *f, int failed);
+
+Config_Batch *lime_config_batch_new(int threads);
+void lime_config_batch_add(Config_Batch *batch, Filter *f, Config_Batch_Cb cb, void *data);
+void lime_config_batch_wait(Config_Batch *batch);
+void lime_config_batch_del(Config_Batch *batch);
+
+FILE *vizp_start(char *path);
+void vizp_stop(FILE *f);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "diskcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define DISKCACHE_MAGIC "LIMEDC1"
+
+typedef struct {
+  char magic[8];
+  uint64_t hash; //path+size+mtime
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_nsec;
+  int32_t len;
+  int32_t pad;
+} _Header;
+
+static uint64_t _fnv(uint64_t h, const void *buf, int len)
+{
+  const uint8_t *p = buf;
+  int i;
+
+  for(i=0;i<len;i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  return h;
+}
+
+static int _key_get(const char *file, _Header *key)
+{
+  struct stat st;
+  char real[PATH_MAX];
+
+  if (!realpath(file, real) || stat(real, &st))
+    return -1;
+
+  memset(key, 0, sizeof(_Header));
+  memcpy(key->magic, DISKCACHE_MAGIC, sizeof(DISKCACHE_MAGIC));
+  key->size = st.st_size;
+  key->mtime = st.st_mtim.tv_sec;
+  key->mtime_nsec = st.st_mtim.tv_nsec;
+
+  key->hash = _fnv(0xcbf29ce484222325ULL, real, strlen(real));
+  key->hash = _fnv(key->hash, &key->size, sizeof(key->size));
+  key->hash = _fnv(key->hash, &key->mtime, sizeof(key->mtime));
+  key->hash = _fnv(key->hash, &key->mtime_nsec, sizeof(key->mtime_nsec));
+
+  return 0;
+}
+
+static int _mkdir(const char *path)
+{
+  if (mkdir(path, 0755) && errno != EEXIST)
+    return -1;
+
+  return 0;
+}
+
+//$XDG_CACHE_HOME/lime/kind or ~/.cache/lime/kind
+static int _dir_get(const char *kind, char *dir)
+{
+  const char *base = getenv("XDG_CACHE_HOME");
+
+  if (base && base[0])
+    snprintf(dir, PATH_MAX, "%s", base);
+  else if (getenv("HOME")) {
+    snprintf(dir, PATH_MAX, "%s/.cache", getenv("HOME"));
+    if (_mkdir(dir))
+      return -1;
+  }
+  else
+    return -1;
+
+  strncat(dir, "/lime", PATH_MAX-strlen(dir)-1);
+  if (_mkdir(dir))
+    return -1;
+
+  strncat(dir, "/", PATH_MAX-strlen(dir)-1);
+  strncat(dir, kind, PATH_MAX-strlen(dir)-1);
+  if (_mkdir(dir))
+    return -1;
+
+  return 0;
+}
+
+static char *_path(const char *kind, _Header *key, const char *ext)
+{
+  char dir[PATH_MAX];
+  char *path;
+
+  if (_dir_get(kind, dir))
+    return NULL;
+
+  path = malloc(strlen(dir)+32+(ext ? strlen(ext) : 0));
+  sprintf(path, "%s/%016llx%s", dir, (unsigned long long)key->hash, ext ? ext : "");
+
+  return path;
+}
+
+char *diskcache_path(const char *kind, const char *file, const char *ext)
+{
+  _Header key;
+
+  if (_key_get(file, &key))
+    return NULL;
+
+  return _path(kind, &key, ext);
+}
+
+void *diskcache_read(const char *kind, const char *file, int *len)
+{
+  _Header key, header;
+  char *path;
+  FILE *f;
+  void *buf;
+
+  if (_key_get(file, &key))
+    return NULL;
+
+  path = _path(kind, &key, ".bin");
+  if (!path)
+    return NULL;
+
+  f = fopen(path, "rb");
+  if (!f) {
+    free(path);
+    return NULL;
+  }
+
+  if (fread(&header, sizeof(_Header), 1, f) != 1
+      || memcmp(header.magic, key.magic, sizeof(header.magic))
+      || header.hash != key.hash || header.size != key.size
+      || header.mtime != key.mtime || header.mtime_nsec != key.mtime_nsec
+      || header.len < 0) {
+    fclose(f);
+    free(path);
+    return NULL;
+  }
+
+  buf = malloc(header.len);
+  if (fread(buf, 1, header.len, f) != header.len) {
+    free(buf);
+    fclose(f);
+    free(path);
+    return NULL;
+  }
+
+  fclose(f);
+  *len = header.len;
+
+  //hits count as use for diskcache_trim()
+  diskcache_touch(path);
+  free(path);
+
+  return buf;
+}
+
+//written to a temporary file and renamed, concurrent readers never see partial entries
+int diskcache_write(const char *kind, const char *file, const void *buf, int len)
+{
+  _Header key;
+  char *path, *tmp;
+  FILE *f;
+  int fd, fail = 0;
+
+  if (_key_get(file, &key))
+    return -1;
+
+  path = _path(kind, &key, ".bin");
+  if (!path)
+    return -1;
+
+  tmp = malloc(strlen(path)+8);
+  sprintf(tmp, "%s.XXXXXX", path);
+  fd = mkstemp(tmp);
+  if (fd == -1) {
+    free(tmp);
+    free(path);
+    return -1;
+  }
+
+  key.len = len;
+  f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    fail = 1;
+  }
+  else {
+    if (fwrite(&key, sizeof(_Header), 1, f) != 1 || fwrite(buf, 1, len, f) != len)
+      fail = 1;
+    if (fclose(f))
+      fail = 1;
+  }
+
+  if (fail || rename(tmp, path)) {
+    unlink(tmp);
+    free(tmp);
+    free(path);
+    return -1;
+  }
+
+  free(tmp);
+  free(path);
+
+  return 0;
+}
+
+//mtime is the last use, atime is unreliable with noatime/relatime mounts
+void diskcache_touch(const char *path)
+{
+  utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+typedef struct {
+  char *path;
+  long long size;
+  int64_t used;
+} _Entry;
+
+static int _entry_cmp(const void *a, const void *b)
+{
+  const _Entry *ea = a, *eb = b;
+
+  if (ea->used < eb->used)
+    return -1;
+  return ea->used > eb->used;
+}
+
+void diskcache_trim(const char *kind, const char *ext, long long max)
+{
+  char dir[PATH_MAX];
+  DIR *d;
+  struct dirent *ent;
+  struct stat st;
+  _Entry *entries = NULL;
+  int count = 0, size = 0, i, len;
+  long long total = 0;
+
+  if (_dir_get(kind, dir))
+    return;
+
+  d = opendir(dir);
+  if (!d)
+    return;
+
+  //only finished entries, temporary files of concurrent writers end in random chars
+  while ((ent = readdir(d))) {
+    len = strlen(ent->d_name);
+    if (len < strlen(ext) || strcmp(ent->d_name+len-strlen(ext), ext))
+      continue;
+    if (count == size) {
+      size = size ? size*2 : 64;
+      entries = realloc(entries, sizeof(_Entry)*size);
+    }
+    entries[count].path = malloc(strlen(dir)+len+2);
+    sprintf(entries[count].path, "%s/%s", dir, ent->d_name);
+    if (stat(entries[count].path, &st) || !S_ISREG(st.st_mode)) {
+      free(entries[count].path);
+      continue;
+    }
+    entries[count].size = st.st_size;
+    entries[count].used = st.st_mtim.tv_sec;
+    total += st.st_size;
+    count++;
+  }
+  closedir(d);
+
+  qsort(entries, count, sizeof(_Entry), _entry_cmp);
+
+  //unlinking entries which are still mapped by a reader is fine
+  for(i=0;i<count;i++) {
+    if (total > max && !unlink(entries[i].path))
+      total -= entries[i].size;
+    free(entries[i].path);
+  }
+
+  free(entries);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DISKCACHE_H
+#define _DISKCACHE_H
+
+/*
+ * persistent per-file cache of derived data (indices, transcoded copies...)
+ * entries are keyed by kind + path + size + mtime of the source file,
+ * a changed source file simply misses the cache
+ */
+
+//path of the cache entry for file, malloced, NULL if no cache dir is available
+char *diskcache_path(const char *kind, const char *file, const char *ext);
+//returns malloced content or NULL if there is no valid entry
+void *diskcache_read(const char *kind, const char *file, int *len);
+int diskcache_write(const char *kind, const char *file, const void *buf, int len);
+//marks the entry at path as used, for diskcache_trim()
+void diskcache_touch(const char *path);
+//removes the least recently used entries of kind ending in ext until at most max bytes remain
+void diskcache_trim(const char *kind, const char *ext, long long max);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encode_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+enum {
+  _SLOT_FREE = 0,
+  _SLOT_QUEUED,
+  _SLOT_ENCODING,
+  _SLOT_DONE,
+  _SLOT_FAILED
+};
+
+struct _Encode_Pool {
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond; //slot queued or shutdown
+  pthread_cond_t done_cond; //slot encoded or shutdown
+  pthread_cond_t free_cond; //slot committed
+  uint8_t *slots;
+  int slot_size;
+  uint8_t *states;
+  int slot_count;
+  uint64_t submitted;
+  uint64_t encoding;
+  uint64_t committed;
+  int failed;
+  int shutdown;
+  Encode_Pool_Funcs funcs;
+  void *data;
+  int thread_count;
+  pthread_t *threads;
+  pthread_t writer;
+  int writer_started;
+};
+
+static void *_slot(Encode_Pool *pool, uint64_t idx)
+{
+  return pool->slots + (idx % pool->slot_count)*pool->slot_size;
+}
+
+static void *_encoder(void *arg)
+{
+  Encode_Pool *pool = arg;
+  void *thread = NULL;
+  uint64_t idx;
+  int failed;
+
+  if (pool->funcs.thread_new)
+    thread = pool->funcs.thread_new(pool->data);
+
+  pthread_mutex_lock(&pool->lock);
+
+  while (1) {
+    while (pool->encoding == pool->submitted && !pool->shutdown)
+      pthread_cond_wait(&pool->job_cond, &pool->lock);
+
+    if (pool->encoding == pool->submitted)
+      break;
+
+    idx = pool->encoding++;
+    pool->states[idx % pool->slot_count] = _SLOT_ENCODING;
+
+    pthread_mutex_unlock(&pool->lock);
+    failed = pool->funcs.encode(pool->data, thread, _slot(pool, idx));
+    pthread_mutex_lock(&pool->lock);
+
+    pool->states[idx % pool->slot_count] = failed ? _SLOT_FAILED : _SLOT_DONE;
+    pthread_cond_broadcast(&pool->done_cond);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  if (pool->funcs.thread_del)
+    pool->funcs.thread_del(pool->data, thread);
+
+  return NULL;
+}
+
+static void *_writer(void *arg)
+{
+  Encode_Pool *pool = arg;
+  uint8_t *state;
+  int failed;
+
+  pthread_mutex_lock(&pool->lock);
+
+  while (1) {
+    state = &pool->states[pool->committed % pool->slot_count];
+    while ((pool->committed == pool->submitted || *state < _SLOT_DONE) && !(pool->shutdown && pool->committed == pool->submitted))
+      pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+    if (pool->committed == pool->submitted)
+      break;
+
+    failed = *state == _SLOT_FAILED;
+    pool->failed += failed;
+
+    pthread_mutex_unlock(&pool->lock);
+    if (pool->funcs.commit)
+      pool->funcs.commit(pool->data, _slot(pool, pool->committed), failed);
+    pthread_mutex_lock(&pool->lock);
+
+    *state = _SLOT_FREE;
+    pool->committed++;
+    pthread_cond_broadcast(&pool->free_cond);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+Encode_Pool *encode_pool_new(int threads, int slots_per_thread, int slot_size, const Encode_Pool_Funcs *funcs, void *data)
+{
+  int i;
+  Encode_Pool *pool = calloc(sizeof(Encode_Pool), 1);
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+
+  pool->funcs = *funcs;
+  pool->data = data;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->job_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pthread_cond_init(&pool->free_cond, NULL);
+
+  pool->slot_count = threads*slots_per_thread;
+  pool->slot_size = slot_size;
+  pool->slots = calloc(slot_size, pool->slot_count);
+  pool->states = calloc(1, pool->slot_count);
+  if (pool->funcs.slot_init)
+    for(i=0;i<pool->slot_count;i++)
+      pool->funcs.slot_init(data, _slot(pool, i));
+
+  pool->threads = malloc(sizeof(pthread_t)*threads);
+  for(i=0;i<threads;i++) {
+    if (pthread_create(&pool->threads[i], NULL, &_encoder, pool)) {
+      printf("encode pool: could only start %d of %d encoder threads\n", i, threads);
+      break;
+    }
+    pool->thread_count++;
+  }
+
+  if (pool->thread_count && !pthread_create(&pool->writer, NULL, &_writer, pool))
+    pool->writer_started = 1;
+  else {
+    encode_pool_del(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+void *encode_pool_slot_get(Encode_Pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->submitted - pool->committed >= pool->slot_count)
+    pthread_cond_wait(&pool->free_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  //free slots are only touched by the (single) submitting thread
+  return _slot(pool, pool->submitted);
+}
+
+void encode_pool_submit(Encode_Pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->states[pool->submitted % pool->slot_count] = _SLOT_QUEUED;
+  pool->submitted++;
+  pthread_cond_signal(&pool->job_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void encode_pool_drain(Encode_Pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->committed < pool->submitted)
+    pthread_cond_wait(&pool->free_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int encode_pool_del(Encode_Pool *pool)
+{
+  int i, failed;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->job_cond);
+  pthread_cond_broadcast(&pool->done_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i=0;i<pool->thread_count;i++)
+    pthread_join(pool->threads[i], NULL);
+  if (pool->writer_started)
+    pthread_join(pool->writer, NULL);
+
+  if (pool->funcs.slot_del)
+    for(i=0;i<pool->slot_count;i++)
+      pool->funcs.slot_del(pool->data, _slot(pool, i));
+
+  failed = pool->failed;
+  free(pool->slots);
+  free(pool->states);
+  free(pool->threads);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->job_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->free_cond);
+  free(pool);
+
+  return failed;
+}
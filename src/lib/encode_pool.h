@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ENCODE_POOL_H
+#define _ENCODE_POOL_H
+
+/*
+ * ring of slots encoded by a pool of threads and committed in submission
+ * order by a single writer thread, used by the savers. slots are filled by
+ * one submitting thread, which blocks while all slots are in use
+ */
+
+typedef struct _Encode_Pool Encode_Pool;
+
+typedef struct {
+  void (*slot_init)(void *data, void *slot); //may be NULL
+  void (*slot_del)(void *data, void *slot); //may be NULL
+  void *(*thread_new)(void *data); //per encoder thread state, may be NULL
+  void (*thread_del)(void *data, void *thread); //may be NULL
+  //returns -1 on failure, the slot is still committed
+  int (*encode)(void *data, void *thread, void *slot);
+  //in submission order, may be NULL
+  void (*commit)(void *data, void *slot, int failed);
+} Encode_Pool_Funcs;
+
+//threads <= 0: one encoder per cpu, NULL if no thread could be started
+Encode_Pool *encode_pool_new(int threads, int slots_per_thread, int slot_size, const Encode_Pool_Funcs *funcs, void *data);
+//next slot to fill, blocks until it is free
+void *encode_pool_slot_get(Encode_Pool *pool);
+//queues the slot from the last encode_pool_slot_get()
+void encode_pool_submit(Encode_Pool *pool);
+//waits until every submitted slot is committed
+void encode_pool_drain(Encode_Pool *pool);
+//commits all submitted slots first, returns the number of failed encodes
+int encode_pool_del(Encode_Pool *pool);
+
+#endif
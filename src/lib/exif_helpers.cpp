@@ -18,16 +18,195 @@
  */
 
 #include <exiv2/exiv2.hpp>
+#include <Eina.h>
+#include <map>
+#include <string>
 #include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "exif_helpers.h"
 
+extern "C" {
+#include "diskcache.h"
+}
+
 struct _lime_exif {
   const char *path;
   Exiv2::Image::AutoPtr img;
   pthread_mutex_t lock;
+  int record_loaded;
+  lime_exif_record record;
 };
 
+typedef struct {
+  const char *dir;
+  char **names;
+  int count;
+  int next;
+  int parsed;
+} _Index_Job;
+
+#define INDEX_QUEUE_MAX 64
+//size limit of the parsed records in the disk cache
+#define EXIF_CACHE_MAX (32LL*1024*1024)
+
+//process wide background indexer, one directory at a time
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *queue[INDEX_QUEUE_MAX];
+  int count;
+  char *current;
+  int running;
+  int shutdown;
+  pthread_t thread;
+} _indexer = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+//directory mtime at the last indexing, unchanged directories are skipped
+static std::map<std::string, time_t> _indexed;
+
+static pthread_once_t _xmp_once = PTHREAD_ONCE_INIT;
+
+//the xmp toolkit init is not threadsafe, do it once before parsing in parallel
+static void _xmp_init(void)
+{
+  Exiv2::XmpParser::initialize();
+}
+
+static void _str_set(char *dst, const std::string &str)
+{
+  strncpy(dst, str.c_str(), LIME_EXIF_STR_MAX-1);
+  dst[LIME_EXIF_STR_MAX-1] = '\0';
+}
+
+//offset of the tiff header the exif offsets are relative to, -1 if unknown
+static long _tiff_base(const char *path)
+{
+  uint8_t buf[65536];
+  FILE *f = fopen(path, "rb");
+  int len, pos, seg_len;
+
+  if (!f)
+    return -1;
+  len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  if (len >= 4 && (!memcmp(buf, "II", 2) || !memcmp(buf, "MM", 2)))
+    return 0;
+
+  if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+    return -1;
+
+  //walk the jpeg segments up to the exif app1
+  pos = 2;
+  while (pos + 10 <= len && buf[pos] == 0xFF) {
+    if (buf[pos+1] == 0xDA || buf[pos+1] == 0xD9)
+      return -1;
+    seg_len = (buf[pos+2] << 8) | buf[pos+3];
+    if (buf[pos+1] == 0xE1 && !memcmp(buf+pos+4, "Exif\0\0", 6))
+      return pos + 10;
+    pos += 2 + seg_len;
+  }
+
+  return -1;
+}
+
+static void _record_parse(const char *path, lime_exif_record *rec)
+{
+  Exiv2::Image::AutoPtr img;
+  long base, thumb_offset = -1, thumb_len = 0;
+  int orientation = 1;
+
+  memset(rec, 0, sizeof(lime_exif_record));
+  rec->version = LIME_EXIF_RECORD_VERSION;
+  rec->focal_length = -1.0;
+  rec->focus_distance = -1.0;
+  rec->f_number = -1.0;
+  rec->orientation = 1;
+
+  pthread_once(&_xmp_once, &_xmp_init);
+
+  try {
+    img = Exiv2::ImageFactory::open(path);
+    assert(img.get() != 0);
+    img->readMetadata();
+  }
+  catch (...) {
+    return;
+  }
+
+  Exiv2::ExifData &exifData = img->exifData();
+  if (exifData.empty())
+    return;
+  rec->valid = 1;
+
+  //single pass, the first matching tag wins like with the by-tagname lookups
+  Exiv2::ExifData::const_iterator end = exifData.end();
+  for (Exiv2::ExifData::const_iterator i = exifData.begin(); i != end; ++i) {
+    std::string name = i->tagName();
+
+    if (i->typeId() == Exiv2::unsignedByte || i->typeId() == Exiv2::asciiString) {
+      if (!name.compare("Make") && !rec->make[0])
+        _str_set(rec->make, i->print(&exifData));
+      else if (!name.compare("Model") && !rec->model[0])
+        _str_set(rec->model, i->print(&exifData));
+      else if (!name.compare("LensType") && !rec->lens_type[0])
+        _str_set(rec->lens_type, i->print(&exifData));
+      else if (!name.compare("LensModel") && !rec->lens_model[0])
+        _str_set(rec->lens_model, i->print(&exifData));
+    }
+    else if (i->typeId() == Exiv2::unsignedRational) {
+      if (!name.compare("FocalLength") && rec->focal_length == -1.0)
+        rec->focal_length = i->getValue()->toFloat();
+      else if (!name.compare("FocusDistance") && rec->focus_distance == -1.0)
+        rec->focus_distance = i->getValue()->toFloat();
+      else if (!name.compare("FNumber") && rec->f_number == -1.0)
+        rec->f_number = i->getValue()->toFloat();
+    }
+    else if (!i->key().compare("Exif.Image.Orientation"))
+      orientation = i->getValue()->toLong();
+    else if (!i->key().compare("Exif.Thumbnail.JPEGInterchangeFormat"))
+      thumb_offset = i->getValue()->toLong();
+    else if (!i->key().compare("Exif.Thumbnail.JPEGInterchangeFormatLength"))
+      thumb_len = i->getValue()->toLong();
+  }
+
+  if (orientation >= 1 && orientation <= 8)
+    rec->orientation = orientation;
+
+  if (thumb_offset > 0 && thumb_len > 0) {
+    base = _tiff_base(path);
+    if (base >= 0) {
+      rec->thumb_offset = base + thumb_offset;
+      rec->thumb_len = thumb_len;
+    }
+  }
+}
+
+//returns 1 if the file had to be parsed, 0 on a cache hit, parsed records are saved
+static int _record_load(const char *path, lime_exif_record *rec)
+{
+  lime_exif_record *cached;
+  int len;
+
+  cached = (lime_exif_record*)diskcache_read("exif", path, &len);
+  if (cached && len == sizeof(lime_exif_record) && cached->version == LIME_EXIF_RECORD_VERSION) {
+    *rec = *cached;
+    free(cached);
+    return 0;
+  }
+  free(cached);
+
+  _record_parse(path, rec);
+  diskcache_write("exif", path, rec, sizeof(lime_exif_record));
+
+  return 1;
+}
+
 lime_exif *lime_exif_handle_new_from_file(const char *path)
 {
   lime_exif *h = (lime_exif*)calloc(sizeof(lime_exif), 1);
@@ -38,23 +217,115 @@ lime_exif *lime_exif_handle_new_from_file(const char *path)
   return h;
 }
 
-float lime_exif_handle_find_float_by_tagname(lime_exif *h, const char *tagname)
+static lime_exif_record *_record_get_locked(lime_exif *h)
+{
+  if (!h->record_loaded) {
+    _record_load(h->path, &h->record);
+    h->record_loaded = 1;
+  }
+
+  return &h->record;
+}
+
+const lime_exif_record *lime_exif_record_get(lime_exif *h)
 {
+  lime_exif_record *rec;
+
   pthread_mutex_lock(&h->lock);
+  rec = _record_get_locked(h);
+  pthread_mutex_unlock(&h->lock);
+
+  return rec;
+}
+
+//orientation tag of an image in memory (e.g. a raw preview), 0 if there is none
+int lime_exif_orientation_mem(const uint8_t *buf, long len)
+{
+  Exiv2::Image::AutoPtr img;
+  int orientation = 0;
+
+  try {
+    img = Exiv2::ImageFactory::open(buf, len);
+    assert(img.get() != 0);
+    img->readMetadata();
+
+    Exiv2::ExifData &exifData = img->exifData();
+    Exiv2::ExifData::const_iterator i = exifData.findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+    if (i != exifData.end())
+      orientation = i->getValue()->toLong();
+  }
+  catch (...) {
+    return 0;
+  }
+
+  if (orientation < 1 || orientation > 8)
+    return 0;
+
+  return orientation;
+}
+
+static const float *_record_float(lime_exif_record *rec, const char *tagname)
+{
+  if (!strcmp(tagname, "FocalLength"))
+    return &rec->focal_length;
+  if (!strcmp(tagname, "FocusDistance"))
+    return &rec->focus_distance;
+  if (!strcmp(tagname, "FNumber"))
+    return &rec->f_number;
+
+  return NULL;
+}
+
+static const char *_record_str(lime_exif_record *rec, const char *tagname)
+{
+  if (!strcmp(tagname, "Make"))
+    return rec->make;
+  if (!strcmp(tagname, "Model"))
+    return rec->model;
+  if (!strcmp(tagname, "LensType"))
+    return rec->lens_type;
+  if (!strcmp(tagname, "LensModel"))
+    return rec->lens_model;
+
+  return NULL;
+}
+
+//tags outside of the record still need the full exif data
+static int _img_open_locked(lime_exif *h)
+{
   if (!h->img.get()) {
     try {
       h->img = Exiv2::ImageFactory::open(h->path);
     }
     catch (...) {
-      pthread_mutex_unlock(&h->lock);
-      return -1.0;
+      return -1;
     }
     assert(h->img.get() != 0);
     h->img->readMetadata();
   }
+
+  return 0;
+}
+
+float lime_exif_handle_find_float_by_tagname(lime_exif *h, const char *tagname)
+{
+  const float *val;
+  float res;
+
+  pthread_mutex_lock(&h->lock);
+  val = _record_float(_record_get_locked(h), tagname);
+  if (val) {
+    res = *val;
+    pthread_mutex_unlock(&h->lock);
+    return res;
+  }
+
+  if (_img_open_locked(h)) {
+    pthread_mutex_unlock(&h->lock);
+    return -1.0;
+  }
   
   Exiv2::ExifData &exifData = h->img->exifData();
-  assert (!exifData.empty());
   
   Exiv2::ExifData::const_iterator end = exifData.end();
   for (Exiv2::ExifData::const_iterator i = exifData.begin(); i != end; ++i)
@@ -69,19 +340,21 @@ float lime_exif_handle_find_float_by_tagname(lime_exif *h, const char *tagname)
 
 char *lime_exif_handle_find_str_by_tagname(lime_exif *h, const char *tagname)
 {
-  pthread_mutex_lock(&h->lock);
   std::string str;
+  const char *val;
   char *c_str;
-  if (!h->img.get()) {
-    try {
-      h->img = Exiv2::ImageFactory::open(h->path);
-    }
-    catch (...) {
-      pthread_mutex_unlock(&h->lock);
-      return NULL;
-    }
-    assert(h->img.get() != 0);
-    h->img->readMetadata();
+
+  pthread_mutex_lock(&h->lock);
+  val = _record_str(_record_get_locked(h), tagname);
+  if (val) {
+    c_str = val[0] ? strdup(val) : NULL;
+    pthread_mutex_unlock(&h->lock);
+    return c_str;
+  }
+
+  if (_img_open_locked(h)) {
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
   }
   
   Exiv2::ExifData &exifData = h->img->exifData();
@@ -108,10 +381,201 @@ void lime_exif_handle_destroy(lime_exif *h)
   if (h->img.get())
     h->img.reset();
   
+  pthread_mutex_destroy(&h->lock);
   free(h);
 }
+
+static void *_index_worker(void *arg)
+{
+  _Index_Job *job = (_Index_Job*)arg;
+  lime_exif_record rec;
+  char *path;
+  int i;
+
+  while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count && !_indexer.shutdown) {
+    path = (char*)malloc(strlen(job->dir)+strlen(job->names[i])+2);
+    sprintf(path, "%s/%s", job->dir, job->names[i]);
+    if (_record_load(path, &rec))
+      __sync_fetch_and_add(&job->parsed, 1);
+    free(path);
+  }
+
+  return NULL;
+}
+
+//parse the exif data of all images in dir into the diskcache, returns the number of files that were parsed
+int lime_exif_index_dir(const char *dir, int threads)
+{
+  _Index_Job job;
+  pthread_t *workers;
+  struct dirent *ent;
+  struct stat st;
+  char *path;
+  DIR *d;
+  int i, size = 64;
+
+  d = opendir(dir);
+  if (!d)
+    return -1;
+
+  memset(&job, 0, sizeof(_Index_Job));
+  job.dir = dir;
+  job.names = (char**)malloc(sizeof(char*)*size);
+
+  while ((ent = readdir(d))) {
+    if (ent->d_name[0] == '.')
+      continue;
+    path = (char*)malloc(strlen(dir)+strlen(ent->d_name)+2);
+    sprintf(path, "%s/%s", dir, ent->d_name);
+    //only image types exiv2 knows, so the cache is not filled with sidecars
+    if (stat(path, &st) || !S_ISREG(st.st_mode) || Exiv2::ImageFactory::getType(path) == Exiv2::ImageType::none) {
+      free(path);
+      continue;
+    }
+    free(path);
+    if (job.count == size) {
+      size *= 2;
+      job.names = (char**)realloc(job.names, sizeof(char*)*size);
+    }
+    job.names[job.count++] = strdup(ent->d_name);
+  }
+  closedir(d);
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > job.count)
+    threads = job.count;
+
+  pthread_once(&_xmp_once, &_xmp_init);
+
+  workers = (pthread_t*)malloc(sizeof(pthread_t)*(threads ? threads : 1));
+  for(i=0;i<threads;i++)
+    pthread_create(&workers[i], NULL, &_index_worker, &job);
+  for(i=0;i<threads;i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+
+  for(i=0;i<job.count;i++)
+    free(job.names[i]);
+  free(job.names);
+
+  //once per directory, records saved by loaders are trimmed with the next one
+  if (job.parsed)
+    diskcache_trim("exif", ".bin", EXIF_CACHE_MAX);
+
+  return job.parsed;
+}
+
+static void *_indexer_run(void *arg)
+{
+  struct stat st;
+  time_t mtime;
+  
+  eina_sched_prio_drop();
+  
+  pthread_mutex_lock(&_indexer.lock);
+  
+  while (1) {
+    while (!_indexer.count && !_indexer.shutdown)
+      pthread_cond_wait(&_indexer.cond, &_indexer.lock);
+    
+    if (_indexer.shutdown)
+      break;
+    
+    _indexer.current = _indexer.queue[0];
+    _indexer.count--;
+    memmove(_indexer.queue, _indexer.queue+1, sizeof(char*)*_indexer.count);
+    
+    pthread_mutex_unlock(&_indexer.lock);
+    
+    mtime = stat(_indexer.current, &st) ? 0 : st.st_mtime;
+    if (!mtime || !_indexed.count(_indexer.current) || _indexed[_indexer.current] != mtime) {
+      lime_exif_index_dir(_indexer.current, 0);
+      if (mtime && !_indexer.shutdown)
+        _indexed[_indexer.current] = mtime;
+    }
+    
+    pthread_mutex_lock(&_indexer.lock);
+    free(_indexer.current);
+    _indexer.current = NULL;
+  }
+  
+  pthread_mutex_unlock(&_indexer.lock);
+  
+  return NULL;
+}
+
+//queue dir for indexing in the background, already queued directories are ignored
+//if the queue is full the oldest request is dropped
+int lime_exif_index_queue(const char *dir)
+{
+  int i;
   
+  pthread_mutex_lock(&_indexer.lock);
   
+  if (_indexer.shutdown) {
+    pthread_mutex_unlock(&_indexer.lock);
+    return -1;
+  }
+  
+  if (_indexer.current && !strcmp(_indexer.current, dir)) {
+    pthread_mutex_unlock(&_indexer.lock);
+    return 0;
+  }
+  for(i=0;i<_indexer.count;i++)
+    if (!strcmp(_indexer.queue[i], dir)) {
+      pthread_mutex_unlock(&_indexer.lock);
+      return 0;
+    }
+  
+  if (_indexer.count == INDEX_QUEUE_MAX) {
+    free(_indexer.queue[0]);
+    _indexer.count--;
+    memmove(_indexer.queue, _indexer.queue+1, sizeof(char*)*_indexer.count);
+  }
+  _indexer.queue[_indexer.count++] = strdup(dir);
+  
+  if (!_indexer.running) {
+    if (pthread_create(&_indexer.thread, NULL, &_indexer_run, NULL)) {
+      free(_indexer.queue[--_indexer.count]);
+      pthread_mutex_unlock(&_indexer.lock);
+      return -1;
+    }
+    _indexer.running = 1;
+  }
+  
+  pthread_cond_signal(&_indexer.cond);
+  pthread_mutex_unlock(&_indexer.lock);
+  
+  return 0;
+}
+
+//the indexer accepts directories again after a lime_exif_index_shutdown()
+void lime_exif_index_init(void)
+{
+  pthread_mutex_lock(&_indexer.lock);
+  _indexer.shutdown = 0;
+  pthread_mutex_unlock(&_indexer.lock);
+}
+
+//drops queued directories and waits for the current one to be aborted
+void lime_exif_index_shutdown(void)
+{
+  int i;
+  
+  pthread_mutex_lock(&_indexer.lock);
+  _indexer.shutdown = 1;
+  for(i=0;i<_indexer.count;i++)
+    free(_indexer.queue[i]);
+  _indexer.count = 0;
+  pthread_cond_signal(&_indexer.cond);
+  pthread_mutex_unlock(&_indexer.lock);
+  
+  if (_indexer.running)
+    pthread_join(_indexer.thread, NULL);
+  _indexer.running = 0;
+}
+
 static inline int strlen_null(const char *str)
 {
   if (!str)
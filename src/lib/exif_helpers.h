@@ -19,10 +19,31 @@
 #ifndef _EXIF_HELPERS_H
 #define _EXIF_HELPERS_H
 
+#include <stdint.h>
+
 struct _lime_exif_handle;
   
 typedef struct _lime_exif lime_exif; 
 
+#define LIME_EXIF_RECORD_VERSION 1
+#define LIME_EXIF_STR_MAX 128
+
+//everything lime needs from the exif data, parsed once per file and kept in the diskcache
+typedef struct {
+  int32_t version;
+  int32_t valid; //0 if the file has no readable exif data
+  char make[LIME_EXIF_STR_MAX];
+  char model[LIME_EXIF_STR_MAX];
+  char lens_type[LIME_EXIF_STR_MAX];
+  char lens_model[LIME_EXIF_STR_MAX];
+  float focal_length; //-1 if not available
+  float focus_distance;
+  float f_number;
+  int32_t orientation; //1-8
+  uint32_t thumb_offset; //embedded jpeg thumbnail, absolute offset in the file
+  uint32_t thumb_len; //0 if there is none
+} lime_exif_record;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,9 +54,15 @@ float lime_exif_handle_find_float_by_tagname(lime_exif *h, const char *tagname);
 char *lime_exif_handle_find_str_by_tagname(lime_exif *h, const char *tagname);
 char *lime_exif_model_make_string(lime_exif *h);
 char *lime_exif_lens_string(lime_exif *h);
+const lime_exif_record *lime_exif_record_get(lime_exif *h);
+int lime_exif_orientation_mem(const uint8_t *buf, long len);
+int lime_exif_index_dir(const char *dir, int threads);
+int lime_exif_index_queue(const char *dir);
+void lime_exif_index_init(void);
+void lime_exif_index_shutdown(void);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
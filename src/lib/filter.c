@@ -118,6 +118,18 @@ int lime_setting_type_get(Filter *f, const char *setting)
   return -1;
 }
 
+static void _setting_changed(Filter *f, Meta *setting)
+{
+  if (f->setting_changed)
+    f->setting_changed(f);
+  
+  if (meta_flag_get(setting, MT_FLAG_SETTING_NOCONFIG) && !lime_config_rehash(f))
+    return;
+  
+  filter_hash_invalidate(f);
+  lime_config_reset(f);
+}
+
 int lime_setting_float_set(Filter *f, const char *setting, float value)
 {
   int i;
@@ -132,12 +144,7 @@ int lime_setting_float_set(Filter *f, const char *setting, float value)
       assert(m->data);
       *(float*)m->data = value;
       
-      filter_hash_invalidate(f);
-      
-      if (f->setting_changed)
-	f->setting_changed(f);
-      
-      lime_config_reset(f);
+      _setting_changed(f, m);
       
       return 0;
     }
@@ -271,12 +278,8 @@ int lime_setting_int_set(Filter *f, const char *setting, int value)
       assert(m->data);
       *(int*)m->data = value;
       
-      filter_hash_invalidate(f);
+      _setting_changed(f, m);
       
-      if (f->setting_changed)
-        f->setting_changed(f);
-      
-      lime_config_reset(f);
       return 0;
     }
   }
@@ -300,12 +303,8 @@ int lime_setting_string_set(Filter *f, const char *setting, const char *value)
     if (!strcmp(setting, m->name)) {
       m->data = str;
       
-      filter_hash_invalidate(f);
-      
-      if (f->setting_changed)
-	f->setting_changed(f);
+      _setting_changed(f, m);
       
-      lime_config_reset(f);
       return 0;
     }
   }
@@ -135,6 +135,7 @@ static Filter *_f_lightness_new(Filter_Core *fc, void worker_func(Filter *f, Ein
   //setting
   setting = meta_new_data(MT_FLOAT, filter, &data->c);
   meta_name_set(setting, fc->shortname);
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, filter, malloc(sizeof(float)));
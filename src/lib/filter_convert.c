@@ -17,6 +17,8 @@
  * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+
 #include "filter_convert.h"
 #include "lcms2.h"
 #include "libswscale/swscale.h"
@@ -27,6 +29,8 @@ static Eina_Array *select_color = NULL;
 static Eina_Array *color1 = NULL;
 static Eina_Array *color2 = NULL;
 static Eina_Array *color3 = NULL;
+//filters may be created from concurrent configurations
+static pthread_once_t selects_once = PTHREAD_ONCE_INIT;
 
 typedef struct {
   int initialized;
@@ -430,6 +434,37 @@ static void color3_tune_calc(Meta *tune, Meta *m)
 }
 
 
+static void _selects_init(void)
+{
+  select_bitdepth = eina_array_new(2);
+  pushint(select_bitdepth, BD_U16);
+  pushint(select_bitdepth, BD_U8);
+  
+  select_color = eina_array_new(4);
+  pushint(select_color, CS_LAB);
+  pushint(select_color, CS_RGB);
+  //pushint(select_color, CS_YUV);
+  //pushint(select_color, CS_HSV);
+  
+  color1 = eina_array_new(4);
+  pushint(color1, CS_LAB_L);
+  pushint(color1, CS_RGB_R);
+  //pushint(color1, CS_YUV_Y);
+  //pushint(color1, CS_HSV_V);
+  
+  color2 = eina_array_new(4);
+  pushint(color2, CS_LAB_A);
+  pushint(color2, CS_RGB_G);
+  //pushint(color2, CS_YUV_U);
+  //pushint(color2, CS_HSV_H);
+  
+  color3 = eina_array_new(4);
+  pushint(color3, CS_LAB_B);
+  pushint(color3, CS_RGB_B);
+  //pushint(color3, CS_YUV_V);
+  //pushint(color3, CS_HSV_S);
+}
+
 Filter *filter_convert_new(void)
 {
   Filter *filter = filter_new(&filter_core_convert);
@@ -450,35 +485,7 @@ Filter *filter_convert_new(void)
   
   Meta *ch_out[3];
   
-  if (!select_bitdepth) {
-    select_bitdepth = eina_array_new(2);
-    pushint(select_bitdepth, BD_U16);
-    pushint(select_bitdepth, BD_U8);
-    
-    select_color = eina_array_new(4);
-    pushint(select_color, CS_LAB);
-    pushint(select_color, CS_RGB);
-    //pushint(select_color, CS_YUV);
-    //pushint(select_color, CS_HSV);
-    
-    color1 = eina_array_new(4);
-    pushint(color1, CS_LAB_L);
-    pushint(color1, CS_RGB_R);
-    //pushint(color1, CS_YUV_Y);
-    //pushint(color1, CS_HSV_V);
-    
-    color2 = eina_array_new(4);
-    pushint(color2, CS_LAB_A);
-    pushint(color2, CS_RGB_G);
-    //pushint(color2, CS_YUV_U);
-    //pushint(color2, CS_HSV_H);
-    
-    color3 = eina_array_new(4);
-    pushint(color3, CS_LAB_B);
-    pushint(color3, CS_RGB_B);
-    //pushint(color3, CS_YUV_V);
-    //pushint(color3, CS_HSV_S);
-  }
+  pthread_once(&selects_once, &_selects_init);
   
   tune_out_bitdepth = meta_new_select(MT_BITDEPTH, filter, select_bitdepth);
   meta_name_set(tune_out_bitdepth, "Output Bitdepth");
@@ -271,6 +271,7 @@ static Filter *_new(void)
   setting = meta_new_data(MT_FLOAT, f, &data->exp);
   data->exp = 0.0;
   meta_name_set(setting, "exposure compensation");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -286,6 +287,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->compress);
   meta_name_set(setting, "highlight compression");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -301,6 +303,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->clip);
   meta_name_set(setting, "highlight clipping");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -316,6 +319,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->x1);
   meta_name_set(setting, "x1");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -336,6 +340,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->y1);
   meta_name_set(setting, "y1");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -356,6 +361,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->x2);
   meta_name_set(setting, "x2");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -376,6 +382,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->y2);
   meta_name_set(setting, "y2");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -653,6 +653,7 @@ static Filter *filter_denoise_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, filter, data->max_diff);
   meta_name_set(setting, "luma");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, filter, malloc(sizeof(float)));
@@ -668,6 +669,7 @@ static Filter *filter_denoise_new(void)
  //setting
   setting = meta_new_data(MT_FLOAT, filter, data->max_diff_c);
   meta_name_set(setting, "chroma");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, filter, malloc(sizeof(float)));
@@ -683,6 +685,7 @@ static Filter *filter_denoise_new(void)
   //setting
   setting = meta_new_data(MT_INT, filter, data->iters);
   meta_name_set(setting, "iterations");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
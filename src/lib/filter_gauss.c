@@ -310,6 +310,7 @@ Filter *filter_gauss_blur_new(void)
     
   setting = meta_new_data(MT_FLOAT, filter, data->sigma);
   meta_name_set(setting, "sigma");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, filter, malloc(sizeof(int)));
@@ -317,8 +317,6 @@ static Filter *filter_deinterleave_new(void)
   //FIXME should drop anything attached here!
   tune_color->replace = color_out_first;
   data->colorspace = tune_color;
-  //printf("Input Colorspace: %p\n", tune_color);
-  global_meta_check = tune_color;
   
   eina_array_push(filter->tune, tune_color);
   
@@ -19,19 +19,32 @@
 
 #include "filter_loadjpeg.h"
 
-#include <libexif/exif-data.h>
 #include <jpeglib.h>
 #include <setjmp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//the avx2 marker scan is compiled independent of the build flags, used if the cpu has it
+#if defined(__x86_64__) || defined(__i386__)
+#define JPEG_FF_AVX2
+#include <immintrin.h>
+#endif
 
 #define JPEG_TILE_WIDTH 256
 #define JPEG_TILE_HEIGHT 256
+//restart interval width of the transcoded copies, tiles decode one interval of halo on each side
+#define JPEG_RST_WIDTH 32
+//size limit of the transcoded copies in the disk cache
+#define JPEG_RST_CACHE_MAX (2048LL*1024*1024)
+//size limit of the restart marker indices in the disk cache
+#define JPEG_INDEX_CACHE_MAX (128LL*1024*1024)
 
 #include "jpeglib.h"
 #include "jerror.h"
-#include <libexif/exif-loader.h>
-
+#include "diskcache.h"
+#include "exif_helpers.h"
 
-/* Expanded data source object for stdio input */
 
 typedef struct {
   int error;
@@ -43,517 +56,362 @@ typedef struct {
   Meta *fliprot;
   Meta *input;
   Meta *dim;
-  int *size_pos;
   int rot;
   int seekable;
   int mcu_w, mcu_h;
   int w, h;
   int iw, ih;
   int rst_int;
+  uint8_t *map; //whole file, mapped on input_fixed
+  size_t map_size;
+  uint8_t *tables; //tables-only datastream: SOI DQT/DHT EOI
+  int tables_len;
+  uint8_t *frame; //SOF DRI SOS of the abbreviated tile datastreams
+  int frame_len;
+  int tables_gen; //changes with the input, decoders reload the tables
+  char *rst_copy; //restart enabled copy in the disk cache
+  int rst_pending; //copy is made on the first seeking tile request
+  int rst_failed; //no copy could be made, tiles are cut from whole decodes
+  uint8_t *seek_map; //tiles are cut from this, the file or its copy
+  size_t seek_map_size;
 } _Common;
 
+struct _Dec;
+
 typedef struct {
   _Common *common;
-  int file_pos;
   int comp_count;
-  int serve_ix;
-  int serve_iy;
   int serve_minx;
   int serve_miny;
   int serve_maxx;
   int serve_maxy;
-  int serve_fakejpg;
-  int serve_bytes;
   int serve_width;
   int serve_height;
-  int rst_next;;
+  struct _Dec *dec; //per thread
 } _Data;
 
-typedef struct {
-  struct jpeg_source_mgr pub; /* public fields */
+//orientation and thumbnail location come from the exif record, parsed once per file
+static void get_exif_stuff(const char *file, const uint8_t *map, size_t map_size, uint8_t **preview, int *p_len, int *rotation)
+{
+  lime_exif *exif = lime_exif_handle_new_from_file(file);
+  const lime_exif_record *rec = lime_exif_record_get(exif);
+  int len = 0;
+  
+  if (rec->valid)
+    *rotation = rec->orientation;
+  
+  //the thumbnail is copied straight out of the mapped file
+  if (rec->thumb_len && (uint64_t)rec->thumb_offset + rec->thumb_len <= map_size) {
+    len = rec->thumb_len;
+    if (*preview)
+      free(*preview);
+    *preview = malloc(len);
+    memcpy(*preview, map + rec->thumb_offset, len);
+  }
+  
+  lime_exif_handle_destroy(exif);
+  
+  *p_len = len;
+}
+  
+#define IF_FREE(X) if (X) {free(X); X = NULL;}  
 
-  FILE * infile;    /* source stream */
-  JOCTET * buffer;    /* start of buffer */
-  boolean start_of_file;  /* have we gotten any data yet? */
-  _Data *data;
-} my_source_mgr;
+//filters may be created from concurrent configurations
+static pthread_once_t _ff_once = PTHREAD_ONCE_INIT;
 
-typedef my_source_mgr * my_src_ptr;
+#ifdef JPEG_FF_AVX2
+static int _avx2;
 
-#define INPUT_BUF_SIZE  4096  /* choose an efficiently fread'able size */
+//whole vectors, returns the 0xFF found or where the tail starts
+__attribute__((target("avx2")))
+static const uint8_t *_ff_find_avx2(const uint8_t *p, const uint8_t *end)
+{
+  const __m256i ff = _mm256_set1_epi8(0xFF);
+  unsigned mask;
+  
+  while (end - p >= 32) {
+    mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), ff));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  
+  return p;
+}
+#endif
 
+static void _ff_init(void)
+{
+#ifdef JPEG_FF_AVX2
+  _avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
 
 /*
- * Initialize source --- called by jpeg_read_header
- * before any data is actually read.
+ * position of the next 0xFF in [p, end), end if there is none.
+ * markers are dense (one per ~100 bytes in camera like files), one vector
+ * per step is about as fast as glibc's vectorized memchr, wider steps and
+ * sse2 were slower. avx2 helps where memchr is not vectorized
  */
-
-#define BUF_SIZE 4096
-
-#define ATLEAST_BUF(L)\
-  if (remain < L) { \
-    if (remain) memmove(buf, pos, remain); \
-    pos = buf; \
-    len = fread(buf+remain, 1, BUF_SIZE, f); \
-    if (remain+len < L) { \
-      printf("not enough data read!\n"); \
-      return -1; \
-    } \
-    remain += len; \
-    file_pos += len; \
-  }
- 
-#define SKIP_BUF(N) \
-  {\
-    if (N > BUF_SIZE || N < 0) {\
-      fseek(f, file_pos + N - remain, SEEK_SET); \
-      file_pos += N - remain; \
-      remain = 0; \
-    } \
-    else { \
-      ATLEAST_BUF(N) \
-      pos+= N; \
-      remain-= N; \
-    } \
+static const uint8_t *_ff_find(const uint8_t *p, const uint8_t *end)
+{
+  const uint8_t *found;
+  
+#ifdef JPEG_FF_AVX2
+  if (_avx2) {
+    p = _ff_find_avx2(p, end);
+    if (p < end && *p == 0xFF)
+      return p;
   }
+#endif
   
-static void get_exif_stuff(const char *file, uint8_t **preview, int *p_len, int *rotation)
+  //tail or no avx2: libc memchr is vectorized on most platforms
+  if (p >= end)
+    return end;
+  found = memchr(p, 0xFF, end - p);
+  
+  return found ? found : end;
+}
+
+//collect the offsets after all restart markers, p points to the start of the entropy coded data
+static int _rst_scan(const uint8_t *map, const uint8_t *p, const uint8_t *end, _Data *data)
 {
-  int orientation = 1;
-  int len = 0;
-  ExifLoader *l;
-  ExifEntry *entry;
+  int *index;
+  int n = 1, count = data->common->iw*data->common->ih;
+  int next_restart = 0;
   
-  /* Create an ExifLoader object to manage the EXIF loading process */
-  l = exif_loader_new();
-  if (l) {
-    ExifData *ed;
-    
-    /* Load the EXIF data from the image file */
-    exif_loader_write_file(l, file);
-    
-    /* Get a pointer to the EXIF data */
-    ed = exif_loader_get_data(l);
+  index = malloc(sizeof(int)*count);
+  index[0] = p - map;
+  
+  //a marker needs two bytes
+  end--;
+  
+  while (n < count) {
+    p = _ff_find(p, end);
+    if (p >= end)
+      break;
     
-    /* The loader is no longer needed--free it */
-    exif_loader_unref(l);
-    l = NULL;
-    if (ed) {
-      entry = exif_data_get_entry(ed, EXIF_TAG_ORIENTATION);
-   
-      if (entry) {
-	
-      orientation = *(short*)entry->data;
-      
-      if (orientation > 8)
-	orientation /= 256;
-      
-      if (orientation > 8 || orientation < 1)
-	orientation = 1;
-      }
-      
-      *rotation = orientation;
-
-      /* Make sure the image had a thumbnail before trying to write it */
-      if (ed->data && ed->size) {
-	//printf("found thumb image of size %d\n", ed->size);
-	len = ed->size;
-	if (!preview)
-	  preview = malloc(sizeof(uint8_t*));
-	else if (*preview)
-	  free(*preview);
-	*preview = malloc(len);
-	/* Write the thumbnail image to the file */
-	memcpy(*preview, ed->data, len);
-      }
-      /* Free the EXIF data */
-      exif_data_unref(ed);
+    if ((p[1] & 0xF8) == 0xD0) {
+      //entropy coded data can't contain markers, so a wrong sequence means a broken file
+      if ((p[1] & 0x07) != next_restart)
+        break;
+      //we point to after the restart marker
+      index[n++] = p + 2 - map;
+      next_restart = (next_restart+1) % 8;
+      p += 2;
     }
+    else if (p[1] == 0x00)
+      //stuffed 0xFF data byte
+      p += 2;
+    else if (p[1] == 0xFF)
+      //fill byte
+      p++;
+    else
+      //EOI or other marker before the last restart interval
+      break;
   }
   
-  *p_len = len;
-}
+  if (n < count) {
+    free(index);
+    return -1;
+  }
   
-#define IF_FREE(X) if (X) {free(X); X = NULL;}  
+  IF_FREE(data->common->index)
+  data->common->index = index;
+  
+  return 0;
+}
 
-int jpeg_read_infos(FILE *f, _Data *data)
+//build the restart index from the mapped file
+int jpeg_read_infos(const uint8_t *map, size_t size, _Data *data)
 {
-  int i;
+  const uint8_t *pos = map;
+  const uint8_t *end = map + size;
   int len;
-  int last_interval;
-  int curr_interval;
-  int last_jump;
-  int remain = 0;
-  int file_pos = 0;
-  int next_restart;
-  unsigned char buf[2*BUF_SIZE];
-  unsigned char *pos = buf;
-  int *index = NULL;
-  int ix, iy;
-  
-  fseek(f, 0, SEEK_SET);
-  ATLEAST_BUF(BUF_SIZE);
-  
-  if ((pos[0] != 0xFF) | (pos[1] != 0xD8))
+  
+  if (size < 4 || pos[0] != 0xFF || pos[1] != 0xD8)
     return -1;
   
-  SKIP_BUF(2)
-  ATLEAST_BUF(4)
+  pos += 2;
     
-  while (1) {
-    if (pos[0] != 0xFF) {
-      IF_FREE(index)
+  while (pos + 4 <= end) {
+    if (pos[0] != 0xFF)
       return -1;
+    
+    //fill bytes before a marker
+    if (pos[1] == 0xFF) {
+      pos++;
+      continue;
     }
+    
+    len = (pos[2] << 8) | pos[3];
+    
     switch (pos[1]) {
       case 0xC0:
-        ATLEAST_BUF(9)
-       //FIXME get lengths and quit
-        *data->common->size_pos = file_pos - remain + 5;
+        if (pos + 9 > end)
+          return -1;
         if (pos[4] != 8) {
           printf("jpg Syntax error!\n");
-          IF_FREE(index)
           return -1;
         }
-        len = pos[2] * 256 + pos[3];
-        SKIP_BUF(len+2);
         break;
       case 0xDA:
-	index = calloc(sizeof(int)*data->common->iw*data->common->ih, 1);
-        //2B Marker + 2B Length + 1B comp_count (FIXME compare/use) + 2B*comp_count+ marker length
-        len = pos[2] * 256 + pos[3];
-        assert(pos[4] == data->comp_count);
-        SKIP_BUF(len+2);
-        //FIXME does the image start with the first restart marker or here?
-        next_restart = 0;
-        //FIXME index[0] = ...
-        ATLEAST_BUF(2)
-        ix = 0;
-        iy = 0;
-        i = 0;
-        index[0] = file_pos - remain;
-        last_interval = 0;
-        curr_interval = 0;
-        while(1) {
-          if (pos[i] == 0xFF && (pos[i+1] & 0xF0) == 0xD0)
-          {
-            if ((pos[i+1] & 0x0F) != next_restart) {
-              assert(last_jump > 0);
-              SKIP_BUF(-curr_interval+1)
-              //printf("back-skip %d\n", curr_interval+1);
-              curr_interval = 0;
-              ATLEAST_BUF(i+4)
-              last_jump = 0;
-              continue;
-            }
-            ix++;
-            if (ix >= data->common->iw) {
-              ix = 0;
-              iy++;
-            }
-            //printf("%4dx%4d ", ix*data->common->mcu_w, iy*data->common->mcu_h);
-            //we point to after the restart marker
-            index[iy*data->common->iw + ix] = file_pos - remain + i+2; 
-            //printf("found %d\n", next_restart);
-            next_restart = (next_restart+1) % 8;
-            
-            if (iy == data->common->ih-1 && ix == data->common->iw-1) {
-              break;
-            }
-            
-            last_interval = curr_interval;
-            curr_interval = 0;
-            //printf("marker interval: %d\n", last_interval);
-            /*SKIP_BUF(i)
-            i = 0;
-            ATLEAST_BUF(4)
-            curr_interval = last_interval*0.5;
-            last_jump = curr_interval;
-            SKIP_BUF(last_jump)
-            ATLEAST_BUF(4)*/
-          }
-          
-          i++;
-          curr_interval++;
-          if (i == remain-1) {
-            SKIP_BUF(i)
-            ATLEAST_BUF(4)
-            i = 0;
-          }
-        }
-        IF_FREE(data->common->index)
-        data->common->index = index;
-        return 0;
-      case 0xC4:
-      case 0xDB:
-      case 0xDD:
-      case 0xFE:
-      case 0xE1: //FIXME get exif info!
-        len = pos[2] * 256 + pos[3];
-        SKIP_BUF(len+2);
-        break;
+        //2B Marker + 2B Length + 1B comp_count + 2B*comp_count + 3B
+        if (pos[4] != data->comp_count)
+          return -1;
+        if (pos + len + 2 > end)
+          return -1;
+        return _rst_scan(map, pos + len + 2, end, data);
       default :
-        if ((pos[1] & 0xF0) != 0xE0) {
-          len = (pos[2] << 8) | pos[3];
-          SKIP_BUF(len+2);
-          break;
-        }
-        else {
-        len = (pos[2] << 8) | pos[3];
-        SKIP_BUF(len+2);
         break;
-        }
     }
-    ATLEAST_BUF(4)
+    pos += len + 2;
   }
   
-  IF_FREE(index)
-  return 0;
+  return -1;
 }
 
-METHODDEF(void)
-init_source (j_decompress_ptr cinfo)
+static int _index_build(_Data *data)
 {
-  my_src_ptr src = (my_src_ptr) cinfo->src;
-
-  /* We reset the empty-input-file flag for each image,
-   * but we don't clear the input buffer.
-   * This is correct behavior for reading a series of images from one source.
-   */
-  src->start_of_file = TRUE;
+  _Common *common = data->common;
+  int ret;
+  
+  madvise(common->seek_map, common->seek_map_size, MADV_SEQUENTIAL);
+  ret = jpeg_read_infos(common->seek_map, common->seek_map_size, data);
+  madvise(common->seek_map, common->seek_map_size, MADV_NORMAL);
+  
+  return ret;
 }
 
+static void _unmap(_Common *common)
+{
+  if (common->seek_map && common->seek_map != common->map)
+    munmap(common->seek_map, common->seek_map_size);
+  if (common->map)
+    munmap(common->map, common->map_size);
+  common->map = NULL;
+  common->map_size = 0;
+  common->seek_map = NULL;
+  common->seek_map_size = 0;
+}
 
-/*
- * Fill the input buffer --- called whenever buffer is emptied.
- *
- * In typical applications, this should read fresh data into the buffer
- * (ignoring the current state of next_input_byte & bytes_in_buffer),
- * reset the pointer & count to the start of the buffer, and return TRUE
- * indicating that the buffer has been reloaded.  It is not necessary to
- * fill the buffer entirely, only to obtain at least one more byte.
- *
- * There is no such thing as an EOF return.  If the end of the file has been
- * reached, the routine has a choice of ERREXIT() or inserting fake data into
- * the buffer.  In most cases, generating a warning message and inserting a
- * fake EOI marker is the best course of action --- this will allow the
- * decompressor to output however much of the image is there.  However,
- * the resulting error message is misleading if the real problem is an empty
- * input file, so we handle that case specially.
- *
- * In applications that need to be able to suspend compression due to input
- * not being available yet, a FALSE return indicates that no more data can be
- * obtained right now, but more may be forthcoming later.  In this situation,
- * the decompressor will return to its caller (with an indication of the
- * number of scanlines it has read, if any).  The application should resume
- * decompression after it has loaded more data into the input buffer.  Note
- * that there are substantial restrictions on the use of suspension --- see
- * the documentation.
- *
- * When suspending, the decompressor will back up to a convenient restart point
- * (typically the start of the current MCU). next_input_byte & bytes_in_buffer
- * indicate where the restart point will be if the current call returns FALSE.
- * Data beyond this point must be rescanned after resumption, so move it to
- * the front of the buffer rather than discarding it.
- */
-
-METHODDEF(boolean)
-fill_input_buffer (j_decompress_ptr cinfo)
+static int _map_file(const char *filename, uint8_t **map_ret, size_t *size_ret)
 {
-  my_src_ptr src = (my_src_ptr) cinfo->src;
-  size_t nbytes;
-  int size;
-  
-  //makes sure we have the whole jpeg size memory area in one piece
-  if (src->data->serve_fakejpg) {
-    if (src->data->serve_iy == src->data->serve_maxy-1
-        && src->data->serve_ix == src->data->serve_maxx-1)
-      size = INPUT_BUF_SIZE;
-    else
-      size = (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix+1]-(src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix];
-    fseek(src->infile, (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix], SEEK_SET);
-    assert(2*INPUT_BUF_SIZE >= size);
-    nbytes = fread(src->buffer, 1, size, src->infile);
-    //FIXME check size?
-    if (size != INPUT_BUF_SIZE) {
-      src->buffer[nbytes-1] = 0xd0 | src->data->rst_next;
-      src->data->rst_next = (src->data->rst_next+1) % 8;
-    }
-    src->data->file_pos = (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix] + nbytes;
-    src->data->serve_ix++;
-    if (src->data->serve_ix >= src->data->serve_maxx) {
-      src->data->serve_ix = src->data->serve_minx;
-      src->data->serve_iy++;
-      if (src->data->serve_iy == src->data->serve_maxy) {
-        src->data->serve_fakejpg = 0;
-        //printf("we have served the whole area!\n");
-      }
-    }
-  }
-  else if (src->data->file_pos < *src->data->common->size_pos 
-      && src->data->file_pos + INPUT_BUF_SIZE >= *src->data->common->size_pos) {
-    if (src->data->file_pos + 2*INPUT_BUF_SIZE >= (src->data->common->index)[0])
-      nbytes = fread(src->buffer, 1, (src->data->common->index)[0]-src->data->file_pos, src->infile);
-    else
-      nbytes = fread(src->buffer, 1, 2*INPUT_BUF_SIZE, src->infile);
-    //FIXME
-    int i = *src->data->common->size_pos - src->data->file_pos;
-    //printf("size on fill: %dx%d\n%x %x %x %x %x %x\n%d\n", src->buffer[i+2]*256+src->buffer[i+3],src->buffer[i]*256+src->buffer[i+1],src->buffer[i],src->buffer[i+1],src->buffer[i+2],src->buffer[i+3],src->buffer[i+4],src->buffer[i+5],src->data->common->size_pos);
-    src->buffer[i+2] = src->data->serve_width / 256; //pretend size to be 256!
-    src->buffer[i+3] = src->data->serve_width % 256;
-  }
-  else if (src->data->file_pos < (src->data->common->index)[0]
-      && src->data->file_pos + INPUT_BUF_SIZE >= (src->data->common->index)[0]) {
-    nbytes = fread(src->buffer, 1, (src->data->common->index)[0]-src->data->file_pos, src->infile);
-  }
-  else if (src->data->file_pos == (src->data->common->index)[0]) {
-    //printf("wohoo now feed fake jpeg\n");
-    src->data->serve_fakejpg = 1;
-    src->data->rst_next = 0;
-    size = (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix+1]-(src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix];
-    fseek(src->infile, (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix], SEEK_SET);
-    assert(INPUT_BUF_SIZE > size);
-    nbytes = fread(src->buffer, 1, size, src->infile);
-    src->buffer[nbytes-1] = 0xd0 | src->data->rst_next;
-    src->data->rst_next = (src->data->rst_next+1) % 8;
-    assert(nbytes == size);
-    src->data->file_pos = (src->data->common->index)[src->data->serve_iy*src->data->common->iw+src->data->serve_ix] + nbytes;
-    src->data->serve_ix++;
-    if (src->data->serve_ix >= src->data->serve_maxx) {
-      src->data->serve_ix = src->data->serve_minx;
-      src->data->serve_iy++;
-      if (src->data->serve_iy == src->data->serve_maxy) {
-        src->data->serve_fakejpg = 0;
-        //printf("we have served the whole area!\n");
-      }
-    }
-  }
-  else
-    nbytes = fread(src->buffer, 1, INPUT_BUF_SIZE, src->infile);
+  struct stat st;
+  uint8_t *map;
+  int fd;
   
-
-  if (nbytes <= 0) {
-    if (src->start_of_file) /* Treat empty input file as fatal error */
-      ERREXIT(cinfo, JERR_INPUT_EMPTY);
-    WARNMS(cinfo, JWRN_JPEG_EOF);
-    /* Insert a fake EOI marker */
-    src->buffer[0] = (JOCTET) 0xFF;
-    src->buffer[1] = (JOCTET) JPEG_EOI;
-    nbytes = 2;
+  fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  
+  if (fstat(fd, &st) || !st.st_size) {
+    close(fd);
+    return -1;
   }
-
-  src->pub.next_input_byte = src->buffer;
-  src->pub.bytes_in_buffer = nbytes;
-  src->start_of_file = FALSE;
-  src->data->file_pos += nbytes;
-
-  return TRUE;
+  
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  
+  *map_ret = map;
+  *size_ret = st.st_size;
+  
+  return 0;
 }
 
-
-/*
- * Skip data --- used to skip over a potentially large amount of
- * uninteresting data (such as an APPn marker).
- *
- * Writers of suspendable-input applications must note that skip_input_data
- * is not granted the right to give a suspension return.  If the skip extends
- * beyond the data currently in the buffer, the buffer can be marked empty so
- * that the next read will cause a fill_input_buffer call that can suspend.
- * Arranging for additional bytes to be discarded before reloading the input
- * buffer is the application writer's problem.
- */
-
-METHODDEF(void)
-skip_input_data (j_decompress_ptr cinfo, long num_bytes)
+static int _map(_Common *common, const char *filename)
 {
-  my_src_ptr src = (my_src_ptr) cinfo->src;
-
-  /* Just a dumb implementation for now.  Could use fseek() except
-   * it doesn't work on pipes.  Not clear that being smart is worth
-   * any trouble anyway --- large skips are infrequent.
-   */
-  if (num_bytes > 0) {
-    while (num_bytes > (long) src->pub.bytes_in_buffer) {
-      num_bytes -= (long) src->pub.bytes_in_buffer;
-      (void) fill_input_buffer(cinfo);
-      /* note we assume that fill_input_buffer will never return FALSE,
-       * so suspension need not be handled.
-       */
-    }
-    src->pub.next_input_byte += (size_t) num_bytes;
-    src->pub.bytes_in_buffer -= (size_t) num_bytes;
-  }
+  _unmap(common);
+  
+  if (_map_file(filename, &common->map, &common->map_size))
+    return -1;
+  
+  common->seek_map = common->map;
+  common->seek_map_size = common->map_size;
+  
+  return 0;
 }
 
-
-/*
- * An additional method that can be provided by data source modules is the
- * resync_to_restart method for error recovery in the presence of RST markers.
- * For the moment, this source module just uses the default resync method
- * provided by the JPEG library.  That method assumes that no backtracking
- * is possible.
- */
-
-
-/*
- * Terminate source --- called by jpeg_finish_decompress
- * after all data has been read.  Often a no-op.
- *
- * NB: *not* called by jpeg_abort or jpeg_destroy; surrounding
- * application must deal with any cleanup that should happen even
- * for error exit.
- */
-
-METHODDEF(void)
-term_source (j_decompress_ptr cinfo)
+static void _append(uint8_t **buf, int *len, const uint8_t *src, int n)
 {
-  /* no work necessary here */
+  *buf = realloc(*buf, *len + n);
+  memcpy(*buf + *len, src, n);
+  *len += n;
 }
 
-
 /*
- * Prepare for input from a stdio stream.
- * The caller must have already opened the stream, and is responsible
- * for closing it after finishing decompression.
+ * split the file header into a tables-only datastream, which is parsed once
+ * per decoder, and the frame header (SOF, DRI, SOS) which starts each tile.
+ * only baseline/extended sequential huffman files can be split.
  */
-
-GLOBAL(void)
-jpeg_hacked_stdio_src (j_decompress_ptr cinfo, FILE * infile, _Data *data)
+static int _header_split(_Common *common)
 {
-  my_src_ptr src;
-
-  /* The source object and input buffer are made permanent so that a series
-   * of JPEG images can be read from the same file by calling jpeg_stdio_src
-   * only before the first one.  (If we discarded the buffer at the end of
-   * one image, we'd likely lose the start of the next one.)
-   * This makes it unsafe to use this manager and a different source
-   * manager serially with the same JPEG object.  Caveat programmer.
-   */
-  if (cinfo->src == NULL) { /* first time for this JPEG object? */
-    cinfo->src = (struct jpeg_source_mgr *)
-      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-          sizeof(my_source_mgr));
-    src = (my_src_ptr) cinfo->src;
-    src->buffer = (JOCTET *)
-      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-          2*INPUT_BUF_SIZE * sizeof(JOCTET));
+  const uint8_t soi[2] = {0xFF, 0xD8};
+  const uint8_t eoi[2] = {0xFF, 0xD9};
+  const uint8_t *pos = common->seek_map + 2;
+  const uint8_t *end = common->seek_map + common->seek_map_size;
+  const uint8_t *sof = NULL, *dri = NULL;
+  int len;
+  
+  IF_FREE(common->tables)
+  IF_FREE(common->frame)
+  common->tables_len = 0;
+  common->frame_len = 0;
+  common->tables_gen++;
+  
+  _append(&common->tables, &common->tables_len, soi, 2);
+  
+  while (pos + 4 <= end) {
+    if (pos[0] != 0xFF)
+      return -1;
+    
+    if (pos[1] == 0xFF) {
+      pos++;
+      continue;
+    }
+    
+    len = (pos[2] << 8) | pos[3];
+    if (pos + len + 2 > end)
+      return -1;
+    
+    switch (pos[1]) {
+      case 0xDB:
+      case 0xC4:
+        _append(&common->tables, &common->tables_len, pos, len+2);
+        break;
+      case 0xC0:
+      case 0xC1:
+        sof = pos;
+        break;
+      case 0xDD:
+        //a cached copy made with another interval doesn't fit the index
+        if (len < 4 || ((pos[4] << 8) | pos[5]) != common->rst_int)
+          return -1;
+        dri = pos;
+        break;
+      case 0xDA:
+        if (!sof || !dri)
+          return -1;
+        _append(&common->tables, &common->tables_len, eoi, 2);
+        //SOF first: size is patched at fixed offsets
+        _append(&common->frame, &common->frame_len, sof, ((sof[2] << 8) | sof[3]) + 2);
+        _append(&common->frame, &common->frame_len, dri, ((dri[2] << 8) | dri[3]) + 2);
+        _append(&common->frame, &common->frame_len, pos, len+2);
+        return 0;
+      default :
+        //progressive, lossless, arithmetic coding
+        if ((pos[1] & 0xF0) == 0xC0 && pos[1] != 0xC8 && pos[1] != 0xCC)
+          return -1;
+        break;
+    }
+    pos += len + 2;
   }
-
-  src = (my_src_ptr) cinfo->src;
-  src->pub.init_source = init_source;
-  src->pub.fill_input_buffer = fill_input_buffer;
-  src->pub.skip_input_data = skip_input_data;
-  src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
-  src->pub.term_source = term_source;
-  src->infile = infile;
-  src->data = data;
-  //FIXME should also seek to pos 0!
-  src->data->file_pos = 0;
-  src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
-  src->pub.next_input_byte = NULL; /* until buffer loaded */
+  
+  return -1;
 }
 
-
 struct my_error_mgr {
   struct jpeg_error_mgr pub;
   jmp_buf setjmp_buffer;
@@ -561,6 +419,14 @@ struct my_error_mgr {
 
 typedef struct my_error_mgr *my_error_ptr;
 
+typedef struct _Dec {
+  struct jpeg_decompress_struct cinfo;
+  struct my_error_mgr jerr;
+  int tables_gen;
+  uint8_t *buf; //abbreviated datastream of the current tile
+  int buf_size;
+} _Dec;
+
 METHODDEF(void)
 my_error_exit (j_common_ptr cinfo)
 {
@@ -571,233 +437,440 @@ my_error_exit (j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
+//serialized restart index: header fields followed by iw*ih offsets
+enum {
+  IDX_VERSION,
+  IDX_W,
+  IDX_H,
+  IDX_MCU_W,
+  IDX_MCU_H,
+  IDX_RST_INT,
+  IDX_HEADER_LEN
+};
+
+#define JPEG_INDEX_VERSION 2
+
+//index of an unchanged file from the disk cache, must hold common->lock
+static int _index_load(_Common *common)
+{
+  int32_t *buf;
+  int len, i;
+
+  //offsets refer to the mapped file
+  buf = diskcache_read("jpeg_index", common->rst_copy ? common->rst_copy : common->filename, &len);
+  if (!buf)
+    return -1;
+
+  if (len != sizeof(int32_t)*(IDX_HEADER_LEN+common->iw*common->ih)
+      || buf[IDX_VERSION] != JPEG_INDEX_VERSION
+      || buf[IDX_W] != common->w || buf[IDX_H] != common->h
+      || buf[IDX_MCU_W] != common->mcu_w || buf[IDX_MCU_H] != common->mcu_h
+      || buf[IDX_RST_INT] != common->rst_int) {
+    free(buf);
+    return -1;
+  }
+
+  IF_FREE(common->index)
+  common->index = malloc(sizeof(int)*common->iw*common->ih);
+  for(i=0;i<common->iw*common->ih;i++)
+    common->index[i] = buf[IDX_HEADER_LEN+i];
+
+  free(buf);
+
+  return 0;
+}
+
+static void _index_save(_Common *common)
+{
+  int32_t *buf;
+  int i, len = sizeof(int32_t)*(IDX_HEADER_LEN+common->iw*common->ih);
+
+  buf = malloc(len);
+  buf[IDX_VERSION] = JPEG_INDEX_VERSION;
+  buf[IDX_W] = common->w;
+  buf[IDX_H] = common->h;
+  buf[IDX_MCU_W] = common->mcu_w;
+  buf[IDX_MCU_H] = common->mcu_h;
+  buf[IDX_RST_INT] = common->rst_int;
+  for(i=0;i<common->iw*common->ih;i++)
+    buf[IDX_HEADER_LEN+i] = common->index[i];
+
+  //a failed write only costs a rescan on the next open
+  if (!diskcache_write("jpeg_index", common->rst_copy ? common->rst_copy : common->filename, buf, len))
+    diskcache_trim("jpeg_index", ".bin", JPEG_INDEX_CACHE_MAX);
+
+  free(buf);
+}
+
 static void *_data_new(Filter *f, void *data)
 {
   _Data *newdata = calloc(sizeof(_Data), 1);
   
   *newdata = *(_Data*)data;
-
-  //FIXME reuse (create on input_fixed?)
-  //newdata->index = calloc(sizeof(int**), 1);
+  newdata->dec = NULL;
   
   return newdata;
 }
 
+static _Dec *_dec_get(_Data *data)
+{
+  _Dec *dec = data->dec;
+  
+  if (dec)
+    return dec;
+  
+  dec = calloc(sizeof(_Dec), 1);
+  dec->cinfo.err = jpeg_std_error(&dec->jerr.pub);
+  dec->jerr.pub.error_exit = my_error_exit;
+  jpeg_create_decompress(&dec->cinfo);
+  data->dec = dec;
+  
+  return dec;
+}
+
+static void _dec_del(_Data *data)
+{
+  if (!data->dec)
+    return;
+  
+  jpeg_destroy_decompress(&data->dec->cinfo);
+  free(data->dec->buf);
+  free(data->dec);
+  data->dec = NULL;
+}
+
+static int imin(int a, int b)
+{
+  if (a<=b) return a;
+  return b;
+}
+
+static int imax(int a, int b)
+{
+  if (a>=b) return a;
+  return b;
+}
+
+//abbreviated datastream for the requested restart intervals, renumbers the restart markers
+static void _tile_stream(_Data *data, _Dec *dec, int *len)
+{
+  _Common *common = data->common;
+  int ix, iy, k, start, stop;
+  int count = common->iw*common->ih;
+  int rst_next = 0;
+  uint8_t *p;
+  
+  *len = 2 + common->frame_len + 2;
+  for(iy=data->serve_miny;iy<data->serve_maxy;iy++) {
+    k = iy*common->iw;
+    stop = k+data->serve_maxx < count ? common->index[k+data->serve_maxx] : common->seek_map_size;
+    *len += stop - common->index[k+data->serve_minx];
+  }
+  
+  if (*len > dec->buf_size) {
+    dec->buf_size = *len;
+    dec->buf = realloc(dec->buf, dec->buf_size);
+  }
+  
+  p = dec->buf;
+  *p++ = 0xFF;
+  *p++ = 0xD8;
+  memcpy(p, common->frame, common->frame_len);
+  p[5] = data->serve_height / 256;
+  p[6] = data->serve_height % 256;
+  p[7] = data->serve_width / 256;
+  p[8] = data->serve_width % 256;
+  p += common->frame_len;
+  
+  for(iy=data->serve_miny;iy<data->serve_maxy;iy++)
+    for(ix=data->serve_minx;ix<data->serve_maxx;ix++) {
+      k = iy*common->iw + ix;
+      start = common->index[k];
+      stop = k+1 < count ? common->index[k+1] : common->seek_map_size;
+      memcpy(p, common->seek_map + start, stop - start);
+      p += stop - start;
+      //interval ends with the restart marker of the next one
+      if (k+1 < count) {
+        p[-1] = 0xD0 | rst_next;
+        rst_next = (rst_next+1) % 8;
+      }
+    }
+  
+  *p++ = 0xFF;
+  *p++ = 0xD9;
+}
+
+static int _rst_copy_map(_Common *common);
+
+//slow fallback if the seekable copy could not be made after all
+static void _loadjpeg_worker_ijg_crop(_Data *data, Rect *area, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+  uint8_t *planes[3], *out[3] = {r, g, b};
+  int i, y, w, h, cw, ch;
+  
+  if (loadjpeg_mem_size(data->common->map, data->common->map_size, area->corner.scale, &w, &h)) {
+    printf("error opening jpeg file!\n");
+    data->common->error = EINA_TRUE;
+    return;
+  }
+  
+  for(i=0;i<3;i++)
+    planes[i] = malloc(w*h);
+  
+  if (loadjpeg_mem_decode(data->common->map, data->common->map_size, area->corner.scale, planes[0], planes[1], planes[2])) {
+    printf("error opening jpeg file!\n");
+    data->common->error = EINA_TRUE;
+  }
+  else {
+    cw = w - area->corner.x < area->width ? w - area->corner.x : area->width;
+    ch = h - area->corner.y < area->height ? h - area->corner.y : area->height;
+    for(i=0;i<3;i++)
+      for(y=0;y<ch;y++)
+        memcpy(out[i] + y*area->width, planes[i] + (area->corner.y+y)*w + area->corner.x, cw);
+  }
+  
+  for(i=0;i<3;i++)
+    free(planes[i]);
+}
+
 static void _loadjpeg_worker_ijg(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
 {
   _Data *data = ea_data(f->data, thread_id);
   
   uint8_t *r, *g, *b;
   uint8_t *rp, *gp, *bp;
-  int i, j, l;
+  int i, j, y, len;
   JSAMPARRAY buffer;
   int row_stride;
-  FILE *file;
   int lines_read;
-  
-  struct jpeg_decompress_struct cinfo;
-  struct my_error_mgr jerr;
+  int rst_w, off_x, off_y, cw;
+  _Dec *dec;
   
   assert(out && ea_count(out) == 3);
   
   //maximum scaledown: 1/8
   assert(area->corner.scale <= 3);
   int mul = 1u << area->corner.scale;
- 
-  data->serve_minx = mul*area->corner.x / (data->common->rst_int*data->common->mcu_w);
-  data->serve_miny = mul*area->corner.y / data->common->mcu_h;
-  if (mul*(area->corner.x + area->width) > data->common->w)
-      data->serve_width = data->common->w-mul*area->corner.x;
-  else
-    data->serve_width = mul*area->width;
-  if (mul*(area->corner.y + area->height) > data->common->h)
-      data->serve_height = data->common->h-mul*area->corner.y;
-  else
-    data->serve_height = mul*area->height;
-  assert(data->serve_width % (data->common->rst_int*data->common->mcu_w) == 0);
-  data->serve_maxx = data->serve_minx+data->serve_width / (data->common->rst_int*data->common->mcu_w);
-  data->serve_maxy = data->serve_miny+data->serve_height / data->common->mcu_h;
-  if (data->serve_maxy > data->common->h / data->common->mcu_h)
-    data->serve_maxy = data->common->h / data->common->mcu_h;
-  data->serve_ix = data->serve_minx;
-  data->serve_iy = data->serve_miny;
-  data->serve_fakejpg = 0;
-  data->common->iw = data->common->w / (data->common->mcu_w*data->common->rst_int);
-  data->common->ih = data->common->h / data->common->mcu_h;
   
   if (area->corner.x<<area->corner.scale >= data->common->w || area->corner.y<<area->corner.scale >= data->common->h) {
     printf("FIXME: invalid tile requested in loadjpg: %dx%d\n", area->corner.x, area->corner.y);
     return;
   }
+ 
+  rst_w = data->common->rst_int*data->common->mcu_w;
+  data->serve_minx = mul*area->corner.x / rst_w;
+  data->serve_miny = mul*area->corner.y / data->common->mcu_h;
+  data->serve_maxx = (mul*(area->corner.x + area->width) + rst_w-1) / rst_w;
+  data->serve_maxy = (mul*(area->corner.y + area->height) + data->common->mcu_h-1) / data->common->mcu_h;
+  
+  //fancy upsampling interpolates chroma from the neighbouring mcus, so these
+  //are decoded as halo and cropped. at scales where the idct already yields
+  //full resolution chroma there is no upsampling and no halo needed
+  if (data->common->mcu_w > 8*mul) {
+    data->serve_minx = imax(data->serve_minx-1, 0);
+    data->serve_maxx++;
+  }
+  if (data->common->mcu_h > 8*mul) {
+    data->serve_miny = imax(data->serve_miny-1, 0);
+    data->serve_maxy++;
+  }
+  data->serve_maxx = imin(data->serve_maxx, data->common->iw);
+  data->serve_maxy = imin(data->serve_maxy, data->common->ih);
+  
+  data->serve_width = imin(data->serve_maxx*rst_w, data->common->w) - data->serve_minx*rst_w;
+  data->serve_height = imin(data->serve_maxy*data->common->mcu_h, data->common->h) - data->serve_miny*data->common->mcu_h;
+  off_x = (mul*area->corner.x - data->serve_minx*rst_w) / mul;
+  off_y = (mul*area->corner.y - data->serve_miny*data->common->mcu_h) / mul;
   
   r = ((Tiledata*)ea_data(out, 0))->data;
   g = ((Tiledata*)ea_data(out, 1))->data;
   b = ((Tiledata*)ea_data(out, 2))->data;
   
-  file = fopen(data->common->filename, "rb");
-  
-  if (!file) {
-    printf("error opening file!\n");
-    data->common->error = EINA_TRUE;
-    return;
-  }
-  
   if (!(data->common->index)) {
     pthread_mutex_lock(data->common->lock);
-    if (!(data->common->index)) {
-      if (jpeg_read_infos(file, data)) {
+    //a cache failure is never a load error
+    if (!(data->common->index) && !data->common->rst_failed && _rst_copy_map(data->common)) {
+      printf("could not make a seekable copy of the jpeg, decoding it whole\n");
+      data->common->rst_failed = 1;
+    }
+    if (!(data->common->index) && !data->common->rst_failed && _index_load(data->common)) {
+      if (_index_build(data)) {
 	printf("corrupt jpeg!\n");
 	data->common->error = EINA_TRUE;
-	fclose(file);
+	pthread_mutex_unlock(data->common->lock);
 	return;
       }
-      fseek(file, 0, SEEK_SET);
+      _index_save(data->common);
     }
     pthread_mutex_unlock(data->common->lock);
   }
   
-  cinfo.err = jpeg_std_error(&jerr.pub);
+  if (data->common->rst_failed) {
+    _loadjpeg_worker_ijg_crop(data, area, r, g, b);
+    return;
+  }
   
-  if (setjmp(jerr.setjmp_buffer)) {
-    jpeg_destroy_decompress(&cinfo);
-    fclose(file);
-    printf("error opening jpeg file!\n");
+  dec = _dec_get(data);
+  
+  if (setjmp(dec->jerr.setjmp_buffer)) {
+    //decoder state is undefined after an error
+    _dec_del(data);
+    printf("error decoding jpeg tile!\n");
     data->common->error = EINA_TRUE;
     return;
   }
-  jpeg_create_decompress(&cinfo);
-
-  jpeg_hacked_stdio_src(&cinfo, file, data);
   
-  (void) jpeg_read_header(&cinfo, TRUE);
+  //tables stay in the decoder across jpeg_abort_decompress()
+  if (dec->tables_gen != data->common->tables_gen) {
+    jpeg_mem_src(&dec->cinfo, data->common->tables, data->common->tables_len);
+    if (jpeg_read_header(&dec->cinfo, FALSE) != JPEG_HEADER_TABLES_ONLY) {
+      _dec_del(data);
+      printf("error reading jpeg tables!\n");
+      data->common->error = EINA_TRUE;
+      return;
+    }
+    dec->tables_gen = data->common->tables_gen;
+  }
   
-  cinfo.scale_num = 1;
-  cinfo.scale_denom = 1u << area->corner.scale;
+  _tile_stream(data, dec, &len);
+  jpeg_mem_src(&dec->cinfo, dec->buf, len);
+  
+  (void) jpeg_read_header(&dec->cinfo, TRUE);
+  
+  dec->cinfo.scale_num = 1;
+  dec->cinfo.scale_denom = mul;
+  
+  assert(dec->cinfo.jpeg_color_space == JCS_YCbCr);
+  dec->cinfo.dct_method = JDCT_FASTEST;
+  dec->cinfo.do_fancy_upsampling = TRUE;
+  jpeg_start_decompress(&dec->cinfo);
+  
+  row_stride = dec->cinfo.output_width * dec->cinfo.output_components;
+  buffer = (*dec->cinfo.mem->alloc_sarray)
+  ((j_common_ptr) &dec->cinfo, JPOOL_IMAGE, row_stride, data->common->mcu_h/mul);
+  
+  assert(off_x < dec->cinfo.output_width && off_y < dec->cinfo.output_height);
+  cw = imin(area->width, dec->cinfo.output_width - off_x);
+  
+  //the halo below the tile is not needed for the last rows
+  while (dec->cinfo.output_scanline < imin(dec->cinfo.output_height, off_y + area->height)) {
+    y = dec->cinfo.output_scanline;
+    lines_read = jpeg_read_scanlines(&dec->cinfo, buffer, data->common->mcu_h/mul);
+    for(j=imax(off_y-y, 0);j<lines_read && y+j<off_y+area->height;j++) {
+      rp = r + (y+j-off_y)*area->width;
+      gp = g + (y+j-off_y)*area->width;
+      bp = b + (y+j-off_y)*area->width;
+      for(i=0;i<cw;i++) {
+        rp[i] = buffer[j][(off_x+i)*3];
+        gp[i] = buffer[j][(off_x+i)*3+1];
+        bp[i] = buffer[j][(off_x+i)*3+2];
+      }
+    }
+  }
   
-  assert(cinfo.jpeg_color_space == JCS_YCbCr);
-  //cinfo.out_color_space   = JCS_YCbCr;
-  cinfo.dct_method = JDCT_FASTEST;
-  cinfo.do_fancy_upsampling = TRUE;
-  jpeg_start_decompress(&cinfo);
+  //keeps the decoder and its tables for the next tile
+  jpeg_abort_decompress(&dec->cinfo);
+}
+
+static void _mem_header(struct jpeg_decompress_struct *cinfo, const uint8_t *buf, size_t len, int scale)
+{
+  jpeg_create_decompress(cinfo);
+  jpeg_mem_src(cinfo, (unsigned char*)buf, len);
+  (void) jpeg_read_header(cinfo, TRUE);
+  
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = 1u << scale;
+  cinfo->out_color_space = JCS_RGB;
+  cinfo->dct_method = JDCT_FASTEST;
+  cinfo->do_fancy_upsampling = TRUE;
+  jpeg_calc_output_dimensions(cinfo);
+}
+
+//size of the jpeg in buf decoded at 1/2^scale (scale <= 3)
+int loadjpeg_mem_size(const uint8_t *buf, size_t len, int scale, int *w, int *h)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct my_error_mgr jerr;
   
-  assert(!cinfo.coef_bits);
-    
-  row_stride = cinfo.output_width * cinfo.output_components;
-  buffer = (*cinfo.mem->alloc_sarray)
-  ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, data->common->mcu_h/mul);
-  
-  //FIXME???
-  assert(area->width >= cinfo.output_width);
-  assert(data->serve_height/mul <= area->height);
-  
-  rp = r;
-  gp = g;
-  bp = b;
-  l = 0;
-  while (l<data->serve_height/mul) {
-    lines_read = jpeg_read_scanlines(&cinfo, buffer, data->common->mcu_h/mul);
-    l += lines_read;
-    for(j=0;j<lines_read;j++,rp+=area->width,gp+=area->width,bp+=area->width)
-      for(i=0;i<cinfo.output_width;i++) {
-        rp[i] = buffer[j][i*3];
-        gp[i] = buffer[j][i*3+1];
-        bp[i] = buffer[j][i*3+2];
-      }
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = my_error_exit;
+  
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    return -1;
   }
   
-  jpeg_abort_decompress(&cinfo);
+  _mem_header(&cinfo, buf, len, scale);
+  *w = cinfo.output_width;
+  *h = cinfo.output_height;
   jpeg_destroy_decompress(&cinfo);
   
-  fclose(file);
+  return 0;
 }
 
-static void _loadjpeg_worker_ijg_original(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+//whole jpeg in buf at 1/2^scale into planes of the size from loadjpeg_mem_size()
+int loadjpeg_mem_decode(const uint8_t *buf, size_t len, int scale, uint8_t *r, uint8_t *g, uint8_t *b)
 {
-  _Data *data = ea_data(f->data, thread_id);
-  
-  uint8_t *r, *g, *b;
-  uint8_t *rp, *gp, *bp;
   int i, j;
-  int xstep, ystep;
   JSAMPARRAY buffer;    /* Output row buffer */
   int row_stride;   /* physical row width in output buffer */
-  FILE *file;
   int lines_read;
   
   struct jpeg_decompress_struct cinfo;
   struct my_error_mgr jerr;
   
-  assert(out && ea_count(out) == 3);
-  
-  //maximum scaledown: 1/8
-  assert(area->corner.scale <= 3);
-  
-  if (area->corner.x || area->corner.y) {
-    printf("FIXME: invalid tile requested in loadjpg: %dx%d\n", area->corner.x, area->corner.y);
-    return;
-  }
-  
-  r = ((Tiledata*)ea_data(out, 0))->data;
-  g = ((Tiledata*)ea_data(out, 1))->data;
-  b = ((Tiledata*)ea_data(out, 2))->data;
-  
-  file = fopen(data->common->filename, "rb");
-    
-  if (!file) {
-    printf("error opening file!\n");
-    data->common->error = EINA_TRUE;
-    return;
-  }
-  
   cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = my_error_exit;
   
   if (setjmp(jerr.setjmp_buffer)) {
     jpeg_destroy_decompress(&cinfo);
-    fclose(file); {
-    printf("error opening jpeg file!\n");
-    data->common->error = EINA_TRUE;
-    return;
-  }
+    return -1;
   }
-  jpeg_create_decompress(&cinfo);
-
-  jpeg_stdio_src(&cinfo, file);
-
-  (void) jpeg_read_header(&cinfo, TRUE);
-
-  cinfo.scale_num = 1;
-  cinfo.scale_denom = 1u << area->corner.scale;
   
-  assert(cinfo.jpeg_color_space == JCS_YCbCr);
-  //cinfo.out_color_space   = JCS_YCbCr;
-  cinfo.dct_method = JDCT_FASTEST;
-  cinfo.do_fancy_upsampling = TRUE;
+  _mem_header(&cinfo, buf, len, scale);
   jpeg_start_decompress(&cinfo);
   
   row_stride = cinfo.output_width * cinfo.output_components;
   buffer = (*cinfo.mem->alloc_sarray)
   ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 16);
   
-  rp = r;
-  gp = g;
-  bp = b;
-  xstep = 1;
-  ystep = 0;
-
   while (cinfo.output_scanline < cinfo.output_height) {
     lines_read = jpeg_read_scanlines(&cinfo, buffer, 16);
-    for(j=0;j<lines_read;j++,rp+=ystep,gp+=ystep,bp+=ystep)
-      for(i=0;i<cinfo.output_width;i++,rp+=xstep,gp+=xstep,bp+=xstep) {
-        rp[0] = buffer[j][i*3];
-        gp[0] = buffer[j][i*3+1];
-        bp[0] = buffer[j][i*3+2];
+    for(j=0;j<lines_read;j++)
+      for(i=0;i<cinfo.output_width;i++,r++,g++,b++) {
+        r[0] = buffer[j][i*3];
+        g[0] = buffer[j][i*3+1];
+        b[0] = buffer[j][i*3+2];
       }
   }
   
   jpeg_finish_decompress(&cinfo);
   jpeg_destroy_decompress(&cinfo);
   
-  fclose(file);
+  return 0;
+}
+
+static void _loadjpeg_worker_ijg_original(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+{
+  _Data *data = ea_data(f->data, thread_id);
+  
+  assert(out && ea_count(out) == 3);
+  
+  //maximum scaledown: 1/8
+  assert(area->corner.scale <= 3);
+  
+  if (area->corner.x || area->corner.y) {
+    printf("FIXME: invalid tile requested in loadjpg: %dx%d\n", area->corner.x, area->corner.y);
+    return;
+  }
+  
+  if (loadjpeg_mem_decode(data->common->map, data->common->map_size, area->corner.scale,
+                          ((Tiledata*)ea_data(out, 0))->data,
+                          ((Tiledata*)ea_data(out, 1))->data,
+                          ((Tiledata*)ea_data(out, 2))->data)) {
+    printf("error opening jpeg file!\n");
+    data->common->error = EINA_TRUE;
+  }
 }
 
 static void simple_scale(int src_w, int src_h, int dst_w, int dst_h, uint8_t *src, uint8_t *dst)
@@ -815,17 +888,10 @@ static void _loadjpeg_worker_ijg_thumb(Filter *f, Eina_Array *in, Eina_Array *ou
   _Data *data = ea_data(f->data, thread_id);
   
   uint8_t *r, *g, *b;
-  uint8_t *rp, *gp, *bp;
-  int i, j;
-  JSAMPARRAY buffer;    /* Output row buffer */
-  int row_stride;   /* physical row width in output buffer */
-  int lines_read;
   uint8_t *rt, *gt, *bt;
+  int w, h;
   int mul = 1u << area->corner.scale;
   
-  struct jpeg_decompress_struct cinfo;
-  struct my_error_mgr jerr;
-  
   assert(out && ea_count(out) == 3);
   
   if (area->corner.x || area->corner.y) {
@@ -836,60 +902,30 @@ static void _loadjpeg_worker_ijg_thumb(Filter *f, Eina_Array *in, Eina_Array *ou
   r = ((Tiledata*)ea_data(out, 0))->data;
   g = ((Tiledata*)ea_data(out, 1))->data;
   b = ((Tiledata*)ea_data(out, 2))->data;
-
-  cinfo.err = jpeg_std_error(&jerr.pub);
   
-  if (setjmp(jerr.setjmp_buffer)) {
-    jpeg_destroy_decompress(&cinfo); {
+  if (loadjpeg_mem_size(data->common->thumb_data, data->common->thumb_len, 0, &w, &h)) {
     printf("error opening jpeg file!\n");
     data->common->error = EINA_TRUE;
     return;
   }
-  }
-  jpeg_create_decompress(&cinfo);
-
-  jpeg_mem_src(&cinfo, data->common->thumb_data, data->common->thumb_len);
-
-  (void)jpeg_read_header(&cinfo, TRUE);
-  
-  assert(cinfo.jpeg_color_space == JCS_YCbCr);
-  //cinfo.out_color_space   = JCS_YCbCr;
-  cinfo.dct_method = JDCT_FASTEST;
-  cinfo.do_fancy_upsampling = TRUE;
-  jpeg_start_decompress(&cinfo);
-     
-  row_stride = cinfo.output_width * cinfo.output_components;
-  buffer = (*cinfo.mem->alloc_sarray)
-  ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 16);
   
-  rt = malloc(cinfo.output_width*cinfo.output_height);
-  gt = malloc(cinfo.output_width*cinfo.output_height);
-  bt = malloc(cinfo.output_width*cinfo.output_height);
+  rt = malloc(w*h);
+  gt = malloc(w*h);
+  bt = malloc(w*h);
   
-  rp = rt;
-  gp = gt;
-  bp = bt;
-  
-  while (cinfo.output_scanline < cinfo.output_height) {
-    lines_read = jpeg_read_scanlines(&cinfo, buffer, 16);
-    for(j=0;j<lines_read;j++)
-      for(i=0;i<cinfo.output_width;i++,rp++,gp++,bp++) {
-        rp[0] = buffer[j][i*3];
-        gp[0] = buffer[j][i*3+1];
-        bp[0] = buffer[j][i*3+2];
-      }
+  if (loadjpeg_mem_decode(data->common->thumb_data, data->common->thumb_len, 0, rt, gt, bt)) {
+    printf("error opening jpeg file!\n");
+    data->common->error = EINA_TRUE;
+  }
+  else {
+    simple_scale(w, h, data->common->w/mul, data->common->h/mul, rt, r);
+    simple_scale(w, h, data->common->w/mul, data->common->h/mul, gt, g);
+    simple_scale(w, h, data->common->w/mul, data->common->h/mul, bt, b);
   }
-
-  simple_scale(cinfo.output_width, cinfo.output_height, data->common->w/mul, data->common->h/mul, rt, r);
-  simple_scale(cinfo.output_width, cinfo.output_height, data->common->w/mul, data->common->h/mul, gt, g);
-  simple_scale(cinfo.output_width, cinfo.output_height, data->common->w/mul, data->common->h/mul, bt, b);
   
   free(rt);
   free(gt);
   free(bt);
-  
-  jpeg_finish_decompress(&cinfo);
-  jpeg_destroy_decompress(&cinfo);
 }
 
 static void _loadjpeg_worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
@@ -915,6 +951,183 @@ int min(a, b)
   return b;
 }
 
+static int _seekable_try(_Common *common)
+{
+  if (!common->rst_int 
+    || JPEG_TILE_WIDTH % (common->rst_int * common->mcu_w) || common->w % (common->rst_int * common->mcu_w))
+    return -1;
+  
+  //a pending copy is split once it exists
+  if (!common->rst_pending && _header_split(common))
+    return -1;
+  
+  common->seekable = 3;
+  common->iw = common->w / (common->mcu_w*common->rst_int);
+  common->ih = (common->h + common->mcu_h-1) / common->mcu_h;
+  
+  return 0;
+}
+
+//lossless transcode of the mapped file to a sequential file with restart markers
+static int _rst_transcode(_Common *common, const char *dst, int rst_int)
+{
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct out;
+  struct my_error_mgr jerr;
+  jvirt_barray_ptr *coefs;
+  FILE *file;
+  char *tmp;
+  int fd;
+  
+  tmp = malloc(strlen(dst)+8);
+  sprintf(tmp, "%s.XXXXXX", dst);
+  fd = mkstemp(tmp);
+  if (fd == -1) {
+    free(tmp);
+    return -1;
+  }
+  file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    return -1;
+  }
+  
+  memset(&src, 0, sizeof(src));
+  memset(&out, 0, sizeof(out));
+  //one error manager may be shared by several objects
+  src.err = jpeg_std_error(&jerr.pub);
+  out.err = &jerr.pub;
+  jerr.pub.error_exit = my_error_exit;
+  
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_compress(&out);
+    jpeg_destroy_decompress(&src);
+    fclose(file);
+    unlink(tmp);
+    free(tmp);
+    return -1;
+  }
+  
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&out);
+  
+  jpeg_mem_src(&src, common->map, common->map_size);
+  jpeg_read_header(&src, TRUE);
+  coefs = jpeg_read_coefficients(&src);
+  
+  jpeg_copy_critical_parameters(&src, &out);
+  out.restart_interval = rst_int;
+  out.optimize_coding = TRUE;
+  jpeg_stdio_dest(&out, file);
+  jpeg_write_coefficients(&out, coefs);
+  
+  jpeg_finish_compress(&out);
+  jpeg_finish_decompress(&src);
+  jpeg_destroy_compress(&out);
+  jpeg_destroy_decompress(&src);
+  
+  if (fclose(file) || rename(tmp, dst)) {
+    unlink(tmp);
+    free(tmp);
+    return -1;
+  }
+  
+  free(tmp);
+  
+  return 0;
+}
+
+//largest interval up to JPEG_RST_WIDTH which fits the image width, 0 if there is none
+static int _rst_int_get(_Common *common)
+{
+  int rst_int;
+  
+  for(rst_int=JPEG_RST_WIDTH/common->mcu_w;rst_int>=1;rst_int/=2)
+    if (common->w % (rst_int*common->mcu_w) == 0)
+      return rst_int;
+  
+  return 0;
+}
+
+//the interval is part of the name, copies made with another one are never reused
+static char *_rst_copy_path(_Common *common)
+{
+  char ext[32];
+  
+  snprintf(ext, sizeof(ext), ".%d.jpg", common->rst_int);
+  return diskcache_path("jpeg_rst", common->filename, ext);
+}
+
+//the copy needs a cache entry which exists or can be written, otherwise the
+//scales are decoded whole like before
+static int _rst_copy_possible(_Common *common)
+{
+  char *path = _rst_copy_path(common);
+  char *slash;
+  int ok;
+  
+  if (!path)
+    return 0;
+  
+  ok = !access(path, R_OK);
+  if (!ok && (slash = strrchr(path, '/'))) {
+    *slash = '\0';
+    ok = !access(path, W_OK);
+  }
+  free(path);
+  
+  return ok;
+}
+
+/*
+ * files without usable restart markers (or progressive ones) are transcoded
+ * once into the disk cache, tiles are then decoded from the copy.
+ * done on the first seeking tile request, scales served from the whole file
+ * never pay for it. must hold common->lock
+ */
+static int _rst_copy_map(_Common *common)
+{
+  char *path;
+  
+  if (!common->rst_pending)
+    return 0;
+  
+  path = _rst_copy_path(common);
+  if (!path)
+    return -1;
+  
+  if (!access(path, R_OK))
+    diskcache_touch(path);
+  else if (_rst_transcode(common, path, common->rst_int)) {
+    free(path);
+    return -1;
+  }
+  else
+    diskcache_trim("jpeg_rst", ".jpg", JPEG_RST_CACHE_MAX);
+  
+  //the file stays mapped for the unseekable scales
+  if (_map_file(path, &common->seek_map, &common->seek_map_size)) {
+    free(path);
+    return -1;
+  }
+  
+  if (_header_split(common)) {
+    munmap(common->seek_map, common->seek_map_size);
+    common->seek_map = common->map;
+    common->seek_map_size = common->map_size;
+    free(path);
+    return -1;
+  }
+  
+  IF_FREE(common->rst_copy)
+  common->rst_copy = path;
+  common->rst_pending = 0;
+  
+  return 0;
+}
+
 int _loadjpeg_input_fixed(Filter *f)
 {
   int i;
@@ -922,14 +1135,12 @@ int _loadjpeg_input_fixed(Filter *f)
   _Data *tdata;
   struct jpeg_decompress_struct cinfo;
   struct my_error_mgr jerr;
-  FILE *file;
-  
-  file = fopen(data->common->input->data, "r");
   
-  if (!file)
+  if (_map(data->common, data->common->input->data))
     return -1;
   
   IF_FREE(data->common->index)
+  IF_FREE(data->common->rst_copy)
   
   for(i=0;i<ea_count(f->data);i++) {
     tdata = ea_data(f->data, i);
@@ -943,24 +1154,24 @@ int _loadjpeg_input_fixed(Filter *f)
 
   if (setjmp(jerr.setjmp_buffer)) {
     jpeg_destroy_decompress(&cinfo);
-    fclose(file);
     return -1;
   }
   
   jpeg_create_decompress(&cinfo);
-  jpeg_stdio_src(&cinfo, file);
+  jpeg_mem_src(&cinfo, data->common->map, data->common->map_size);
   jpeg_read_header(&cinfo, TRUE);
   jpeg_calc_output_dimensions(&cinfo);
   
   if (cinfo.jpeg_color_space != JCS_YCbCr) {
     printf("implement jpeg_color_space %d\n", cinfo.jpeg_color_space);
+    jpeg_destroy_decompress(&cinfo);
     return -1;
   }
   
   //default
   data->common->rot = 1;
   
-  get_exif_stuff(data->common->filename, &data->common->thumb_data, &data->common->thumb_len, &data->common->rot);
+  get_exif_stuff(data->common->filename, data->common->map, data->common->map_size, &data->common->thumb_data, &data->common->thumb_len, &data->common->rot);
   
   
   data->common->mcu_w = cinfo.max_h_samp_factor*8;
@@ -974,9 +1185,15 @@ int _loadjpeg_input_fixed(Filter *f)
   
   //printf("seekable tile size: %dx%d\n", data->common->rst_int*data->common->mcu_w, data->common->mcu_h);
 
-  if (data->common->rst_int 
-    && JPEG_TILE_WIDTH % (data->common->rst_int * data->common->mcu_w) == 0 && data->common->w % (data->common->rst_int * data->common->mcu_w) == 0)
-    data->common->seekable = 3;
+  data->common->seekable = 0;
+  data->common->rst_pending = 0;
+  data->common->rst_failed = 0;
+  if (_seekable_try(data->common) && (data->common->rst_int = _rst_int_get(data->common))
+      && _rst_copy_possible(data->common)) {
+    data->common->rst_pending = 1;
+    if (_seekable_try(data->common))
+      data->common->rst_pending = 0;
+  }
   
   ((Dim*)data->common->dim)->scaledown_max = 3;
   
@@ -1014,8 +1231,6 @@ int _loadjpeg_input_fixed(Filter *f)
   }
   
   jpeg_destroy_decompress(&cinfo);
-  
-  fclose(file);
 
   return 0;
 }
@@ -1028,13 +1243,17 @@ static int _del(Filter *f)
   free(data->common->thumb_data);
   pthread_mutex_destroy(data->common->lock);
   free(data->common->lock);
-  free(data->common->size_pos);
   IF_FREE(data->common->index)
+  IF_FREE(data->common->tables)
+  IF_FREE(data->common->frame)
+  IF_FREE(data->common->rst_copy)
+  _unmap(data->common);
   
   free(data->common);
   
   for(i=0;i<ea_count(f->data);i++) {
     data = ea_data(f->data, i);
+    _dec_del(data);
     free(data);
   }
   
@@ -1048,11 +1267,12 @@ Filter *filter_loadjpeg_new(void)
   Meta *in, *out, *channel, *bitdepth, *color, *dim, *fliprot;
   _Data *data = calloc(sizeof(_Data), 1);
   data->common = calloc(sizeof(_Common), 1);
-  data->common->size_pos = calloc(sizeof(int*), 1);
   data->common->lock = calloc(sizeof(pthread_mutex_t), 1);
   assert(pthread_mutex_init(data->common->lock, NULL) == 0);
   data->common->dim = calloc(sizeof(Dim), 1);
   
+  pthread_once(&_ff_once, &_ff_init);
+  
   filter->del = &_del;
   filter->mode_buffer = filter_mode_buffer_new();
   filter->mode_buffer->worker = &_loadjpeg_worker;
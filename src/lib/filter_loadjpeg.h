@@ -24,5 +24,9 @@
 
 extern Filter_Core filter_core_loadjpeg;
 
+//whole image decode of a jpeg in memory, also used for embedded previews
+int loadjpeg_mem_size(const uint8_t *buf, size_t len, int scale, int *w, int *h);
+int loadjpeg_mem_decode(const uint8_t *buf, size_t len, int scale, uint8_t *r, uint8_t *g, uint8_t *b);
+
 #endif
 
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter_loadlime.h"
+#include "limefile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/*
+ * the mapping outlives the filter as long as cached tiles point into it.
+ * lime files must only be replaced by rename, like savelime does: that
+ * leaves the mapped inode alone. a file truncated or rewritten in place
+ * while mapped faults (SIGBUS) on the next read of a tile, which is not
+ * guarded against.
+ */
+typedef struct {
+  uint8_t *base;
+  size_t size;
+  int refs;
+  dev_t dev;
+  ino_t ino;
+} _Map;
+
+typedef struct {
+  Meta *input;
+  Meta *dim;
+  Meta *bitdepth;
+  Meta *color[3];
+  _Map *map;
+  Limefile_Header header;
+  Limefile_Entry *index;
+} _Data;
+
+static void _map_unref(void *owner)
+{
+  _Map *map = owner;
+
+  if (__sync_sub_and_fetch(&map->refs, 1))
+    return;
+
+  munmap(map->base, map->size);
+  free(map);
+}
+
+static void _undelta(uint8_t *buf, int w, int h, int depth16)
+{
+  int x, y;
+  uint16_t *buf16 = (uint16_t*)buf;
+
+  for(y=0;y<h;y++)
+    if (depth16)
+      for(x=1;x<w;x++)
+        buf16[y*w+x] += buf16[y*w+x-1];
+    else
+      for(x=1;x<w;x++)
+        buf[y*w+x] += buf[y*w+x-1];
+}
+
+static void _worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+{
+  _Data *data = ea_data(f->data, 0);
+  Limefile_Header *h = &data->header;
+  Limefile_Entry *entry;
+  Tiledata *td;
+  uLong len;
+  int ch, tx, ty;
+  int depth16 = h->bitdepth == BD_U16;
+  int bytes = area->width*area->height*(depth16 ? 2 : 1);
+
+  assert(out && ea_count(out) == 3);
+
+  tx = area->corner.x/(int)h->tile_width;
+  ty = area->corner.y/(int)h->tile_height;
+
+  for(ch=0;ch<3;ch++) {
+    td = ea_data(out, ch);
+    if (depth16)
+      hack_tiledata_fixsize_mt(2, td);
+
+    if (area->corner.x < 0 || area->corner.y < 0
+        || area->corner.x % h->tile_width || area->corner.y % h->tile_height
+        || area->width != h->tile_width || area->height != h->tile_height
+        || tx >= limefile_tiles_x(h, area->corner.scale) || ty >= limefile_tiles_y(h, area->corner.scale)) {
+      printf("FIXME: loadlime invalid tile request\n");
+      memset(td->data, 0, bytes);
+      continue;
+    }
+
+    entry = &data->index[limefile_entry_idx(h, area->corner.scale, tx, ty, ch)];
+
+    if (!entry->len)
+      memset(td->data, 0, bytes);
+    //no decode and no copy, the cache references the mapping
+    else if (entry->compression == LIMEFILE_RAW) {
+      __sync_fetch_and_add(&data->map->refs, 1);
+      tiledata_borrow(td, data->map->base + entry->offset, &_map_unref, data->map);
+    }
+    else {
+      len = bytes;
+      if (uncompress(td->data, &len, data->map->base + entry->offset, entry->len) != Z_OK || len != bytes) {
+        printf("loadlime: corrupt tile in %s\n", (char*)data->input->data);
+        memset(td->data, 0, bytes);
+        continue;
+      }
+      _undelta(td->data, area->width, area->height, depth16);
+    }
+  }
+}
+
+static void _map_release(_Data *data)
+{
+  if (!data->map)
+    return;
+
+  //the cache may still borrow from it
+  _map_unref(data->map);
+  data->map = NULL;
+  data->index = NULL;
+}
+
+static int _header_valid(Limefile_Header *h)
+{
+  //sizes below 2^30 keep the tile counts of limefile.h in range
+  return !memcmp(h->magic, LIMEFILE_MAGIC, sizeof(LIMEFILE_MAGIC))
+      && h->version == LIMEFILE_VERSION
+      && h->width && h->height && h->tile_width && h->tile_height
+      && h->width < (1u << 30) && h->height < (1u << 30)
+      && h->tile_width < (1u << 15) && h->tile_height < (1u << 15)
+      && h->scales && h->scales <= LIMEFILE_SCALES_MAX
+      && h->channels == 3 && h->layout == LIMEFILE_PLANAR
+      && (h->bitdepth == BD_U8 || h->bitdepth == BD_U16);
+}
+
+static int _input_fixed(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+  Limefile_Header header;
+  struct stat st;
+  uint64_t i, count, tile_bytes;
+  void *base;
+  int fd;
+
+  fd = open((char*)data->input->data, O_RDONLY);
+  if (fd == -1) {
+    _map_release(data);
+    return -1;
+  }
+
+  //cheap rejection of other formats before mapping anything
+  if (pread(fd, &header, sizeof(Limefile_Header), 0) != sizeof(Limefile_Header)
+      || !_header_valid(&header) || fstat(fd, &st)) {
+    close(fd);
+    _map_release(data);
+    return -1;
+  }
+
+  //same file, the metas still describe it (files are replaced by rename)
+  if (data->map && st.st_dev == data->map->dev && st.st_ino == data->map->ino) {
+    close(fd);
+    return 0;
+  }
+
+  _map_release(data);
+
+  count = limefile_entry_count(&header);
+  if (header.index_offset > st.st_size
+      || count > (st.st_size - header.index_offset)/sizeof(Limefile_Entry)) {
+    printf("loadlime: truncated file %s\n", (char*)data->input->data);
+    close(fd);
+    return -1;
+  }
+
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return -1;
+  madvise(base, st.st_size, MADV_RANDOM);
+
+  data->map = calloc(sizeof(_Map), 1);
+  data->map->base = base;
+  data->map->size = st.st_size;
+  data->map->refs = 1;
+  data->map->dev = st.st_dev;
+  data->map->ino = st.st_ino;
+  data->header = header;
+  data->index = (Limefile_Entry*)(data->map->base + header.index_offset);
+
+  //raw tiles are borrowed as a whole Tiledata
+  tile_bytes = (uint64_t)header.tile_width*header.tile_height*(header.bitdepth == BD_U16 ? 2 : 1);
+  for(i=0;i<count;i++)
+    if (data->index[i].offset > st.st_size || data->index[i].len > st.st_size - data->index[i].offset
+        || (data->index[i].len && data->index[i].compression == LIMEFILE_RAW
+            && data->index[i].len != tile_bytes)) {
+      printf("loadlime: invalid tile index in %s\n", (char*)data->input->data);
+      _map_release(data);
+      return -1;
+    }
+
+  ((Dim*)data->dim)->width = header.width;
+  ((Dim*)data->dim)->height = header.height;
+  ((Dim*)data->dim)->scaledown_max = header.scales-1;
+
+  for(i=0;i<3;i++)
+    *(int*)(data->color[i]->data) = header.colors[i];
+  *(int*)(data->bitdepth->data) = header.bitdepth;
+
+  f->tile_width = header.tile_width;
+  f->tile_height = header.tile_height;
+
+  return 0;
+}
+
+static int _del(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+
+  _map_release(data);
+  free(data->dim);
+  free(data);
+
+  return 0;
+}
+
+Filter *filter_loadlime_new(void)
+{
+  Filter *filter = filter_new(&filter_core_loadlime);
+  Meta *in, *out, *channel, *bitdepth, *dim, *fliprot;
+  _Data *data = calloc(sizeof(_Data), 1);
+  data->dim = calloc(sizeof(Dim), 1);
+
+  filter->del = &_del;
+  filter->mode_buffer = filter_mode_buffer_new();
+  filter->mode_buffer->worker = &_worker;
+  filter->mode_buffer->threadsafe = 1;
+  filter->input_fixed = &_input_fixed;
+  filter->fixme_outcount = 3;
+  ea_push(filter->data, data);
+
+  bitdepth = meta_new_data(MT_BITDEPTH, filter, malloc(sizeof(int)));
+  *(int*)(bitdepth->data) = BD_U8;
+  data->bitdepth = bitdepth;
+
+  dim = meta_new_data(MT_IMGSIZE, filter, data->dim);
+  eina_array_push(filter->core, dim);
+
+  out = meta_new(MT_BUNDLE, filter);
+  eina_array_push(filter->out, out);
+
+  in = meta_new(MT_LOADIMG, filter);
+  in->replace = out;
+  eina_array_push(filter->in, in);
+  data->input = in;
+
+  fliprot = meta_new_data(MT_FLIPROT, filter, malloc(sizeof(int)));
+  *(int*)fliprot->data = 1;
+  meta_attach(out, fliprot);
+
+  channel = meta_new_channel(filter, 1);
+  data->color[0] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[0]->data) = CS_RGB_R;
+  meta_attach(channel, data->color[0]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, dim);
+  meta_attach(out, channel);
+
+  channel = meta_new_channel(filter, 2);
+  data->color[1] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[1]->data) = CS_RGB_G;
+  meta_attach(channel, data->color[1]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, dim);
+  meta_attach(out, channel);
+
+  channel = meta_new_channel(filter, 3);
+  data->color[2] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[2]->data) = CS_RGB_B;
+  meta_attach(channel, data->color[2]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, dim);
+  meta_attach(out, channel);
+
+  return filter;
+}
+
+Filter_Core filter_core_loadlime = {
+  "Lime pyramid loader",
+  "loadlime",
+  "Loads memory-mapped lime pyramid files",
+  &filter_loadlime_new
+};
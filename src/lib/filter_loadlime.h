@@ -1,29 +1,28 @@
-/*
- * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
- *
- * This file is part of lime.
- * 
- * Lime is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- * 
- * Lime is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * 
- * You should have received a copy of the GNU General Public License
- * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <libraw.h>
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-libraw_data_t *libraw_data_copy(libraw_data_t *src);
-void libraw_copy_del(libraw_data_t *copy);
-#ifdef __cplusplus
-}
-#endif
\ No newline at end of file
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ * 
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILTER_LOADLIME_H
+#define _FILTER_LOADLIME_H
+
+#include "Lime.h"
+
+extern Filter_Core filter_core_loadlime;
+
+#endif
+
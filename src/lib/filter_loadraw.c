@@ -18,11 +18,20 @@
  */
 
 #include "filter_loadraw.h"
-#include "libraw_helpers.h"
+
+#include "cache.h"
+#include "exif_helpers.h"
+#include "filter_loadjpeg.h"
 
 #include <libexif/exif-data.h>
 #include <jpeglib.h>
 #include <setjmp.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define RAW_TILE_WIDTH 1024
 #define RAW_TILE_HEIGHT 256
@@ -33,19 +42,55 @@
 #include <libexif/exif-loader.h>
 
 #define RAW_TILING_BORDER 8
+#define RAW_SCALES_MAX 8
+//smallest image size to offer a scale for, coarser views are downscaled
+#define RAW_PREVIEW_MIN_SIZE 160
 
-#define RAW_THREADSAFE_BUT_LEAK
+enum {
+  BAND_TODO,
+  BAND_BUSY,
+  BAND_DONE,
+  BAND_FAILED
+};
 
-/* Expanded data source object for stdio input */
+typedef struct {
+  uint16_t **data; //interleaved rgb, one buffer per band of tile rows
+  int w, h;
+  uint8_t *bands; //state of each band of tile rows, processed scales only
+  int band_count;
+  uint8_t *copied; //tiles copied out at least once
+  int tiles_x;
+  int tiles_left; //data is freed once every tile was copied out
+  int *band_tiles; //per band, processed bands are freed once their tiles were copied out
+  int readers; //workers copying from data
+  int *band_readers;
+} _Img;
 
 typedef struct {
-  libraw_data_t *raw;
-  int unpacked;
+  libraw_data_t *raw; //metadata, preview and the unpacked sensor data
   int opened;
-#ifdef RAW_THREADSAFE_BUT_LEAK
+  int unpacked; //0 not yet, 1 done, -1 failed
   pthread_mutex_t lock;
-#endif
+  pthread_mutex_t raw_lock; //libraw processing of raw, sensors loadraw can not demosaic
+  int bayer; //2x2 bayer sensor, bands are demosaiced from the unpacked sensor data
+  float black[4], mul[4]; //per cfa color
+  float cam[3][3]; //camera to linear ProPhoto
+  pthread_cond_t band_cond;
   Meta *exif;
+  uint8_t *map; //file, shared by the per thread instances
+  size_t map_size;
+  int w, h;
+  unsigned filters;
+  int rot; //exif orientation of the sensor data
+  //whole image per scale, a band is read only once it is done
+  _Img img[RAW_SCALES_MAX];
+  //scales below are processed from the raw data, the others come from the preview
+  int processed_scales;
+  uint8_t *preview; //embedded jpeg preview
+  int preview_len;
+  int preview_w, preview_h; //in the layout of the sensor data
+  int preview_orient; //exif orientation the preview is stored in
+  uint16_t lin[256]; //sRGB to linear 16 bit, still sRGB primaries
 } _Common;
 
 typedef struct {
@@ -78,7 +123,6 @@ typedef struct {
   char *filename;
   Meta *fliprot;
   int thumb_len;
-  libraw_data_t *raw;
 } _Data;
 
 static int imin(a, b) 
@@ -87,146 +131,757 @@ static int imin(a, b)
   return b;
 }
 
-static void _worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+static int imax(int a, int b)
 {
-  int ch, i, j;
-  int tb;
-  int offx, offy;
-  int w, h;
-#ifdef RAW_THREADSAFE_BUT_LEAK
-  _Data *data = ea_data(f->data, thread_id);
-  _Data *tdata;
-#else
-  _Data *data = ea_data(f->data, 0);
-#endif
-  Tiledata *out_td;
-  libraw_processed_image_t *img;
-  int errcode;
+  if (a>=b) return a;
+  return b;
+}
+
+static int _orient_swaps(int o)
+{
+  return o >= 5 && o <= 8;
+}
+
+//position in the displayed image of x,y of a w x h image stored with exif orientation o
+static void _orient_map(int o, int x, int y, int w, int h, int *dx, int *dy)
+{
+  switch (o) {
+    case 2 : *dx = w-1-x; *dy = y; break;
+    case 3 : *dx = w-1-x; *dy = h-1-y; break;
+    case 4 : *dx = x; *dy = h-1-y; break;
+    case 5 : *dx = y; *dy = x; break;
+    case 6 : *dx = h-1-y; *dy = x; break;
+    case 7 : *dx = h-1-y; *dy = w-1-x; break;
+    case 8 : *dx = y; *dy = w-1-x; break;
+    default : *dx = x; *dy = y;
+  }
+}
+
+static int _band_rows(_Img *img, int band)
+{
+  return imin(RAW_TILE_HEIGHT, img->h - band*RAW_TILE_HEIGHT);
+}
+
+static uint16_t *_img_row(_Img *img, int y)
+{
+  return img->data[y / RAW_TILE_HEIGHT] + (y % RAW_TILE_HEIGHT)*img->w*3;
+}
+
+static void _band_alloc(_Img *img, int band)
+{
+  if (!img->data[band])
+    img->data[band] = cache_buffer_alloc(sizeof(uint16_t)*3*img->w*_band_rows(img, band));
+}
+
+static void _band_free(_Img *img, int band)
+{
+  if (img->data[band])
+    cache_buffer_del(img->data[band], sizeof(uint16_t)*3*img->w*_band_rows(img, band));
+  img->data[band] = NULL;
+}
+
+static void _img_free(_Img *img)
+{
+  int i;
   
-  if (!data->common->unpacked) {
-#ifdef RAW_THREADSAFE_BUT_LEAK
-    pthread_mutex_lock(&data->common->lock);
-#endif
-    if (!data->common->unpacked) {
-      
-      data->common->raw->params.user_qual = 10;
-      data->common->raw->params.adjust_maximum_thr = 0.0;
-      data->common->raw->params.no_auto_bright = 1;
-      data->common->raw->params.no_auto_scale = 0;
-      data->common->raw->params.use_auto_wb = 0;
-      data->common->raw->params.use_camera_matrix = 0;
-      data->common->raw->params.output_bps = 16;
-      
-      //exposure
-      data->common->raw->params.exp_correc = 0.0;
-      data->common->raw->params.exp_shift = 0.0;
-      data->common->raw->params.exp_preser = 0.0;
-      
-      //sRGB
-      data->common->raw->params.output_color = 4;
-      //BT709
-      //data->common->raw->params.gamm[0]=1.0/2.222;
-      //data->common->raw->params.gamm[1]=4.5;
-      //sRGB
-      //data->common->raw->params.gamm[0]=1.0/2.4;
-      //data->common->raw->params.gamm[1]=12.92;
-        
-      data->common->raw->params.gamm[0]=1.0;
-      data->common->raw->params.gamm[1]=0.0;
-      
-      libraw_unpack(data->common->raw);
-      data->common->unpacked = 1;
-      
-#ifdef RAW_THREADSAFE_BUT_LEAK
-      for(i=0;i<ea_count(f->data);i++) {
-        tdata = ea_data(f->data, i);
-        if (tdata->raw)
-          libraw_copy_del(tdata->raw);
-        tdata->raw = libraw_data_copy(data->common->raw);
+  if (img->data)
+    for(i=0;i<img->band_count;i++)
+      _band_free(img, i);
+  free(img->data);
+  free(img->bands);
+  free(img->copied);
+  free(img->band_tiles);
+  free(img->band_readers);
+  memset(img, 0, sizeof(_Img));
+}
+
+static void _img_clear(_Common *common)
+{
+  int i;
+  
+  for(i=0;i<RAW_SCALES_MAX;i++)
+    _img_free(&common->img[i]);
+}
+
+//vw x vh is the image size the graph requests tiles of at this scale,
+//band buffers are allocated with _band_alloc()
+static void _img_alloc(_Img *img, int w, int h, int vw, int vh)
+{
+  int i;
+  
+  img->w = w;
+  img->h = h;
+  img->band_count = (h + RAW_TILE_HEIGHT-1) / RAW_TILE_HEIGHT;
+  img->data = calloc(img->band_count, sizeof(uint16_t*));
+  img->bands = calloc(img->band_count, 1);
+  img->tiles_x = (imin(w, vw) + RAW_TILE_WIDTH-1) / RAW_TILE_WIDTH;
+  img->tiles_left = img->tiles_x*((imin(h, vh) + RAW_TILE_HEIGHT-1) / RAW_TILE_HEIGHT);
+  img->copied = calloc(img->tiles_left, 1);
+  img->band_tiles = calloc(img->band_count, sizeof(int));
+  img->band_readers = calloc(img->band_count, sizeof(int));
+  for(i=0;i*RAW_TILE_HEIGHT<imin(h, vh);i++)
+    img->band_tiles[i] = img->tiles_x;
+}
+
+static void _preview_clear(_Common *common)
+{
+  free(common->preview);
+  common->preview = NULL;
+  common->preview_len = 0;
+  common->preview_w = 0;
+  common->preview_h = 0;
+  common->preview_orient = 0;
+}
+
+//keep the embedded jpeg preview, other thumbnail formats are ignored
+static void _preview_load(_Common *common)
+{
+  libraw_processed_image_t *thumb;
+  int errcode, w, h, o, swapped;
+  
+  _preview_clear(common);
+  
+  if (libraw_unpack_thumb(common->raw))
+    return;
+  
+  thumb = libraw_dcraw_make_mem_thumb(common->raw, &errcode);
+  if (!thumb)
+    return;
+  
+  if (thumb->type == LIBRAW_IMAGE_JPEG) {
+    common->preview_len = thumb->data_size;
+    common->preview = malloc(common->preview_len);
+    memcpy(common->preview, thumb->data, common->preview_len);
+  }
+  libraw_dcraw_clear_mem(thumb);
+  
+  if (!common->preview)
+    return;
+  
+  if (loadjpeg_mem_size(common->preview, common->preview_len, 0, &w, &h)) {
+    _preview_clear(common);
+    return;
+  }
+  
+  //untagged previews and tags which contradict the aspect of the raw are
+  //stored either upright or like the sensor data, whichever fits the aspect
+  o = lime_exif_orientation_mem(common->preview, common->preview_len);
+  swapped = (w > h) != (common->w > common->h);
+  if (!o || (_orient_swaps(o) != _orient_swaps(common->rot)) != swapped)
+    o = swapped ? 1 : common->rot;
+  if ((_orient_swaps(o) != _orient_swaps(common->rot)) != swapped) {
+    printf("loadraw: preview does not match the raw orientation, ignored\n");
+    _preview_clear(common);
+    return;
+  }
+  
+  common->preview_orient = o;
+  if (swapped) {
+    common->preview_w = h;
+    common->preview_h = w;
+  }
+  else {
+    common->preview_w = w;
+    common->preview_h = h;
+  }
+}
+
+//preview has enough resolution for scale (1% tolerance for differing crops)
+static int _preview_covers(_Common *common, int scale)
+{
+  int w = common->w >> scale;
+  int h = common->h >> scale;
+  
+  return common->preview && common->preview_w >= w - w/100 && common->preview_h >= h - h/100;
+}
+
+//linear sRGB (D65) to linear ProPhoto (D50, bradford adapted), the space of
+//the demosaiced scales. all positive and rows sum to one, so no clipping
+static const float _srgb2prophoto[3][3] = {
+  {0.529346, 0.330073, 0.140581},
+  {0.098374, 0.873461, 0.028165},
+  {0.016883, 0.117672, 0.865444}
+};
+
+//decode with dct scaling, then resample to the exact image size at this scale,
+//turned into the layout of the sensor data as the fliprot meta applies to both
+static int _preview_decode(_Common *common, int scale, _Img *img)
+{
+  uint8_t *rgb;
+  float v[3];
+  int x, y, c, s, i, ex, ey, sx, sy, pw, ph;
+  int w = imax(common->w >> scale, 1);
+  int h = imax(common->h >> scale, 1);
+  int o = common->preview_orient;
+  int inv = o == 6 ? 8 : (o == 8 ? 6 : o);
+  //display sizes of the sensor data and of the decoded preview
+  int dw, dh, pdw, pdh;
+  
+  for(s=3;s>0;s--)
+    if ((common->preview_w+(1<<s)-1)>>s >= w && (common->preview_h+(1<<s)-1)>>s >= h)
+      break;
+  
+  if (loadjpeg_mem_size(common->preview, common->preview_len, s, &pw, &ph))
+    return -1;
+  
+  rgb = malloc(pw*ph*3);
+  if (loadjpeg_mem_decode(common->preview, common->preview_len, s, rgb, rgb+pw*ph, rgb+2*pw*ph)) {
+    free(rgb);
+    return -1;
+  }
+  
+  dw = _orient_swaps(common->rot) ? h : w;
+  dh = _orient_swaps(common->rot) ? w : h;
+  pdw = _orient_swaps(o) ? ph : pw;
+  pdh = _orient_swaps(o) ? pw : ph;
+  
+  _img_alloc(img, w, h, w, h);
+  for(i=0;i<img->band_count;i++)
+    _band_alloc(img, i);
+  for(y=0;y<h;y++)
+    for(x=0;x<w;x++) {
+      _orient_map(common->rot, x, y, w, h, &ex, &ey);
+      _orient_map(inv, ex*pdw/dw, ey*pdh/dh, pdw, pdh, &sx, &sy);
+      i = sy*pw+sx;
+      for(c=0;c<3;c++)
+        v[c] = common->lin[rgb[c*pw*ph+i]];
+      for(c=0;c<3;c++)
+        _img_row(img, y)[x*3+c] = _srgb2prophoto[c][0]*v[0] + _srgb2prophoto[c][1]*v[1]
+                               + _srgb2prophoto[c][2]*v[2] + 0.5;
+    }
+  
+  free(rgb);
+  
+  return 0;
+}
+
+static void _unmap(_Common *common)
+{
+  if (common->map)
+    munmap(common->map, common->map_size);
+  common->map = NULL;
+  common->map_size = 0;
+}
+
+static int _map(_Common *common, const char *filename)
+{
+  struct stat st;
+  uint8_t *map;
+  int fd;
+  
+  _unmap(common);
+  
+  fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  
+  if (fstat(fd, &st) || !st.st_size) {
+    close(fd);
+    return -1;
+  }
+  
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  
+  common->map = map;
+  common->map_size = st.st_size;
+  
+  return 0;
+}
+
+static void _params_set(libraw_data_t *raw)
+{
+  raw->params.use_camera_matrix = 0;
+  raw->params.use_camera_wb = 1;
+  raw->params.user_flip = 0;
+  raw->params.use_rawspeed = 1;
+  
+  raw->params.user_qual = 10;
+  raw->params.adjust_maximum_thr = 0.0;
+  raw->params.no_auto_bright = 1;
+  raw->params.no_auto_scale = 0;
+  raw->params.use_auto_wb = 0;
+  raw->params.output_bps = 16;
+  
+  //exposure
+  raw->params.exp_correc = 0.0;
+  raw->params.exp_shift = 0.0;
+  raw->params.exp_preser = 0.0;
+  
+  //ProPhoto
+  raw->params.output_color = 4;
+  //BT709
+  //raw->params.gamm[0]=1.0/2.222;
+  //raw->params.gamm[1]=4.5;
+  //sRGB
+  //raw->params.gamm[0]=1.0/2.4;
+  //raw->params.gamm[1]=12.92;
+    
+  raw->params.gamm[0]=1.0;
+  raw->params.gamm[1]=0.0;
+}
+
+//color of the cfa at row,col of the visible area, the second green is green
+static int _fc(unsigned filters, int row, int col)
+{
+  int c = filters >> ((((row << 1) & 14) | (col & 1)) << 1) & 3;
+  
+  return c == 3 ? 1 : c;
+}
+
+/*
+ * libraw instances can not share unpacked sensor data, so for the common
+ * 2x2 bayer sensors loadraw demosaics bands itself from the data unpacked
+ * once into common->raw, which is only read after the unpack. black level,
+ * white balance and color matrix are taken from libraw like dcraw_process()
+ * does, everything else is processed by libraw on common->raw, one band at
+ * a time
+ */
+static int _bayer_setup(_Common *common)
+{
+  libraw_rawdata_t *rd = &common->raw->rawdata;
+  unsigned f = rd->iparams.filters;
+  float pre[4], dmin;
+  int i, j, c;
+  
+  if (!rd->raw_image || rd->iparams.colors != 3 || f < 1000 || rd->ioparams.fuji_width
+      || rd->sizes.pixel_aspect != 1.0 || rd->ph1_cblack || rd->ph1_rblack
+      || common->w < 4 || common->h < 4)
+    return 0;
+  
+  //a 2x2 pattern with the greens on one diagonal
+  for(j=0;j<16;j++)
+    for(i=0;i<2;i++)
+      if (_fc(f, j, i) != _fc(f, j&1, i))
+        return 0;
+  if (!(_fc(f,0,0) == 1 && _fc(f,1,1) == 1 && _fc(f,0,1) + _fc(f,1,0) == 2 && _fc(f,0,1) != 1)
+      && !(_fc(f,0,1) == 1 && _fc(f,1,0) == 1 && _fc(f,0,0) + _fc(f,1,1) == 2 && _fc(f,0,0) != 1))
+    return 0;
+  
+  //camera white balance like use_camera_wb, scaled to the full 16 bit range
+  for(c=0;c<4;c++)
+    pre[c] = rd->color.cam_mul[c];
+  if (pre[0] <= 0 || pre[1] <= 0 || pre[2] <= 0)
+    for(c=0;c<4;c++)
+      pre[c] = rd->color.pre_mul[c];
+  if (pre[3] <= 0)
+    pre[3] = pre[1];
+  dmin = pre[0];
+  for(c=0;c<4;c++) {
+    if (pre[c] <= 0)
+      return 0;
+    if (pre[c] < dmin)
+      dmin = pre[c];
+  }
+  for(c=0;c<4;c++) {
+    common->black[c] = rd->color.black + rd->color.cblack[c];
+    if (rd->color.maximum <= common->black[c])
+      return 0;
+    common->mul[c] = pre[c] / dmin * 65535.0 / (rd->color.maximum - common->black[c]);
+  }
+  
+  for(j=0;j<3;j++)
+    for(c=0;c<3;c++)
+      common->cam[j][c] = _srgb2prophoto[j][0]*rd->color.rgb_cam[0][c]
+                        + _srgb2prophoto[j][1]*rd->color.rgb_cam[1][c]
+                        + _srgb2prophoto[j][2]*rd->color.rgb_cam[2][c];
+  
+  return 1;
+}
+
+//the file is unpacked once, on the first band which is processed
+static int _unpack(_Common *common)
+{
+  int unpacked;
+  
+  pthread_mutex_lock(&common->lock);
+  if (!common->unpacked) {
+    common->unpacked = libraw_unpack(common->raw) ? -1 : 1;
+    if (common->unpacked > 0)
+      common->bayer = _bayer_setup(common);
+  }
+  unpacked = common->unpacked;
+  pthread_mutex_unlock(&common->lock);
+  
+  return unpacked > 0 ? 0 : -1;
+}
+
+//size at scale, libraw half_size only shrinks bayer images, all other
+//scales are box filtered from the next finer one
+static void _img_size(_Common *common, int scale, int *w, int *h)
+{
+  if (!scale) {
+    *w = common->w;
+    *h = common->h;
+  }
+  else if (scale == 1 && common->filters) {
+    *w = (common->w + 1) >> 1;
+    *h = (common->h + 1) >> 1;
+  }
+  else {
+    _img_size(common, scale-1, w, h);
+    *w /= 2;
+    *h /= 2;
+  }
+}
+
+//process one band of tile rows (plus a border for demosaicing) with libraw
+static int _band_libraw(_Common *common, int scale, int band, _Img *img)
+{
+  libraw_data_t *raw = common->raw;
+  libraw_processed_image_t *processed;
+  int j, w, rows, offy, errcode;
+  int tb = scale ? 0 : RAW_TILING_BORDER;
+  int y = band*RAW_TILE_HEIGHT;
+  
+  rows = imin(RAW_TILE_HEIGHT, img->h - y);
+  
+  pthread_mutex_lock(&common->raw_lock);
+  
+  raw->params.half_size = scale;
+  raw->params.cropbox[0] = 0;
+  raw->params.cropbox[1] = imax((y<<scale)-tb, 0);
+  raw->params.cropbox[2] = UINT_MAX;
+  raw->params.cropbox[3] = (rows<<scale)+2*tb;
+  offy = ((y<<scale) - raw->params.cropbox[1]) >> scale;
+  
+  libraw_dcraw_process(raw);
+  if (!raw->image) {
+    printf("LIBRAW: ERROR no image created! - wrong cropbox?\n");
+    libraw_free_image(raw);
+    pthread_mutex_unlock(&common->raw_lock);
+    return -1;
+  }
+  processed = libraw_dcraw_make_mem_image(raw, &errcode);
+  libraw_free_image(raw);
+  
+  pthread_mutex_unlock(&common->raw_lock);
+  
+  if (!processed)
+    return -1;
+  
+  w = imin(img->w, processed->width);
+  rows = imin(rows, processed->height - offy);
+  for(j=0;j<rows;j++)
+    memcpy(_img_row(img, y+j),
+           ((uint16_t*)processed->data) + (offy+j)*processed->width*3,
+           w*3*sizeof(uint16_t));
+  
+  libraw_dcraw_clear_mem(processed);
+  
+  return 0;
+}
+
+//sensor value at row,col of the visible area, black subtracted and white balanced,
+//borders are mirrored by two pixels which keeps the color of the cfa
+static float _bayer_get(_Common *common, int row, int col)
+{
+  libraw_rawdata_t *rd = &common->raw->rawdata;
+  unsigned *cblack = rd->color.cblack;
+  int c;
+  float v;
+  
+  while (row < 0) row += 2;
+  while (row >= common->h) row -= 2;
+  while (col < 0) col += 2;
+  while (col >= common->w) col -= 2;
+  
+  c = _fc(common->filters, row, col);
+  v = rd->raw_image[(row+rd->sizes.top_margin)*(rd->sizes.raw_pitch/2) + col+rd->sizes.left_margin];
+  v -= common->black[c];
+  if (cblack[4] && cblack[5])
+    v -= cblack[6 + (row % cblack[4])*cblack[5] + col % cblack[5]];
+  v *= common->mul[c];
+  
+  return v < 0 ? 0 : (v > 65535 ? 65535 : v);
+}
+
+static void _bayer_store(_Common *common, uint16_t *d, float *rgb)
+{
+  float v;
+  int c;
+  
+  for(c=0;c<3;c++) {
+    v = common->cam[c][0]*rgb[0] + common->cam[c][1]*rgb[1] + common->cam[c][2]*rgb[2];
+    d[c] = v < 0 ? 0 : (v > 65535 ? 65535 : v+0.5);
+  }
+}
+
+#define P(dy, dx) p[(dy)*stride+(dx)]
+
+/*
+ * demosaic one band of tile rows from the shared sensor data, the full
+ * scale with the gradient corrected linear interpolation of Malvar, He and
+ * Cutler, scale 1 from each 2x2 block like libraw half_size
+ */
+static int _band_demosaic(_Common *common, int scale, int band, _Img *img)
+{
+  int y = band*RAW_TILE_HEIGHT;
+  int rows = imin(RAW_TILE_HEIGHT, img->h - y);
+  int stride = img->w+4;
+  int i, j, k, h, n[3];
+  float *buf, *p, rgb[3], axis, diag;
+  
+  if (scale) {
+    for(j=0;j<rows;j++)
+      for(i=0;i<img->w;i++) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        n[0] = n[1] = n[2] = 0;
+        for(k=0;k<4;k++) {
+          h = _fc(common->filters, 2*(y+j)+(k>>1), 2*i+(k&1));
+          rgb[h] += _bayer_get(common, 2*(y+j)+(k>>1), 2*i+(k&1));
+          n[h]++;
+        }
+        for(k=0;k<3;k++)
+          rgb[k] /= n[k];
+        _bayer_store(common, _img_row(img, y+j) + i*3, rgb);
       }
-#else
-    data->raw = data->common->raw;
-#endif
+    return 0;
+  }
+  
+  buf = malloc(sizeof(float)*(rows+4)*stride);
+  if (!buf)
+    return -1;
+  for(j=-2;j<rows+2;j++)
+    for(i=-2;i<img->w+2;i++)
+      buf[(j+2)*stride+i+2] = _bayer_get(common, y+j, i);
+  
+  for(j=0;j<rows;j++)
+    for(i=0;i<img->w;i++) {
+      p = buf + (j+2)*stride+i+2;
+      k = _fc(common->filters, y+j, i);
+      axis = P(-2,0)+P(2,0)+P(0,-2)+P(0,2);
+      diag = P(-1,-1)+P(-1,1)+P(1,-1)+P(1,1);
+      if (k != 1) {
+        rgb[k] = P(0,0);
+        rgb[1] = (4*P(0,0) + 2*(P(-1,0)+P(1,0)+P(0,-1)+P(0,1)) - axis) / 8;
+        rgb[2-k] = (6*P(0,0) + 2*diag - 1.5*axis) / 8;
+      }
+      else {
+        //color of the horizontal neighbours
+        h = _fc(common->filters, y+j, i+1);
+        rgb[1] = P(0,0);
+        rgb[h] = (5*P(0,0) - diag - P(0,-2) - P(0,2) + 0.5*(P(-2,0)+P(2,0))
+                  + 4*(P(0,-1)+P(0,1))) / 8;
+        rgb[2-h] = (5*P(0,0) - diag - P(-2,0) - P(2,0) + 0.5*(P(0,-2)+P(0,2))
+                    + 4*(P(-1,0)+P(1,0))) / 8;
+      }
+      for(k=0;k<3;k++)
+        if (rgb[k] < 0)
+          rgb[k] = 0;
+      _bayer_store(common, _img_row(img, y+j) + i*3, rgb);
     }
-#ifdef RAW_THREADSAFE_BUT_LEAK
-    pthread_mutex_unlock(&data->common->lock);
-#endif
+  
+  free(buf);
+  
+  return 0;
+}
+
+#undef P
+
+//process one band of tile rows into the shared image
+static int _band_process(_Data *data, int scale, int band, _Img *img)
+{
+  if (_unpack(data->common))
+    return -1;
+  
+  if (data->common->bayer)
+    return _band_demosaic(data->common, scale, band, img);
+  
+  return _band_libraw(data->common, scale, band, img);
+}
+
+static _Img *_img_get(_Data *data, int scale, int y);
+static void _img_put(_Data *data, _Img *img, int x, int y);
+
+//box filter one band from the bands of the next finer scale
+static int _band_downscale(_Data *data, int scale, int band, _Img *img)
+{
+  _Img *src = &data->common->img[scale-1];
+  uint16_t *s0, *s1, *d;
+  int i, j, x, c, got;
+  int y = band*RAW_TILE_HEIGHT;
+  int rows = imin(RAW_TILE_HEIGHT, img->h - y);
+  int need = (2*rows + RAW_TILE_HEIGHT-1) / RAW_TILE_HEIGHT;
+  
+  for(got=0;got<need;got++)
+    if (!_img_get(data, scale-1, 2*y + got*RAW_TILE_HEIGHT))
+      break;
+  
+  if (got == need)
+    for(j=0;j<rows;j++) {
+      s0 = _img_row(src, 2*(y+j));
+      s1 = _img_row(src, 2*(y+j)+1);
+      d = _img_row(img, y+j);
+      for(x=0;x<img->w;x++,s0+=6,s1+=6,d+=3)
+        for(c=0;c<3;c++)
+          d[c] = (s0[c] + s0[3+c] + s1[c] + s1[3+c] + 2) >> 2;
+    }
+  
+  for(i=0;i<got;i++)
+    _img_put(data, src, -1, 2*y + i*RAW_TILE_HEIGHT);
+  
+  return got == need ? 0 : -1;
+}
+
+/*
+ * image at scale with the rows of the tile at y available,
+ * bands are processed in parallel by the threads which need them first
+ * the image is kept until _img_put() of its last tile, bands of the
+ * processed scales until their own tiles are copied out or the next scale
+ * was downscaled from them
+ */
+static _Img *_img_get(_Data *data, int scale, int y)
+{
+  _Common *common = data->common;
+  _Img *img = &common->img[scale];
+  int band, w, h, failed;
+  
+  pthread_mutex_lock(&common->lock);
+  
+  if (scale >= common->processed_scales) {
+    if (!img->data && _preview_decode(common, scale, img))
+      printf("loadraw: could not decode preview!\n");
+    if (img->data) {
+      img->readers++;
+      img->band_readers[y / RAW_TILE_HEIGHT]++;
+    }
+    pthread_mutex_unlock(&common->lock);
+    return img->data ? img : NULL;
   }
   
-  assert(out && ea_count(out) == 3);
-  data->raw->params.half_size = area->corner.scale;
+  if (!img->data) {
+    _img_size(common, scale, &w, &h);
+    _img_alloc(img, w, h, common->w >> scale, common->h >> scale);
+  }
+  
+  band = y / RAW_TILE_HEIGHT;
+  assert(band < img->band_count);
+  
+  while (img->bands[band] == BAND_BUSY)
+    pthread_cond_wait(&common->band_cond, &common->lock);
+  
+  if (img->bands[band] == BAND_TODO) {
+    img->bands[band] = BAND_BUSY;
+    _band_alloc(img, band);
+    pthread_mutex_unlock(&common->lock);
+    
+    if (!scale || (scale == 1 && common->filters))
+      failed = _band_process(data, scale, band, img);
+    else
+      failed = _band_downscale(data, scale, band, img);
+    
+    pthread_mutex_lock(&common->lock);
+    img->bands[band] = failed ? BAND_FAILED : BAND_DONE;
+    pthread_cond_broadcast(&common->band_cond);
+  }
+  
+  failed = img->bands[band] == BAND_FAILED;
+  if (!failed) {
+    img->readers++;
+    img->band_readers[band]++;
+  }
+  
+  pthread_mutex_unlock(&common->lock);
+  
+  if (failed)
+    return NULL;
+  
+  return img;
+}
+
+//the tile at x,y was copied out (x < 0: the band at y was downscaled from),
+//frees the image after its last tile
+static void _img_put(_Data *data, _Img *img, int x, int y)
+{
+  _Common *common = data->common;
+  int band = y / RAW_TILE_HEIGHT;
+  int tile = band*img->tiles_x + x / RAW_TILE_WIDTH;
+  
+  pthread_mutex_lock(&common->lock);
+  
+  img->readers--;
+  img->band_readers[band]--;
+  if (x >= 0 && x / RAW_TILE_WIDTH < img->tiles_x && tile < img->tiles_x*img->band_count
+      && tile >= 0 && !img->copied[tile] && img->tiles_left) {
+    img->copied[tile] = 1;
+    img->tiles_left--;
+    img->band_tiles[band]--;
+  }
+  
+  //tiles are cached from now on, a later request processes again
+  if (!img->tiles_left && !img->readers)
+    _img_free(img);
+  //each band is downscaled from once, so only the band in use stays in memory
+  else if (img - common->img < common->processed_scales && img->bands[band] == BAND_DONE
+           && !img->band_readers[band] && (x < 0 || !img->band_tiles[band])) {
+    _band_free(img, band);
+    img->bands[band] = BAND_TODO;
+  }
   
-  if (!area->corner.scale)
-    tb = RAW_TILING_BORDER;
-  else
-    tb = 0;
+  pthread_mutex_unlock(&common->lock);
+}
 
-  data->raw->params.cropbox[0] = imax((area->corner.x<<area->corner.scale)-tb, 0);
-  data->raw->params.cropbox[1] = imax((area->corner.y<<area->corner.scale)-tb, 0);
-  data->raw->params.cropbox[2] = (area->width<<area->corner.scale)+2*tb;
-  data->raw->params.cropbox[3] = (area->height<<area->corner.scale)+2*tb;
+static void _worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+{
+  int j;
+  int w, h;
+  _Data *data = ea_data(f->data, thread_id);
+  Tiledata *out_td;
+  _Img *img;
   
-  offx = (area->corner.x<<area->corner.scale) - data->raw->params.cropbox[0];
-  offy = (area->corner.y<<area->corner.scale) - data->raw->params.cropbox[1];
+  assert(out && ea_count(out) == 3);
+  assert(area->corner.scale < RAW_SCALES_MAX);
   
-#ifdef RAW_THREADSAFE_BUT_LEAK
   hack_tiledata_fixsize_mt(6, ea_data(out, 0));
-#else
-  hack_tiledata_fixsize(6, ea_data(out, 0));
-#endif
   out_td = (Tiledata*)ea_data(out, 0);
   
-  libraw_dcraw_process(data->raw);
-  if (!data->raw->image) {
-    printf("LIBRAW: ERROR no image created! - wrong cropbox?\n");
-    libraw_free_image(data->raw);
+  img = _img_get(data, area->corner.scale, area->corner.y);
+  if (!img)
     return;
-  }
-  img = libraw_dcraw_make_mem_image(data->raw, &errcode);
   
-  w = imin(area->width, data->raw->sizes.width-offx);
-  h = imin(area->height, data->raw->sizes.height-offy);
+  w = imin(area->width, img->w-area->corner.x);
+  h = imin(area->height, img->h-area->corner.y);
   
   for(j=0;j<h;j++)
-    for(i=0;i<w;i++) {
-      uint16_t *ptr = tileptr16_3(out_td, out_td->area.corner.x+i, out_td->area.corner.y+j);
-      for(ch=0;ch<3;ch++)
-        ptr[ch] = ((uint16_t*)img->data)[((j+offy)*img->width+i+offx)*3+ch];
-    }
+    memcpy(tileptr16_3(out_td, area->corner.x, area->corner.y+j),
+           _img_row(img, area->corner.y+j) + area->corner.x*3,
+           w*3*sizeof(uint16_t));
   
-  libraw_dcraw_clear_mem(img);
-  libraw_free_image(data->raw);
+  _img_put(data, img, area->corner.x, area->corner.y);
 }
 
 static int _input_fixed(Filter *f)
 {
-  int i;
-  int rot;
+  int i, first;
   _Data *data = ea_data(f->data, 0);
   
   if (!data->common->raw)
     data->common->raw = libraw_init(0);
   
-  data->common->raw->params.use_camera_matrix = 0;
-  data->common->raw->params.use_camera_wb = 1;
-  data->common->raw->params.user_flip = 0;
-  data->common->raw->params.use_rawspeed = 1;
+  _params_set(data->common->raw);
   
   //data->common->raw->params.camera_profile = "/usr/share/rawtherapee/dcpprofiles/Olympus E-M5.dcp";
   
   if (data->common->opened) {
     libraw_recycle(data->common->raw);
     libraw_recycle_datastream(data->common->raw);
+    data->common->opened = 0;
     //libraw_close(data->common->raw);
   }
   
-  if (libraw_open_file(data->common->raw, data->input->data)) {
+  if (_map(data->common, data->input->data)
+      || libraw_open_buffer(data->common->raw, data->common->map, data->common->map_size)) {
     libraw_close(data->common->raw);
     data->common->raw = NULL;
     return -1;
   }
   
   data->common->opened = 1;
+  data->common->unpacked = 0;
+  data->common->bayer = 0;
   
   //printf("raw profile: %s\n", data->common->raw->params.camera_profile);
   
@@ -242,37 +897,42 @@ static int _input_fixed(Filter *f)
   
   data->w = data->common->raw->sizes.width;
   data->h = data->common->raw->sizes.height;
+  data->common->w = data->w;
+  data->common->h = data->h;
+  data->common->filters = data->common->raw->idata.filters;
+  data->common->rot = data->rot;
+  
+  _img_clear(data->common);
+  _preview_load(data->common);
+  
+  //scales finer than the preview are processed from the raw data
+  for(first=1;first<RAW_SCALES_MAX;first++)
+    if (_preview_covers(data->common, first))
+      break;
+  data->common->processed_scales = first;
   
   ((Dim*)data->dim)->scaledown_max = 1;
+  while (((Dim*)data->dim)->scaledown_max+1 < RAW_SCALES_MAX
+      && data->w >> (((Dim*)data->dim)->scaledown_max+1) >= RAW_PREVIEW_MIN_SIZE)
+    ((Dim*)data->dim)->scaledown_max++;
+  
   ((Dim*)data->dim)->width = data->w;
   ((Dim*)data->dim)->height = data->h;
   
   f->tw_s = realloc(f->tw_s, sizeof(int)*(((Dim*)data->dim)->scaledown_max+1));
   f->th_s = realloc(f->th_s, sizeof(int)*(((Dim*)data->dim)->scaledown_max+1));
   
-  f->tw_s[0] = RAW_TILE_WIDTH;
-  f->th_s[0] = RAW_TILE_HEIGHT;
-  f->tw_s[1] = RAW_TILE_WIDTH;
-  f->th_s[1] = RAW_TILE_HEIGHT;
-  
-  data->common->unpacked = 0;
+  for(i=0;i<=((Dim*)data->dim)->scaledown_max;i++) {
+    f->tw_s[i] = RAW_TILE_WIDTH;
+    f->th_s[i] = RAW_TILE_HEIGHT;
+  }
   
   data->common->exif->data = lime_exif_handle_new_from_file(data->input->data);
   assert(data->common->exif->data);
-  
-#ifdef RAW_THREADSAFE_BUT_LEAK
-  for(i=0;i<ea_count(f->data);i++) {
-    data = ea_data(f->data, i);
-    if (data->raw)
-      libraw_copy_del(data->raw);
-    data->raw = NULL;
-  }
-#endif
 
   return 0;
 }
 
-//FIXME uhh ohh free thread stuff (c++ class instance!)
 static int _del(Filter *f)
 {
   _Data *data = ea_data(f->data, 0);
@@ -283,19 +943,24 @@ static int _del(Filter *f)
     libraw_recycle_datastream(data->common->raw);
   }
   
+  _img_clear(data->common);
+  _preview_clear(data->common);
+  
   if (data->common->raw)
     libraw_close(data->common->raw);
+  _unmap(data->common);
   
   if (data->common->exif->data)
     lime_exif_handle_destroy(data->common->exif->data);
   
+  pthread_mutex_destroy(&data->common->lock);
+  pthread_mutex_destroy(&data->common->raw_lock);
+  pthread_cond_destroy(&data->common->band_cond);
   free(data->common);
   free(data->dim);
   
   for(i=0;i<ea_count(f->data);i++) {
     data = ea_data(f->data, i);
-    if (data->raw)
-      libraw_copy_del(data->raw);
     free(data);
   }
   
@@ -303,36 +968,39 @@ static int _del(Filter *f)
   return 0;
 }
 
-#ifdef RAW_THREADSAFE_BUT_LEAK
 static void *_data_new(Filter *f, void *data)
 {
   _Data *newdata = calloc(sizeof(_Data), 1);
   
   *newdata = *(_Data*)data;
-  newdata->raw = libraw_data_copy(newdata->common->raw);
   
   return newdata;
 }
-#endif
 
 static Filter *_new(void)
 {
   Filter *filter = filter_new(&filter_core_loadraw);
   Meta *in, *out, *channel, *bitdepth, *color, *dim, *fliprot, *exif;
   _Data *data = calloc(sizeof(_Data), 1);
+  double v;
+  int i;
   data->common = calloc(sizeof(_Common), 1);
   data->dim = calloc(sizeof(Dim), 1);
-#ifdef RAW_THREADSAFE_BUT_LEAK
   pthread_mutex_init(&data->common->lock, NULL);
-#endif
+  pthread_mutex_init(&data->common->raw_lock, NULL);
+  pthread_cond_init(&data->common->band_cond, NULL);
+  
+  for(i=0;i<256;i++) {
+    v = i/255.0;
+    v = v <= 0.04045 ? v/12.92 : pow((v+0.055)/1.055, 2.4);
+    data->common->lin[i] = v*65535.0+0.5;
+  }
   
   filter->del = &_del;
   filter->mode_buffer = filter_mode_buffer_new();
   filter->mode_buffer->worker = &_worker;
-#ifdef RAW_THREADSAFE_BUT_LEAK
   filter->mode_buffer->threadsafe = 1;
   filter->mode_buffer->data_new = &_data_new;
-#endif
   filter->input_fixed = &_input_fixed;
   filter->fixme_outcount = 3;
   ea_push(filter->data, data);
@@ -20,163 +20,440 @@
 #include "filter_loadtiff.h"
 #include "tiffio.h"
 
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//compiled for ssse3 independent of the build flags, used if the cpu has it
+#if defined(__x86_64__) || defined(__i386__)
+#define TIFF_SPLIT_SSSE3
+#include <tmmintrin.h>
+#endif
+
+//one directory per scale, further directories (thumbnails, masks) are ignored
+#define TIFF_SCALES_MAX 16
+
+typedef struct {
+  toff_t offset;
+  uint32_t w, h;
+  uint32_t tw, th; //native tile size, strips are tw = w, th = rows per strip
+  int tiled;
+} _Dir;
+
+typedef struct {
+  int fd;
+  uint64_t size;
+  uint16_t bps, spp, planar;
+  int dir_count;
+  _Dir dirs[TIFF_SCALES_MAX];
+} _Common;
+
+//client state of one TIFF handle, all handles pread from the shared fd
+typedef struct {
+  int fd;
+  uint64_t pos;
+  uint64_t size;
+} _Io;
+
+typedef struct {
+  TIFF *tif;
+  _Io io;
+  int64_t chunk; //decoded tile/strip in buf, -1 if none
+  uint8_t *buf;
+  tmsize_t buf_size;
+} _Handle;
+
 typedef struct {
   Meta *input;
   Meta *dim;
-  TIFF* file;
-  int directory;
+  Meta *bitdepth;
   Meta *color[3];
+  _Common *common;
+  _Handle handles[TIFF_SCALES_MAX]; //per thread, opened on first use of a scale
 } _Data;
 
-static void *_loadtiff_data_new(Filter *f, void *data)
+static int imin(int a, int b)
 {
-  _Data *newdata = calloc(sizeof(_Data), 1);
-  
-  newdata->input = ((_Data*)data)->input;
-  newdata->directory = 0;
-  newdata->dim = ((_Data*)data)->dim;
-  
-  newdata->file = TIFFOpen((char*)newdata->input->data, "r");
-  assert(newdata->file);
-  
-  return newdata;
+  if (a < b) return a;
+  return b;
+}
+
+static int imax(int a, int b)
+{
+  if (a > b) return a;
+  return b;
+}
+
+//filters may be created from concurrent configurations
+static pthread_once_t _split_once = PTHREAD_ONCE_INIT;
+
+#ifdef TIFF_SPLIT_SSSE3
+//[16 bit][spp 3/4][channel][input vector][output byte]
+static uint8_t _shuf[2][2][3][4][16];
+static int _ssse3;
+#endif
+
+static void _split_init(void)
+{
+#ifdef TIFF_SPLIT_SSSE3
+  int ss, spp, ch, k, o, src;
+
+  for(ss=1;ss<=2;ss++)
+    for(spp=3;spp<=4;spp++)
+      for(ch=0;ch<3;ch++)
+        for(k=0;k<4;k++)
+          for(o=0;o<16;o++) {
+            src = ((o/ss)*spp+ch)*ss + o%ss;
+            _shuf[ss-1][spp-3][ch][k][o] = src/16 == k ? src%16 : 0x80;
+          }
+
+  _ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#ifdef TIFF_SPLIT_SSSE3
+//whole vectors of _split() for spp 3/4, returns the number of samples done
+__attribute__((target("ssse3")))
+static int _split_ssse3(uint8_t *src, int spp, int ss, uint8_t **dst, int n)
+{
+  __m128i in[4], acc, m;
+  int i, j, ch, step = 16/ss;
+
+  for(i=0;i+step<=n;i+=step) {
+    for(j=0;j<spp;j++)
+      in[j] = _mm_loadu_si128((__m128i*)(src+i*spp*ss+j*16));
+    for(ch=0;ch<3;ch++) {
+      acc = _mm_setzero_si128();
+      for(j=0;j<spp;j++) {
+        m = _mm_loadu_si128((__m128i*)_shuf[ss-1][spp-3][ch][j]);
+        acc = _mm_or_si128(acc, _mm_shuffle_epi8(in[j], m));
+      }
+      _mm_storeu_si128((__m128i*)(dst[ch]+i*ss), acc);
+    }
+  }
+
+  return i;
+}
+#endif
+
+//contiguous samples (ss bytes each) to three planes, extra samples are dropped
+static void _split(uint8_t *src, int spp, int ss, uint8_t *r, uint8_t *g, uint8_t *b, int n)
+{
+  int i = 0, ch;
+  uint8_t *dst[3] = {r, g, b};
+
+#ifdef TIFF_SPLIT_SSSE3
+  if (_ssse3 && (spp == 3 || spp == 4))
+    i = _split_ssse3(src, spp, ss, dst, n);
+#endif
+
+  if (ss == 1)
+    for(;i<n;i++) {
+      r[i] = src[i*spp+0];
+      g[i] = src[i*spp+1];
+      b[i] = src[i*spp+2];
+    }
+  else
+    for(;i<n;i++)
+      for(ch=0;ch<3;ch++)
+        ((uint16_t*)dst[ch])[i] = ((uint16_t*)src)[i*spp+ch];
+}
+
+static tmsize_t _io_read(thandle_t handle, void *buf, tmsize_t size)
+{
+  _Io *io = handle;
+  ssize_t len;
+  tmsize_t done = 0;
+
+  while (done < size) {
+    len = pread(io->fd, (uint8_t*)buf+done, size-done, io->pos);
+    if (len <= 0)
+      break;
+    done += len;
+    io->pos += len;
+  }
+
+  return done;
+}
+
+static tmsize_t _io_write(thandle_t handle, void *buf, tmsize_t size)
+{
+  return -1;
+}
+
+static toff_t _io_seek(thandle_t handle, toff_t off, int whence)
+{
+  _Io *io = handle;
+
+  switch (whence) {
+    case SEEK_SET :
+      io->pos = off;
+      break;
+    case SEEK_CUR :
+      io->pos += off;
+      break;
+    case SEEK_END :
+      io->pos = io->size + off;
+      break;
+  }
+
+  return io->pos;
+}
+
+//the fd belongs to common
+static int _io_close(thandle_t handle)
+{
+  return 0;
+}
+
+static toff_t _io_size(thandle_t handle)
+{
+  return ((_Io*)handle)->size;
+}
+
+static int _io_map(thandle_t handle, void **base, toff_t *size)
+{
+  return 0;
+}
+
+static void _io_unmap(thandle_t handle, void *base, toff_t size)
+{
+}
+
+static TIFF *_open(_Data *data, _Io *io)
+{
+  io->fd = data->common->fd;
+  io->size = data->common->size;
+  io->pos = 0;
+
+  return TIFFClientOpen((char*)data->input->data, "r", (thandle_t)io,
+                        &_io_read, &_io_write, &_io_seek, &_io_close,
+                        &_io_size, &_io_map, &_io_unmap);
+}
+
+static void _handles_close(_Data *data)
+{
+  int i;
+
+  for(i=0;i<TIFF_SCALES_MAX;i++) {
+    if (data->handles[i].tif)
+      TIFFClose(data->handles[i].tif);
+    if (data->handles[i].buf)
+      _TIFFfree(data->handles[i].buf);
+  }
+  memset(data->handles, 0, sizeof(data->handles));
+}
+
+static void _thread_handles_close(Filter *f)
+{
+  int i;
+
+  for(i=0;i<ea_count(f->data);i++)
+    _handles_close(ea_data(f->data, i));
+}
+
+//jump directly to the cached directory offset, never walk the directory chain
+static _Handle *_handle_get(_Data *data, int scale)
+{
+  _Handle *h = &data->handles[scale];
+  _Dir *dir = &data->common->dirs[scale];
+
+  if (h->tif)
+    return h;
+
+  h->tif = _open(data, &h->io);
+  if (!h->tif)
+    return NULL;
+
+  if (!TIFFSetSubDirectory(h->tif, dir->offset)) {
+    TIFFClose(h->tif);
+    h->tif = NULL;
+    return NULL;
+  }
+
+  h->buf_size = dir->tiled ? TIFFTileSize(h->tif) : TIFFStripSize(h->tif);
+  h->buf = _TIFFmalloc(h->buf_size);
+  h->chunk = -1;
+
+  return h;
+}
+
+static int _chunk_read(_Handle *h, _Dir *dir, uint32_t chunk)
+{
+  tmsize_t len;
+
+  if (h->chunk == chunk)
+    return 0;
+
+  if (dir->tiled)
+    len = TIFFReadEncodedTile(h->tif, chunk, h->buf, h->buf_size);
+  else
+    len = TIFFReadEncodedStrip(h->tif, chunk, h->buf, h->buf_size);
+
+  if (len < 0) {
+    h->chunk = -1;
+    return -1;
+  }
+
+  h->chunk = chunk;
+
+  return 0;
 }
 
 void _loadtiff_worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
 {
   _Data *data = ea_data(f->data, thread_id);
+  _Common *common = data->common;
+  _Dir *dir;
+  _Handle *h;
+  uint8_t *planes[3], *src;
+  uint32_t chunk;
+  int i, p, y, cx, cy, x0, x1, y0, y1, ix0, ix1, iy0, iy1;
+  int ss = common->bps/8;
+  int separate = common->planar == PLANARCONFIG_SEPARATE;
+  int pixel = separate ? ss : ss*common->spp;
+  int ax = area->corner.x, ay = area->corner.y;
 
-  uint8_t *r, *g, *b;
-  uint32 width, height;
-  uint32 twidth, tlenght;
-  uint32 x, y;
-  uint8_t *buf;
-  int i, j;
-  int16_t bitspersample, samplesperpixel, planarconfig;
   assert(out && ea_count(out) == 3);
-  
-  r = ((Tiledata*)ea_data(out, 0))->data;
-  g = ((Tiledata*)ea_data(out, 1))->data;
-  b = ((Tiledata*)ea_data(out, 2))->data;
-  
-  if (area->corner.scale != data->directory) {
-    if (!TIFFSetDirectory(data->file, area->corner.scale))
-      abort();
-    else
-      data->directory = area->corner.scale;
+
+  for(i=0;i<3;i++) {
+    if (ss == 2)
+      hack_tiledata_fixsize_mt(2, ea_data(out, i));
+    planes[i] = ((Tiledata*)ea_data(out, i))->data;
   }
 
-  TIFFGetField(data->file, TIFFTAG_IMAGEWIDTH, &width);
-  TIFFGetField(data->file, TIFFTAG_IMAGELENGTH, &height);
-  TIFFGetField(data->file, TIFFTAG_TILEWIDTH, &twidth);
-  TIFFGetField(data->file, TIFFTAG_TILELENGTH, &tlenght);
-  TIFFGetField(data->file, TIFFTAG_BITSPERSAMPLE, &bitspersample);
-  TIFFGetField(data->file, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel);
-  TIFFGetField(data->file, TIFFTAG_PLANARCONFIG, &planarconfig);
-
-  assert(bitspersample == 8);
-  assert(samplesperpixel == 3 || samplesperpixel == 4);
-  //if (samplesperpixel == 4)
-  //  printf("FIXME: discarding alpha?!\n");
-  assert(twidth == area->width);
-  assert(tlenght == area->height);
-  
-  if (area->corner.x < 0 || area->corner.y < 0 || area->corner.x >= width || area->corner.y >= height) {
-    memset(r, 0, twidth*tlenght);
-    memset(g, 0, twidth*tlenght);
-    memset(b, 0, twidth*tlenght);
-    
-    printf("FIXME: invalid tilerequest");
-    
+  dir = &common->dirs[area->corner.scale];
+
+  x0 = imax(ax, 0);
+  y0 = imax(ay, 0);
+  x1 = imin(ax+area->width, dir->w);
+  y1 = imin(ay+area->height, dir->h);
+
+  if (x0 != ax || y0 != ay || x1 != ax+area->width || y1 != ay+area->height)
+    for(i=0;i<3;i++)
+      memset(planes[i], 0, area->width*area->height*ss);
+
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  h = _handle_get(data, area->corner.scale);
+  if (!h) {
+    printf("TIFF could not open scale %d of %s\n", area->corner.scale, (char*)data->input->data);
     return;
   }
-  
-  if (planarconfig == PLANARCONFIG_CONTIG) {
-     buf = _TIFFmalloc(TIFFTileSize(data->file));
-     for (y = area->corner.y/tlenght*tlenght; y < area->corner.y+area->height; y += tlenght)
-	for (x = area->corner.x/twidth*twidth; x < area->corner.x+area->width; x += twidth) {
-	   TIFFReadTile(data->file, buf, x, y, 0, 0);
-	   
-	    //FIXME right and bottom border trash!
-	   
-	   for(j=0;j<area->height;j++)
-	      for(i=0;i<area->width;i++) {
-		 r[j*area->width+i] = buf[(j*area->width+i)*samplesperpixel+0];
-		 g[j*area->width+i] = buf[(j*area->width+i)*samplesperpixel+1];
-		 b[j*area->width+i] = buf[(j*area->width+i)*samplesperpixel+2];
-	      }
-	}
-	
-	_TIFFfree(buf);
-  }
-  else if (planarconfig == PLANARCONFIG_SEPARATE) {
-    TIFFReadTile(data->file, r, area->corner.x, area->corner.y, 0, 0);
-    TIFFReadTile(data->file, g, area->corner.x, area->corner.y, 0, 1);
-    TIFFReadTile(data->file, b, area->corner.x, area->corner.y, 0, 2);
-    
-    if (area->corner.x+area->width > width)
-      for(y=0;y<area->height;y++) {
-	memset(r+twidth*y + width  - area->corner.x, 0, area->corner.x+area->width - width);
-	memset(g+twidth*y + width  - area->corner.x, 0, area->corner.x+area->width - width);
-	memset(b+twidth*y + width  - area->corner.x, 0, area->corner.x+area->width - width);
-      }
-      
-      if (area->corner.y+area->height > height) {
-	memset(r+twidth*(height - area->corner.y), 0, (area->height + area->corner.y - height)*256);
-	memset(g+twidth*(height - area->corner.y), 0, (area->height + area->corner.y - height)*256);
-	memset(b+twidth*(height - area->corner.y), 0, (area->height + area->corner.y - height)*256);
+
+  //every native tile/strip intersecting the area is decoded once and split into its part
+  for(cy=y0/dir->th*dir->th;cy<y1;cy+=dir->th)
+    for(cx=x0/dir->tw*dir->tw;cx<x1;cx+=dir->tw) {
+      ix0 = imax(cx, x0);
+      ix1 = imin(cx+dir->tw, x1);
+      iy0 = imax(cy, y0);
+      iy1 = imin(cy+dir->th, y1);
+
+      for(p=0;p<(separate ? 3 : 1);p++) {
+        if (dir->tiled)
+          chunk = TIFFComputeTile(h->tif, cx, cy, 0, p);
+        else
+          chunk = TIFFComputeStrip(h->tif, cy, p);
+
+        if (_chunk_read(h, dir, chunk)) {
+          printf("TIFF read error in %s\n", (char*)data->input->data);
+          continue;
+        }
+
+        for(y=iy0;y<iy1;y++) {
+          src = h->buf + ((y-cy)*dir->tw + ix0-cx)*pixel;
+          i = ((y-ay)*area->width + ix0-ax)*ss;
+          if (separate)
+            memcpy(planes[p]+i, src, (ix1-ix0)*ss);
+          else
+            _split(src, common->spp, ss, planes[0]+i, planes[1]+i, planes[2]+i, ix1-ix0);
+        }
       }
-      
+    }
+}
+
+static void _dir_read(TIFF *tif, _Dir *dir)
+{
+  uint32_t rows;
+
+  dir->offset = TIFFCurrentDirOffset(tif);
+  dir->w = 0;
+  dir->h = 0;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &dir->w);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &dir->h);
+
+  dir->tiled = TIFFIsTiled(tif);
+  if (dir->tiled) {
+    dir->tw = 0;
+    dir->th = 0;
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &dir->tw);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &dir->th);
+  }
+  else {
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rows);
+    dir->tw = dir->w;
+    dir->th = rows && rows < dir->h ? rows : dir->h;
   }
-  
 }
 
-//TODO open file, get image dimensions etc
+//a directory is the next scale if it has the same layout at half the size
+static int _dir_is_scale(_Common *common, TIFF *tif, _Dir *dir, int scale)
+{
+  uint16_t bps, spp, planar;
+
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+
+  if (bps != common->bps || spp != common->spp || planar != common->planar)
+    return 0;
+
+  if (!dir->w || !dir->h || !dir->tw || !dir->th)
+    return 0;
+
+  return abs((int)dir->w - (int)(common->dirs[0].w >> scale)) <= 1
+      && abs((int)dir->h - (int)(common->dirs[0].h >> scale)) <= 1;
+}
+
 int _loadtiff_input_fixed(Filter *f)
 {
-  uint32_t width, height;
-  uint32_t twidth, theight;
-  uint32_t twidth_d, theight_d;
-  short color;
-  int succ = 0;
   _Data *data = ea_data(f->data, 0);
-  
-  data->file = TIFFOpen(data->input->data, "r");
+  _Common *common = data->common;
+  _Dir *dir;
+  _Io io;
+  TIFF *tif;
+  struct stat st;
+  uint16_t color;
+  int i;
 
-  if (!data->file)
-    return -1;
-  
-  succ += TIFFGetField(data->file, TIFFTAG_IMAGEWIDTH, &width);
-  succ += TIFFGetField(data->file, TIFFTAG_IMAGELENGTH, &height);
-  succ += TIFFGetField(data->file, TIFFTAG_TILEWIDTH, &twidth);
-  succ += TIFFGetField(data->file, TIFFTAG_TILELENGTH, &theight);
-  succ += TIFFGetField(data->file, TIFFTAG_PHOTOMETRIC, &color);
-  
-  if (succ != 5) {
-    printf("TIFF unsupported configuration %s\n", data->input->data);
-    TIFFClose(data->file);
-    data->file = NULL;
+  _thread_handles_close(f);
+  if (common->fd != -1)
+    close(common->fd);
+
+  common->fd = open((char*)data->input->data, O_RDONLY);
+  if (common->fd == -1 || fstat(common->fd, &st)) {
+    printf("TIFF could not open %s\n", (char*)data->input->data);
     return -1;
   }
-  
-  if (!width || !height || !twidth || !theight) {
-    printf("TIFF unsupported configuration %s\n", data->input->data);
-    TIFFClose(data->file);
-    data->file = NULL;
+  common->size = st.st_size;
+
+  tif = _open(data, &io);
+  if (!tif)
     return -1;
-  }
-  
-  if (!twidth || !theight) {
-    printf("FIXME: TIFF unsupported tile configuration %dx%d\n", twidth, theight);
-    TIFFClose(data->file);
-    data->file = NULL;
+
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &common->bps);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &common->spp);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &common->planar);
+
+  if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &color)
+      || (common->bps != 8 && common->bps != 16) || common->spp < 3) {
+    printf("TIFF unsupported configuration %s\n", (char*)data->input->data);
+    TIFFClose(tif);
     return -1;
   }
-  
-  ((Dim*)data->dim)->width = width;
-  ((Dim*)data->dim)->height = height;
-  ((Dim*)data->dim)->scaledown_max = 0;
-  
+
   switch (color) {
     case PHOTOMETRIC_RGB :
        *(int*)(data->color[0]->data) = CS_RGB_R;
@@ -189,49 +466,75 @@ int _loadtiff_input_fixed(Filter *f)
        *(int*)(data->color[2]->data) = CS_LAB_B;
       break;
     default:
-    printf("TIFF unsupported colorspace %s\n", data->input->data);
-    TIFFClose(data->file);
-    data->file = NULL;
+    printf("TIFF unsupported colorspace %s\n", (char*)data->input->data);
+    TIFFClose(tif);
+    return -1;
+  }
+
+  common->dir_count = 0;
+  do {
+    dir = &common->dirs[common->dir_count];
+    _dir_read(tif, dir);
+    if (!_dir_is_scale(common, tif, dir, common->dir_count))
+      break;
+    common->dir_count++;
+  } while (common->dir_count < TIFF_SCALES_MAX && TIFFReadDirectory(tif));
+
+  TIFFClose(tif);
+
+  if (!common->dir_count) {
+    printf("TIFF unsupported configuration %s\n", (char*)data->input->data);
     return -1;
   }
-    
-  data->directory = 0;
-  
-  while (TIFFReadDirectory(data->file)) {
-    succ = 0;
-    succ += TIFFGetField(data->file, TIFFTAG_TILEWIDTH, &twidth_d);
-    succ += TIFFGetField(data->file, TIFFTAG_TILELENGTH, &theight_d);
-    if (succ != 2 || twidth != twidth_d || theight != theight_d) {
-      printf("TIFF unsupported configuration %s\n", data->input->data);
-      TIFFClose(data->file);
-      data->file = NULL;
-      return -1;
+
+  ((Dim*)data->dim)->width = common->dirs[0].w;
+  ((Dim*)data->dim)->height = common->dirs[0].h;
+  ((Dim*)data->dim)->scaledown_max = common->dir_count-1;
+
+  *(int*)(data->bitdepth->data) = common->bps == 16 ? BD_U16 : BD_U8;
+
+  //native tiles map 1:1 to lime tiles if all scales share a sane tile size
+  f->tile_width = DEFAULT_TILE_SIZE;
+  f->tile_height = DEFAULT_TILE_SIZE;
+  dir = &common->dirs[0];
+  if (dir->tiled && dir->tw >= 64 && dir->tw <= 1024 && dir->th >= 64 && dir->th <= 1024) {
+    for(i=1;i<common->dir_count;i++)
+      if (!common->dirs[i].tiled || common->dirs[i].tw != dir->tw || common->dirs[i].th != dir->th)
+        break;
+    if (i == common->dir_count) {
+      f->tile_width = dir->tw;
+      f->tile_height = dir->th;
     }
-    ((Dim*)data->dim)->scaledown_max++;
-    data->directory++;
   }
-    
-  f->tile_width = twidth;
-  f->tile_height = theight;
 
-  
   return 0;
 }
 
+static void *_loadtiff_data_new(Filter *f, void *data)
+{
+  _Data *newdata = calloc(sizeof(_Data), 1);
+
+  *newdata = *(_Data*)data;
+  memset(newdata->handles, 0, sizeof(newdata->handles));
+
+  return newdata;
+}
+
 static int _del(Filter *f)
 {
   int i;
   _Data *data = ea_data(f->data, 0);
-  
+
+  _thread_handles_close(f);
+
+  if (data->common->fd != -1)
+    close(data->common->fd);
+  free(data->common);
   free(data->dim);
-  
-  for(i=0;i<ea_count(f->data);i++) {
-    data = ea_data(f->data, i);
-    if (data->file)
-      TIFFClose(data->file);
-    free(data);
-  }
-  
+
+  for(i=0;i<ea_count(f->data);i++)
+    free(ea_data(f->data, i));
+
   return 0;
 }
 
@@ -241,10 +544,14 @@ Filter *filter_loadtiff_new(void)
   Meta *in, *out, *channel, *bitdepth, *dim, *fliprot;
   _Data *data = calloc(sizeof(_Data), 1);
   data->dim = calloc(sizeof(Dim), 1);
-  
+  data->common = calloc(sizeof(_Common), 1);
+  data->common->fd = -1;
+
   TIFFSetErrorHandler(NULL);
   TIFFSetWarningHandler(NULL);
-  
+
+  pthread_once(&_split_once, &_split_init);
+
   filter->del = &_del;
   filter->mode_buffer = filter_mode_buffer_new();
   filter->mode_buffer->worker = &_loadtiff_worker;
@@ -253,25 +560,26 @@ Filter *filter_loadtiff_new(void)
   filter->input_fixed = &_loadtiff_input_fixed;
   filter->fixme_outcount = 3;
   ea_push(filter->data, data);
-  
+
   bitdepth = meta_new_data(MT_BITDEPTH, filter, malloc(sizeof(int)));
   *(int*)(bitdepth->data) = BD_U8;
-  
+  data->bitdepth = bitdepth;
+
   dim = meta_new_data(MT_IMGSIZE, filter, data->dim);
   eina_array_push(filter->core, dim);
-  
+
   out = meta_new(MT_BUNDLE, filter);
   eina_array_push(filter->out, out);
-  
+
   in = meta_new(MT_LOADIMG, filter);
   in->replace = out;
   eina_array_push(filter->in, in);
   data->input = in;
-  
+
   fliprot = meta_new_data(MT_FLIPROT, filter, malloc(sizeof(int)));
   *(int*)fliprot->data = 1;
   meta_attach(out, fliprot);
-  
+
   channel = meta_new_channel(filter, 1);
   data->color[0] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
   *(int*)(data->color[0]->data) = CS_RGB_R;
@@ -279,7 +587,7 @@ Filter *filter_loadtiff_new(void)
   meta_attach(channel, bitdepth);
   meta_attach(channel, dim);
   meta_attach(out, channel);
-  
+
   channel = meta_new_channel(filter, 2);
   data->color[1] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
   *(int*)(data->color[1]->data) = CS_RGB_G;
@@ -287,7 +595,7 @@ Filter *filter_loadtiff_new(void)
   meta_attach(channel, bitdepth);
   meta_attach(channel, dim);
   meta_attach(out, channel);
-  
+
   channel = meta_new_channel(filter, 3);
   data->color[2] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
   *(int*)(data->color[2]->data) = CS_RGB_B;
@@ -295,7 +603,7 @@ Filter *filter_loadtiff_new(void)
   meta_attach(channel, bitdepth);
   meta_attach(channel, dim);
   meta_attach(out, channel);
-  
+
   return filter;
 }
 
@@ -305,4 +613,3 @@ Filter_Core filter_core_loadtiff = {
   "Loads TIFF images from a file",
   &filter_loadtiff_new
 };
-
@@ -491,6 +491,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->common->radius);
   meta_name_set(setting, "radius");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -506,6 +507,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->common->damp);
   meta_name_set(setting, "damping");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -526,6 +528,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_INT, f, &data->common->iterations);
   meta_name_set(setting, "iterations");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_INT, f, malloc(sizeof(int)));
@@ -541,6 +544,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->common->sharpen);
   meta_name_set(setting, "sharpen");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -556,6 +560,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->common->gamma1);
   meta_name_set(setting, "gamma1");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -571,6 +576,7 @@ static Filter *_new(void)
   //setting
   setting = meta_new_data(MT_FLOAT, f, &data->common->gamma2);
   meta_name_set(setting, "gamma2");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(f->settings, setting);
   
   bound = meta_new_data(MT_FLOAT, f, malloc(sizeof(float)));
@@ -0,0 +1,777 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter_savedzi.h"
+#include "encode_pool.h"
+
+#include <jpeglib.h>
+#include <setjmp.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <dirent.h>
+
+/*
+ * writes a deep zoom tile directory (dzi or xyz layout) from an iterator
+ * sink. every scale the renderer supports is rendered directly, row of
+ * tiles by row of tiles, coarser levels are streamed from the rows of the
+ * coarsest rendered scale through a gamma correct 2x2 cascade.
+ * finished tiles are encoded and written by a pool of threads.
+ * the xyz layout starts at the coarsest level which fits into one tile,
+ * manifest.json records the dzi level of z 0.
+ */
+
+#define TILE_SIZE 256
+#define SLOTS_PER_THREAD 2
+
+enum {
+  SAVEDZI_JPEG = 0,
+  SAVEDZI_PNG
+};
+
+enum {
+  SAVEDZI_DZI = 0,
+  SAVEDZI_XYZ
+};
+
+typedef struct {
+  uint8_t *buf;
+  int w, h;
+  char path[PATH_MAX];
+} _Slot;
+
+//encoder thread state, libjpeg errors return to _jpeg_write()
+typedef struct {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+} _Enc;
+
+typedef struct _Level _Level;
+
+//rows of one output level, cut into tiles every TILE_SIZE rows
+struct _Level {
+  int level;
+  int w, h;
+  uint8_t *acc;
+  int acc_y; //first row in acc
+  int acc_rows;
+  uint32_t *pending; //horizontally summed linear row waiting for its pair
+  int has_pending;
+  _Level *child;
+};
+
+typedef struct {
+  Meta *m_size;
+  Meta *filename;
+  int format;
+  int layout;
+  int quality;
+  Dim size;
+  int levels; //dzi level count
+  int level_first; //first level written, z 0 of the xyz layout
+  int scale_max; //coarsest scale rendered directly
+  _Level **scale_levels; //output level of each rendered scale
+  uint8_t *band; //one tile row of the current scale
+  int started;
+  Encode_Pool *pool;
+} _Data;
+
+typedef struct {
+  Filter *f;
+  Filter *source;
+  int scale;
+  int tw;
+  int th;
+  int finito;
+} _Iter;
+
+static const char *_ext[] = {"jpg", "png"};
+
+static int _jpeg_write(_Data *data, _Enc *enc, _Slot *slot)
+{
+  struct jpeg_compress_struct *cinfo = &enc->cinfo;
+  JSAMPROW row_pointer[1];
+  FILE *file = fopen(slot->path, "w");
+
+  if (!file)
+    return -1;
+
+  if (setjmp(enc->setjmp_buffer)) {
+    jpeg_abort_compress(cinfo);
+    fclose(file);
+    unlink(slot->path);
+    return -1;
+  }
+
+  jpeg_stdio_dest(cinfo, file);
+  cinfo->image_width      = slot->w;
+  cinfo->image_height     = slot->h;
+  cinfo->input_components = 3;
+  cinfo->in_color_space   = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality (cinfo, data->quality, TRUE);
+  jpeg_start_compress(cinfo, TRUE);
+  while (cinfo->next_scanline < cinfo->image_height) {
+    row_pointer[0] = slot->buf + cinfo->next_scanline*slot->w*3;
+    jpeg_write_scanlines(cinfo, row_pointer, 1);
+  }
+  jpeg_finish_compress(cinfo);
+
+  return fclose(file);
+}
+
+static void _png_chunk(FILE *file, const char *type, const uint8_t *buf, uint32_t len)
+{
+  uint8_t be[4];
+  uLong crc;
+
+  be[0] = len >> 24; be[1] = len >> 16; be[2] = len >> 8; be[3] = len;
+  fwrite(be, 1, 4, file);
+  fwrite(type, 1, 4, file);
+  fwrite(buf, 1, len, file);
+
+  //crc32() with a NULL buffer returns the initial value
+  crc = crc32(0, (const Bytef*)type, 4);
+  if (len)
+    crc = crc32(crc, buf, len);
+  be[0] = crc >> 24; be[1] = crc >> 16; be[2] = crc >> 8; be[3] = crc;
+  fwrite(be, 1, 4, file);
+}
+
+//8 bit rgb, sub filter on every row
+static int _png_write(_Data *data, _Slot *slot)
+{
+  const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  uint8_t ihdr[13] = {0};
+  int x, y, stride = slot->w*3+1;
+  uint8_t *raw = malloc(stride*slot->h);
+  uLongf len = compressBound(stride*slot->h);
+  uint8_t *z = malloc(len);
+  uint8_t *src;
+  FILE *file;
+
+  for(y=0;y<slot->h;y++) {
+    src = slot->buf + y*slot->w*3;
+    raw[y*stride] = 1;
+    for(x=0;x<3;x++)
+      raw[y*stride+1+x] = src[x];
+    for(x=3;x<slot->w*3;x++)
+      raw[y*stride+1+x] = src[x] - src[x-3];
+  }
+  if (compress2(z, &len, raw, stride*slot->h, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    free(raw);
+    free(z);
+    return -1;
+  }
+  free(raw);
+
+  file = fopen(slot->path, "w");
+  if (!file) {
+    free(z);
+    return -1;
+  }
+
+  ihdr[0] = slot->w >> 24; ihdr[1] = slot->w >> 16; ihdr[2] = slot->w >> 8; ihdr[3] = slot->w;
+  ihdr[4] = slot->h >> 24; ihdr[5] = slot->h >> 16; ihdr[6] = slot->h >> 8; ihdr[7] = slot->h;
+  ihdr[8] = 8; //bit depth
+  ihdr[9] = 2; //truecolor
+
+  fwrite(sig, 1, 8, file);
+  _png_chunk(file, "IHDR", ihdr, 13);
+  _png_chunk(file, "IDAT", z, len);
+  _png_chunk(file, "IEND", NULL, 0);
+  free(z);
+
+  return fclose(file);
+}
+
+static void _error_exit(j_common_ptr cinfo)
+{
+  _Enc *enc = (_Enc*)cinfo;
+
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(enc->setjmp_buffer, 1);
+}
+
+static void *_thread_new(void *data)
+{
+  _Enc *enc = calloc(sizeof(_Enc), 1);
+
+  enc->cinfo.err = jpeg_std_error(&enc->pub);
+  enc->pub.error_exit = &_error_exit;
+  jpeg_create_compress(&enc->cinfo);
+
+  return enc;
+}
+
+static void _thread_del(void *data, void *thread)
+{
+  _Enc *enc = thread;
+
+  jpeg_destroy_compress(&enc->cinfo);
+  free(enc);
+}
+
+//tiles are independent files, written by the encoder threads
+static int _encode(void *data_ptr, void *thread, void *slot_ptr)
+{
+  _Data *data = data_ptr;
+  _Slot *slot = slot_ptr;
+  int failed;
+
+  if (data->format == SAVEDZI_PNG)
+    failed = _png_write(data, slot);
+  else
+    failed = _jpeg_write(data, thread, slot);
+  if (failed)
+    printf("savedzi: failed to write %s\n", slot->path);
+
+  return failed ? -1 : 0;
+}
+
+static void _slot_init(void *data, void *slot_ptr)
+{
+  ((_Slot*)slot_ptr)->buf = malloc(TILE_SIZE*TILE_SIZE*3);
+}
+
+static void _slot_del(void *data, void *slot_ptr)
+{
+  free(((_Slot*)slot_ptr)->buf);
+}
+
+static const Encode_Pool_Funcs _pool_funcs = {
+  &_slot_init,
+  &_slot_del,
+  &_thread_new,
+  &_thread_del,
+  &_encode,
+  NULL
+};
+
+static void _tile_path(_Data *data, char *path, int level, int x, int y)
+{
+  if (data->layout == SAVEDZI_XYZ)
+    snprintf(path, PATH_MAX, "%s/%d/%d/%d.%s", (char*)data->filename->data, level-data->level_first, x, y, _ext[data->format]);
+  else
+    snprintf(path, PATH_MAX, "%s_files/%d/%d_%d.%s", (char*)data->filename->data, level, x, y, _ext[data->format]);
+}
+
+static void _acc_flush(_Data *data, _Level *l)
+{
+  _Slot *slot;
+  int y, tx;
+
+  if (!l->acc_rows)
+    return;
+
+  for(tx=0;tx*TILE_SIZE<l->w;tx++) {
+    slot = encode_pool_slot_get(data->pool);
+    slot->w = TILE_SIZE;
+    if ((tx+1)*TILE_SIZE > l->w)
+      slot->w = l->w - tx*TILE_SIZE;
+    slot->h = l->acc_rows;
+    for(y=0;y<slot->h;y++)
+      memcpy(slot->buf + y*slot->w*3, l->acc + (y*l->w + tx*TILE_SIZE)*3, slot->w*3);
+    _tile_path(data, slot->path, l->level, tx, l->acc_y/TILE_SIZE);
+    encode_pool_submit(data->pool);
+  }
+
+  l->acc_y += l->acc_rows;
+  l->acc_rows = 0;
+}
+
+static void _row_push(_Data *data, _Level *l, const uint8_t *row);
+
+//one finished row of the parent, summed horizontally in linear light
+static void _child_push(_Data *data, _Level *l, const uint8_t *row, int pw)
+{
+  uint8_t *out;
+  int x, i, x2;
+
+  if (!l->has_pending)
+    memset(l->pending, 0, sizeof(uint32_t)*l->w*3);
+
+  for(x=0;x<l->w;x++) {
+    x2 = 2*x+1 < pw ? 2*x+1 : 2*x;
+    for(i=0;i<3;i++)
+      l->pending[x*3+i] += lime_g2l[row[2*x*3+i]] + lime_g2l[row[x2*3+i]];
+  }
+
+  if (!l->has_pending) {
+    l->has_pending = 1;
+    return;
+  }
+
+  out = malloc(l->w*3);
+  for(x=0;x<l->w*3;x++)
+    out[x] = lime_l2g[(l->pending[x]+2)/4];
+  l->has_pending = 0;
+  _row_push(data, l, out);
+  free(out);
+}
+
+static void _row_push(_Data *data, _Level *l, const uint8_t *row)
+{
+  memcpy(l->acc + l->acc_rows*l->w*3, row, l->w*3);
+  l->acc_rows++;
+  if (l->acc_rows == TILE_SIZE)
+    _acc_flush(data, l);
+
+  if (l->child)
+    _child_push(data, l->child, row, l->w);
+}
+
+//the last row of an odd height level is paired with itself
+static void _level_finish(_Data *data, _Level *l)
+{
+  int x;
+
+  _acc_flush(data, l);
+
+  if (!l->child)
+    return;
+
+  if (l->child->has_pending) {
+    uint8_t *out = malloc(l->child->w*3);
+    for(x=0;x<l->child->w*3;x++)
+      out[x] = lime_l2g[(l->child->pending[x]+1)/2];
+    l->child->has_pending = 0;
+    _row_push(data, l->child, out);
+    free(out);
+  }
+  _level_finish(data, l->child);
+}
+
+static _Level *_level_new(int level, int w, int h)
+{
+  _Level *l = calloc(sizeof(_Level), 1);
+
+  l->level = level;
+  l->w = w;
+  l->h = h;
+  l->acc = malloc(w*TILE_SIZE*3);
+
+  return l;
+}
+
+static void _level_del(_Level *l)
+{
+  if (!l)
+    return;
+
+  _level_del(l->child);
+  free(l->acc);
+  free(l->pending);
+  free(l);
+}
+
+static int _mkdir(const char *path)
+{
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    printf("savedzi: could not create %s\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int _manifest_write(_Data *data)
+{
+  char path[PATH_MAX];
+  FILE *file;
+
+  if (data->layout == SAVEDZI_XYZ) {
+    snprintf(path, PATH_MAX, "%s/manifest.json", (char*)data->filename->data);
+    file = fopen(path, "w");
+    if (!file)
+      return -1;
+    //z counts from the first level which fits into one tile, z = dzi level - dzi_level_offset
+    fprintf(file, "{\"width\": %d, \"height\": %d, \"tile_size\": %d, \"levels\": %d, \"dzi_level_offset\": %d, \"format\": \"%s\"}\n",
+            data->size.width, data->size.height, TILE_SIZE, data->levels-data->level_first, data->level_first, _ext[data->format]);
+  }
+  else {
+    snprintf(path, PATH_MAX, "%s.dzi", (char*)data->filename->data);
+    file = fopen(path, "w");
+    if (!file)
+      return -1;
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"%s\">\n"
+                  "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+                  "</Image>\n", TILE_SIZE, _ext[data->format], data->size.width, data->size.height);
+  }
+
+  return fclose(file);
+}
+
+static int _numeric(const char *name, int len)
+{
+  return len && (int)strspn(name, "0123456789") == len;
+}
+
+//tile names we write: x_y.ext (dzi) or y.ext (xyz), for any format
+static int _tile_name(const char *name)
+{
+  const char *dot = strrchr(name, '.');
+  const char *sep = strchr(name, '_');
+  int i;
+
+  if (!dot)
+    return 0;
+  if (sep && sep < dot) {
+    if (!_numeric(name, sep-name) || !_numeric(sep+1, dot-sep-1))
+      return 0;
+  }
+  else if (!_numeric(name, dot-name))
+    return 0;
+
+  for(i=SAVEDZI_JPEG;i<=SAVEDZI_PNG;i++)
+    if (!strcmp(dot+1, _ext[i]))
+      return 1;
+
+  return 0;
+}
+
+/*
+ * removes the levels (and xyz columns) and tiles of a previous export, a
+ * smaller image or another format would leave them next to the new ones.
+ * only names we write are touched, directories with other files stay.
+ */
+static void _stale_remove(const char *dir, int depth)
+{
+  char path[PATH_MAX];
+  DIR *d = opendir(dir);
+  struct dirent *ent;
+  struct stat st;
+
+  if (!d)
+    return;
+
+  while ((ent = readdir(d))) {
+    snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name);
+    if (lstat(path, &st))
+      continue;
+    if (depth && S_ISDIR(st.st_mode) && _numeric(ent->d_name, strlen(ent->d_name))) {
+      _stale_remove(path, depth-1);
+      rmdir(path);
+    }
+    else if (!depth && S_ISREG(st.st_mode) && _tile_name(ent->d_name))
+      unlink(path);
+  }
+  closedir(d);
+}
+
+//directories of every level (and column for xyz)
+static int _dirs_create(_Data *data)
+{
+  char path[PATH_MAX];
+  int level, scale, x, w;
+
+  if (data->layout == SAVEDZI_XYZ)
+    snprintf(path, PATH_MAX, "%s", (char*)data->filename->data);
+  else
+    snprintf(path, PATH_MAX, "%s_files", (char*)data->filename->data);
+  _stale_remove(path, data->layout == SAVEDZI_XYZ ? 2 : 1);
+  if (_mkdir(path))
+    return -1;
+
+  for(level=data->level_first;level<data->levels;level++) {
+    if (data->layout == SAVEDZI_XYZ)
+      snprintf(path, PATH_MAX, "%s/%d", (char*)data->filename->data, level-data->level_first);
+    else
+      snprintf(path, PATH_MAX, "%s_files/%d", (char*)data->filename->data, level);
+    if (_mkdir(path))
+      return -1;
+
+    if (data->layout != SAVEDZI_XYZ)
+      continue;
+    scale = data->levels-1-level;
+    w = DIV_SHIFT_ROUND_UP(data->size.width, scale);
+    for(x=0;x*TILE_SIZE<w;x++) {
+      snprintf(path, PATH_MAX, "%s/%d/%d", (char*)data->filename->data, level-data->level_first, x);
+      if (_mkdir(path))
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void _stop(_Data *data)
+{
+  int i;
+
+  if (!data->started)
+    return;
+
+  if (encode_pool_del(data->pool))
+    printf("savedzi: some tiles of %s are missing\n", (char*)data->filename->data);
+  data->pool = NULL;
+
+  //the coarsest rendered scale owns the cascade
+  for(i=0;i<=data->scale_max;i++)
+    _level_del(data->scale_levels[i]);
+  free(data->scale_levels);
+  free(data->band);
+  data->scale_levels = NULL;
+  data->band = NULL;
+  data->started = 0;
+}
+
+static int _start(_Data *data, int tw, int th)
+{
+  int i, size;
+  _Level *l;
+
+  data->size = *(Dim*)data->m_size->data;
+
+  size = data->size.width > data->size.height ? data->size.width : data->size.height;
+  for(data->levels=1;(1 << (data->levels-1)) < size;data->levels++);
+
+  //dzi has every level down to 1x1, xyz starts with the whole image in one tile
+  data->level_first = 0;
+  if (data->layout == SAVEDZI_XYZ)
+    while (data->level_first < data->levels-1
+        && DIV_SHIFT_ROUND_UP(size, (data->levels-2-data->level_first)) <= TILE_SIZE)
+      data->level_first++;
+
+  data->scale_max = data->size.scaledown_max;
+  if (data->scale_max > data->levels-1-data->level_first)
+    data->scale_max = data->levels-1-data->level_first;
+  if (data->scale_max < 0)
+    data->scale_max = 0;
+
+  if (_dirs_create(data) || _manifest_write(data)) {
+    printf("savedzi: could not write to %s\n", (char*)data->filename->data);
+    return -1;
+  }
+
+  data->scale_levels = calloc(sizeof(_Level*)*(data->scale_max+1), 1);
+  for(i=0;i<=data->scale_max;i++)
+    data->scale_levels[i] = _level_new(data->levels-1-i,
+                                       DIV_SHIFT_ROUND_UP(data->size.width, i),
+                                       DIV_SHIFT_ROUND_UP(data->size.height, i));
+
+  //levels below the renderer's range are downsampled from the coarsest rendered one
+  for(l=data->scale_levels[data->scale_max];l->level>data->level_first;l=l->child) {
+    l->child = _level_new(l->level-1, (l->w+1)/2, (l->h+1)/2);
+    l->child->pending = malloc(sizeof(uint32_t)*l->child->w*3);
+  }
+
+  data->band = malloc(data->size.width*th*3);
+
+  data->pool = encode_pool_new(0, SLOTS_PER_THREAD, sizeof(_Slot), &_pool_funcs, data);
+  if (!data->pool) {
+    printf("savedzi: could not start encoder threads\n");
+    for(i=0;i<=data->scale_max;i++)
+      _level_del(data->scale_levels[i]);
+    free(data->scale_levels);
+    free(data->band);
+    data->scale_levels = NULL;
+    data->band = NULL;
+    return -1;
+  }
+
+  data->started = 1;
+
+  return 0;
+}
+
+static void _worker(Filter *f, void *in, int channel, Eina_Array *out, Rect *area, int thread_id)
+{
+  Tiledata *tile = in;
+  _Data *data = ea_data(f->data, 0);
+  int scale = tile->area.corner.scale;
+  _Level *l;
+  int x1, y1, y;
+
+  if (!data->started)
+    return;
+
+  l = data->scale_levels[scale];
+
+  x1 = tile->area.corner.x+tile->area.width < l->w ? tile->area.corner.x+tile->area.width : l->w;
+  y1 = tile->area.corner.y+tile->area.height < l->h ? tile->area.corner.y+tile->area.height : l->h;
+
+  for(y=tile->area.corner.y;y<y1;y++)
+    memcpy(data->band + ((y-tile->area.corner.y)*l->w + tile->area.corner.x)*3,
+           (uint8_t*)tile->data + (y-tile->area.corner.y)*tile->area.width*3,
+           (x1-tile->area.corner.x)*3);
+
+  //last tile of the row
+  if (x1 == l->w) {
+    for(y=tile->area.corner.y;y<y1;y++)
+      _row_push(data, l, data->band + (y-tile->area.corner.y)*l->w*3);
+    if (y1 == l->h)
+      _level_finish(data, l);
+  }
+}
+
+static void _finish(Filter *f)
+{
+  _stop(ea_data(f->data, 0));
+}
+
+//coarsest scale first, tiles row by row
+static void _iter_next(void *data, Pos *pos, int *channel)
+{
+  _Iter *iter = data;
+  _Data *fdata = ea_data(iter->f->data, 0);
+
+  pos->x += iter->tw;
+  if (pos->x < DIV_SHIFT_ROUND_UP(fdata->size.width, pos->scale))
+    return;
+
+  pos->x = 0;
+  pos->y += iter->th;
+  if (pos->y < DIV_SHIFT_ROUND_UP(fdata->size.height, pos->scale))
+    return;
+
+  pos->y = 0;
+  if (!pos->scale) {
+    iter->finito = 1;
+    return;
+  }
+  pos->scale--;
+  iter->tw = tw_get(iter->source, pos->scale);
+  iter->th = th_get(iter->source, pos->scale);
+}
+
+static int _iter_eoi(void *data, Pos pos, int channel)
+{
+  _Iter *iter = data;
+
+  return iter->finito;
+}
+
+static void *_iter_new(Filter *f, Rect *area, Eina_Array *f_source, Pos *pos, int *channel)
+{
+  _Iter *iter = calloc(sizeof(_Iter), 1);
+  _Data *data = ea_data(f->data, 0);
+  int i, th = 0;
+
+  iter->f = f;
+  iter->source = ea_data(f_source, 0);
+
+  _stop(data);
+  data->size = *(Dim*)data->m_size->data;
+  for(i=0;i<=data->size.scaledown_max;i++)
+    if (th_get(iter->source, i) > th)
+      th = th_get(iter->source, i);
+
+  if (_start(data, tw_get(iter->source, 0), th))
+    iter->finito = 1;
+
+  *channel = 0;
+  pos->x = 0;
+  pos->y = 0;
+  pos->scale = data->scale_max;
+  iter->tw = tw_get(iter->source, pos->scale);
+  iter->th = th_get(iter->source, pos->scale);
+
+  return iter;
+}
+
+static int _del(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+
+  _stop(data);
+  free(data);
+
+  return 0;
+}
+
+static void _setting_add(Filter *filter, const char *name, int *val, int min, int max)
+{
+  Meta *setting, *bound;
+
+  setting = meta_new_data(MT_INT, filter, val);
+  meta_name_set(setting, name);
+  eina_array_push(filter->settings, setting);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = min;
+  meta_name_set(bound, "PARENT_SETTING_MIN");
+  meta_attach(setting, bound);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = max;
+  meta_name_set(bound, "PARENT_SETTING_MAX");
+  meta_attach(setting, bound);
+}
+
+Filter *filter_savedzi_new(void)
+{
+  Filter *filter = filter_new(&filter_core_savedzi);
+  Meta *in, *channel, *bitdepth, *color, *size, *fliprot;
+  _Data *data = calloc(sizeof(_Data), 1);
+  data->quality = 90;
+  ea_push(filter->data, data);
+
+  filter->del = &_del;
+  filter->mode_iter = filter_mode_iter_new();
+  filter->mode_iter->iter_new = &_iter_new;
+  filter->mode_iter->iter_next = &_iter_next;
+  filter->mode_iter->iter_eoi = &_iter_eoi;
+  filter->mode_iter->worker = &_worker;
+  filter->mode_iter->finish = &_finish;
+
+  bitdepth = meta_new_data(MT_BITDEPTH, filter, malloc(sizeof(int)));
+  *(int*)(bitdepth->data) = BD_U8;
+
+  size = meta_new(MT_IMGSIZE, filter);
+  ea_push(filter->core, size);
+  data->m_size = size;
+
+  in = meta_new(MT_BUNDLE, filter);
+  eina_array_push(filter->in, in);
+
+  fliprot = meta_new_data(MT_FLIPROT, filter, malloc(sizeof(int)));
+  *(int*)fliprot->data = 1;
+  meta_attach(in, fliprot);
+
+  channel = meta_new_channel(filter, 1);
+  color = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(color->data) = CS_INT_RGB;
+  meta_attach(channel, color);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, size);
+  meta_attach(in, channel);
+
+  //output base path: base.dzi + base_files/ or base/z/x/y
+  data->filename = meta_new(MT_STRING, filter);
+  meta_name_set(data->filename, "filename");
+  eina_array_push(filter->settings, data->filename);
+
+  //format 0: jpeg, 1: png - layout 0: dzi, 1: xyz
+  _setting_add(filter, "format", &data->format, SAVEDZI_JPEG, SAVEDZI_PNG);
+  _setting_add(filter, "layout", &data->layout, SAVEDZI_DZI, SAVEDZI_XYZ);
+  _setting_add(filter, "quality", &data->quality, 1, 100);
+
+  return filter;
+}
+
+Filter_Core filter_core_savedzi = {
+  "Deep zoom saver",
+  "savedzi",
+  "Saves all scales as a deep zoom tile directory",
+  &filter_savedzi_new
+};
@@ -18,43 +18,479 @@
  */
 
 #include "filter_savejpeg.h"
+#include "encode_pool.h"
 
 #include <jpeglib.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+/*
+ * streaming sink: tiles arrive row by row in iterator mode and are copied
+ * into a band of one tile row, the band is cut into stripes of whole mcu
+ * rows which are encoded in parallel, each as a standalone jpeg with
+ * restart markers. a writer thread concatenates the entropy coded segments
+ * in order, with a restart marker between stripes, behind the headers of
+ * the first stripe, which gives one valid baseline jpeg.
+ * the jpeg height field is 16 bit, taller images are rejected.
+ * the restart interval is chosen so loadjpeg can seek into the file.
+ * stripes in flight are bounded to POOL_BANDS tile rows, wide images get
+ * shorter stripes and then fewer encoder threads.
+ */
+
+#define QUALITY 97
+#define STRIPE_MCU_ROWS 8
+#define STRIPES_PER_THREAD 2
+//bytes of all stripes (rows and encoded output) relative to one band
+#define POOL_BANDS 2
+#define JPEG_HEIGHT_MAX 65535
+
+typedef struct {
+  uint8_t *rows;
+  int row_count;
+  int idx;
+  unsigned char *out; //complete jpeg of this stripe
+  unsigned long out_size;
+  unsigned long out_len;
+  int ecs_start; //entropy coded data, after SOS
+  int ecs_end; //before EOI
+} _Stripe;
+
+//encoder thread state, libjpeg errors return to _stripe_encode()
+typedef struct {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+} _Enc;
 
 typedef struct {
   Meta *filename;
+  FILE *file;
+  Rect area; //what is written to the file
+  int th;
+  uint8_t *band;
+  int started;
+  int stripe_rows;
+  int stripe_mcu_rows;
+  int rst_int; //in mcus
+  int rst_per_stripe;
+  Encode_Pool *pool;
+  _Stripe *cur;
+  uint64_t submitted;
+  int failed; //a stripe failed, nothing is written after it
 } _Data;
 
-static void _worker(Filter *f, Eina_Array *in, Eina_Array *out, Rect *area, int thread_id)
+typedef struct {
+  Filter *f;
+  Rect area;
+  int tw;
+  int th;
+  int start_x;
+  int finito;
+} _Iter;
+
+static int _align_down(int v, int step)
 {
-  FILE *file;
-  int i, j;
+  if (v >= 0)
+    return (v/step)*step;
+  return ((v-step+1)/step)*step;
+}
+
+static void _cinfo_setup(_Data *data, struct jpeg_compress_struct *cinfo, int height)
+{
+  cinfo->image_width      = data->area.width;
+  cinfo->image_height     = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space   = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality (cinfo, QUALITY, TRUE);
+  cinfo->restart_interval = data->rst_int;
+}
+
+//offsets of the entropy coded segment, -1 if the stream is not what libjpeg should produce
+static int _ecs_find(_Stripe *stripe)
+{
+  unsigned long pos = 2;
+  int len;
+
+  while (pos + 4 <= stripe->out_len && stripe->out[pos] == 0xFF) {
+    len = (stripe->out[pos+2] << 8) | stripe->out[pos+3];
+    if (stripe->out[pos+1] == 0xDA) {
+      stripe->ecs_start = pos + 2 + len;
+      stripe->ecs_end = stripe->out_len - 2;
+      return stripe->ecs_start <= stripe->ecs_end ? 0 : -1;
+    }
+    pos += 2 + len;
+  }
+
+  return -1;
+}
+
+//restart markers of each stripe count from 0, continue the global sequence instead
+static void _rst_renumber(_Stripe *stripe, int first)
+{
+  unsigned char *p = stripe->out + stripe->ecs_start;
+  unsigned char *end = stripe->out + stripe->ecs_end;
+  int n = first;
+
+  while ((p = memchr(p, 0xFF, end - p)) && p + 1 < end) {
+    if (p[1] >= 0xD0 && p[1] <= 0xD7)
+      p[1] = 0xD0 + (n++ & 7);
+    p += 2;
+  }
+}
+
+static void _error_exit(j_common_ptr cinfo)
+{
+  _Enc *enc = (_Enc*)cinfo;
+
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(enc->setjmp_buffer, 1);
+}
+
+static void *_thread_new(void *data)
+{
+  _Enc *enc = calloc(sizeof(_Enc), 1);
+
+  enc->cinfo.err = jpeg_std_error(&enc->pub);
+  enc->pub.error_exit = &_error_exit;
+  jpeg_create_compress(&enc->cinfo);
+
+  return enc;
+}
+
+static void _thread_del(void *data, void *thread)
+{
+  _Enc *enc = thread;
+
+  jpeg_destroy_compress(&enc->cinfo);
+  free(enc);
+}
+
+static int _stripe_encode(void *data_ptr, void *thread, void *stripe_ptr)
+{
+  _Data *data = data_ptr;
+  _Enc *enc = thread;
+  _Stripe *stripe = stripe_ptr;
+  struct jpeg_compress_struct *cinfo = &enc->cinfo;
   JSAMPROW row_pointer[1];
-  _Data *data = ea_data(f->data, 0);
+  unsigned char *out = stripe->out;
+  unsigned long size = stripe->out_size;
+
+  if (setjmp(enc->setjmp_buffer)) {
+    jpeg_abort_compress(cinfo);
+    //libjpeg may have replaced our buffer before failing
+    if (out != stripe->out) {
+      free(stripe->out);
+      stripe->out = out;
+      stripe->out_size = size;
+    }
+    return -1;
+  }
+
+  jpeg_mem_dest(cinfo, &out, &size);
+  _cinfo_setup(data, cinfo, stripe->row_count);
+  jpeg_start_compress(cinfo, TRUE);
+  while (cinfo->next_scanline < cinfo->image_height) {
+    row_pointer[0] = stripe->rows + cinfo->next_scanline*data->area.width*3;
+    jpeg_write_scanlines(cinfo, row_pointer, 1);
+  }
+  jpeg_finish_compress(cinfo);
+
+  //libjpeg allocates a larger buffer if ours was too small
+  if (out != stripe->out) {
+    free(stripe->out);
+    stripe->out = out;
+    stripe->out_size = size;
+  }
+  stripe->out_len = size;
+
+  if (_ecs_find(stripe)) {
+    printf("savejpeg: unexpected encoder output\n");
+    return -1;
+  }
+  _rst_renumber(stripe, stripe->idx*data->rst_per_stripe);
+
+  return 0;
+}
+
+static void _stripe_write(_Data *data, _Stripe *stripe)
+{
+  unsigned char rst[2];
+  int height = data->area.height;
+
+  //headers of the first stripe with the height of the whole image
+  if (!stripe->idx) {
+    unsigned long pos = 2;
+    int len;
+    while (pos + 4 <= stripe->out_len && stripe->out[pos+1] != 0xDA) {
+      len = (stripe->out[pos+2] << 8) | stripe->out[pos+3];
+      if (stripe->out[pos+1] == 0xC0) {
+        stripe->out[pos+5] = height >> 8;
+        stripe->out[pos+6] = height & 0xFF;
+      }
+      pos += 2 + len;
+    }
+    fwrite(stripe->out, 1, stripe->ecs_start, data->file);
+  }
+  else {
+    rst[0] = 0xFF;
+    rst[1] = 0xD0 + ((stripe->idx*data->rst_per_stripe - 1) & 7);
+    fwrite(rst, 1, 2, data->file);
+  }
+
+  fwrite(stripe->out + stripe->ecs_start, 1, stripe->ecs_end - stripe->ecs_start, data->file);
+}
+
+//on the writer thread, in stripe order
+static void _stripe_commit(void *data_ptr, void *stripe_ptr, int failed)
+{
+  _Data *data = data_ptr;
+
+  if (failed)
+    data->failed = 1;
+  if (!data->failed)
+    _stripe_write(data, stripe_ptr);
+}
+
+static void _stripe_init(void *data_ptr, void *stripe_ptr)
+{
+  _Data *data = data_ptr;
+  _Stripe *stripe = stripe_ptr;
+
+  stripe->rows = malloc(data->area.width*data->stripe_rows*3);
+}
+
+static void _stripe_del(void *data_ptr, void *stripe_ptr)
+{
+  _Stripe *stripe = stripe_ptr;
+
+  free(stripe->rows);
+  free(stripe->out);
+}
+
+static const Encode_Pool_Funcs _pool_funcs = {
+  &_stripe_init,
+  &_stripe_del,
+  &_thread_new,
+  &_thread_del,
+  &_stripe_encode,
+  &_stripe_commit
+};
+
+//next free stripe for the render thread to fill
+static void _stripe_acquire(_Data *data)
+{
+  data->cur = encode_pool_slot_get(data->pool);
+  data->cur->row_count = 0;
+  data->cur->idx = data->submitted;
+}
+
+static void _stripe_submit(_Data *data)
+{
+  encode_pool_submit(data->pool);
+  data->submitted++;
+  data->cur = NULL;
+}
+
+static void _rows_push(_Data *data, uint8_t *rows, int count)
+{
+  int n, stride = data->area.width*3;
+
+  while (count) {
+    if (!data->cur)
+      _stripe_acquire(data);
+    n = data->stripe_rows - data->cur->row_count;
+    if (n > count)
+      n = count;
+    memcpy(data->cur->rows + data->cur->row_count*stride, rows, n*stride);
+    data->cur->row_count += n;
+    rows += n*stride;
+    count -= n;
+    if (data->cur->row_count == data->stripe_rows)
+      _stripe_submit(data);
+  }
+}
+
+static int _start(_Data *data, Rect *area, int th)
+{
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
-      
-  file = fopen(data->filename->data, "w");
-  
+  int i, mcu_w, mcu_h, threads;
+
+  if (area->height > JPEG_HEIGHT_MAX || area->width > JPEG_MAX_DIMENSION) {
+    printf("savejpeg: %dx%d is too large for jpeg\n", area->width, area->height);
+    return -1;
+  }
+
+  data->file = fopen(data->filename->data, "w");
+  if (!data->file) {
+    printf("savejpeg: could not open %s\n", (char*)data->filename->data);
+    return -1;
+  }
+
+  data->area = *area;
+  data->th = th;
+
+  //mcu size of the default sampling
   cinfo.err = jpeg_std_error(&jerr);
   jpeg_create_compress(&cinfo);
-  jpeg_stdio_dest(&cinfo, file);
-
-  cinfo.image_width      = area->width;
-  cinfo.image_height     = area->height;
-  cinfo.input_components = 3;
-  cinfo.in_color_space   = JCS_RGB;
-  jpeg_set_defaults(&cinfo);
-  jpeg_set_quality (&cinfo, 97, TRUE);
-  jpeg_start_compress(&cinfo, TRUE);
-    
-  while (cinfo.next_scanline < cinfo.image_height) {
-    row_pointer[0] = (uint8_t*)((Tiledata*)ea_data(in, 0))->data + cinfo.next_scanline*area->width*3;
-    jpeg_write_scanlines(&cinfo, row_pointer, 1);
+  data->rst_int = 0;
+  _cinfo_setup(data, &cinfo, area->height);
+  mcu_w = cinfo.comp_info[0].h_samp_factor*DCTSIZE;
+  mcu_h = cinfo.comp_info[0].v_samp_factor*DCTSIZE;
+  jpeg_destroy_compress(&cinfo);
+
+  //largest interval loadjpeg can seek with (256 pixel tiles), at least one per mcu row
+  data->rst_int = (area->width + mcu_w - 1)/mcu_w;
+  for(i=256/mcu_w;i>=1;i/=2)
+    if (area->width % (i*mcu_w) == 0) {
+      data->rst_int = i;
+      break;
+    }
+
+  //a stripe holds its rows and up to as much encoded output
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+  data->stripe_mcu_rows = STRIPE_MCU_ROWS;
+  while (data->stripe_mcu_rows > 1
+      && threads*STRIPES_PER_THREAD*data->stripe_mcu_rows*mcu_h*2 > POOL_BANDS*th)
+    data->stripe_mcu_rows /= 2;
+  while (threads > 1 && threads*STRIPES_PER_THREAD*data->stripe_mcu_rows*mcu_h*2 > POOL_BANDS*th)
+    threads--;
+
+  data->stripe_rows = data->stripe_mcu_rows*mcu_h;
+  data->rst_per_stripe = data->stripe_mcu_rows*(((area->width + mcu_w - 1)/mcu_w)/data->rst_int);
+
+  data->cur = NULL;
+  data->submitted = 0;
+  data->failed = 0;
+
+  data->pool = encode_pool_new(threads, STRIPES_PER_THREAD, sizeof(_Stripe), &_pool_funcs, data);
+  if (!data->pool) {
+    printf("savejpeg: could not start encoder threads\n");
+    fclose(data->file);
+    data->file = NULL;
+    return -1;
   }
-  jpeg_finish_compress(&cinfo);
 
-  fclose(file);
+  data->band = malloc(area->width*th*3);
+  data->started = 1;
+
+  return 0;
+}
+
+static void _worker(Filter *f, void *in, int channel, Eina_Array *out, Rect *area, int thread_id)
+{
+  Tiledata *tile = in;
+  _Data *data = ea_data(f->data, 0);
+  Rect *a = &data->area;
+  int x0, x1, y0, y1, y;
+  int band_y;
+
+  if (!data->started)
+    return;
+
+  band_y = tile->area.corner.y;
+
+  //intersection of tile and output area
+  x0 = tile->area.corner.x > a->corner.x ? tile->area.corner.x : a->corner.x;
+  x1 = tile->area.corner.x+tile->area.width < a->corner.x+a->width ? tile->area.corner.x+tile->area.width : a->corner.x+a->width;
+  y0 = band_y > a->corner.y ? band_y : a->corner.y;
+  y1 = band_y+tile->area.height < a->corner.y+a->height ? band_y+tile->area.height : a->corner.y+a->height;
+
+  for(y=y0;y<y1;y++)
+    memcpy(data->band + ((y-band_y)*a->width + x0-a->corner.x)*3,
+           (uint8_t*)tile->data + ((y-band_y)*tile->area.width + x0-tile->area.corner.x)*3,
+           (x1-x0)*3);
+
+  //last tile of the row
+  if (tile->area.corner.x+tile->area.width >= a->corner.x+a->width)
+    _rows_push(data, data->band + (y0-band_y)*a->width*3, y1-y0);
+}
+
+static void _finish(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+  unsigned char eoi[2] = {0xFF, 0xD9};
+
+  if (!data->started)
+    return;
+
+  //the last stripe may be shorter
+  if (data->cur && data->cur->row_count)
+    _stripe_submit(data);
+
+  encode_pool_del(data->pool);
+  data->pool = NULL;
+
+  fwrite(eoi, 1, 2, data->file);
+  fclose(data->file);
+  data->file = NULL;
+  //a truncated stream would look like a valid but partial image
+  if (data->failed) {
+    printf("savejpeg: encoding failed, removing %s\n", (char*)data->filename->data);
+    unlink(data->filename->data);
+  }
+
+  free(data->band);
+  data->band = NULL;
+  data->started = 0;
+}
+
+static void _iter_next(void *data, Pos *pos, int *channel)
+{
+  _Iter *iter = data;
+
+  pos->x += iter->tw;
+  if (pos->x >= iter->area.corner.x + iter->area.width) {
+    pos->x = iter->start_x;
+    pos->y += iter->th;
+    if (pos->y >= iter->area.corner.y + iter->area.height)
+      iter->finito = 1;
+  }
+}
+
+static int _iter_eoi(void *data, Pos pos, int channel)
+{
+  _Iter *iter = data;
+
+  return iter->finito;
+}
+
+static void *_iter_new(Filter *f, Rect *area, Eina_Array *f_source, Pos *pos, int *channel)
+{
+  _Iter *iter = calloc(sizeof(_Iter), 1);
+  _Data *data = ea_data(f->data, 0);
+  Filter *source = ea_data(f_source, 0);
+
+  iter->f = f;
+  iter->area = *area;
+  iter->tw = tw_get(source, area->corner.scale);
+  iter->th = th_get(source, area->corner.scale);
+  iter->start_x = _align_down(area->corner.x, iter->tw);
+
+  *channel = 0;
+  pos->x = iter->start_x;
+  pos->y = _align_down(area->corner.y, iter->th);
+  pos->scale = area->corner.scale;
+
+  if (data->started)
+    _finish(f);
+  if (_start(data, area, iter->th))
+    iter->finito = 1;
+
+  return iter;
+}
+
+static int _del(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+
+  _finish(f);
+  free(data);
+
+  return 0;
 }
 
 Filter *filter_savejpeg_new(void)
@@ -64,10 +500,13 @@ Filter *filter_savejpeg_new(void)
   _Data *data = calloc(sizeof(_Data), 1);
   ea_push(filter->data, data);
   
-  filter->mode_buffer = filter_mode_buffer_new();
-  filter->mode_buffer->worker = &_worker;
-  filter->mode_buffer->threadsafe = 0;
-  
+  filter->del = &_del;
+  filter->mode_iter = filter_mode_iter_new();
+  filter->mode_iter->iter_new = &_iter_new;
+  filter->mode_iter->iter_next = &_iter_next;
+  filter->mode_iter->iter_eoi = &_iter_eoi;
+  filter->mode_iter->worker = &_worker;
+  filter->mode_iter->finish = &_finish;
   bitdepth = meta_new_data(MT_BITDEPTH, filter, malloc(sizeof(int)));
   *(int*)(bitdepth->data) = BD_U8;
   
@@ -0,0 +1,569 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter_savelime.h"
+#include "limefile.h"
+
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//tile of a coarser scale assembled from four tiles of the next finer scale
+typedef struct {
+  uint8_t *buf;
+  int x, y; //tile position, -1 if empty
+} _Acc;
+
+typedef struct {
+  Meta *m_size;
+  Meta *filename;
+  Meta *bitdepth;
+  Meta *color[3];
+  int colorspace;
+  int depth16;
+  int compression;
+  Dim size;
+  FILE *file;
+  char *tmp_name; //file is written here and renamed over filename when complete
+  uint64_t pos;
+  int failed;
+  Limefile_Header header;
+  Limefile_Entry *index;
+  _Acc acc[LIMEFILE_SCALES_MAX][3];
+  uint8_t *delta;
+  uint8_t *zbuf;
+  uLong zbuf_size;
+} _Data;
+
+typedef struct {
+  Filter *f;
+  Rect area;
+  int tw;
+  int th;
+  Eina_Array *f_source;
+  int finito;
+  uint64_t counter;
+} _Iter;
+
+static int imax(int a, int b)
+{
+  if (a > b) return a;
+  return b;
+}
+
+static int _tile_bytes(_Data *data)
+{
+  return data->header.tile_width*data->header.tile_height*(data->depth16 ? 2 : 1);
+}
+
+static int _write_at_align(_Data *data, const void *buf, int len)
+{
+  static const uint8_t zeros[LIMEFILE_ALIGN];
+  int pad = (LIMEFILE_ALIGN - data->pos % LIMEFILE_ALIGN) % LIMEFILE_ALIGN;
+
+  if (pad && fwrite(zeros, 1, pad, data->file) != pad)
+    return -1;
+  data->pos += pad;
+
+  if (fwrite(buf, 1, len, data->file) != len)
+    return -1;
+  data->pos += len;
+
+  return 0;
+}
+
+//horizontal delta per row, makes smooth image content compressible
+static void _delta(_Data *data, uint8_t *buf)
+{
+  int x, y;
+  int w = data->header.tile_width;
+  uint16_t *src16 = (uint16_t*)buf, *dst16 = (uint16_t*)data->delta;
+
+  for(y=0;y<data->header.tile_height;y++)
+    if (data->depth16) {
+      dst16[y*w] = src16[y*w];
+      for(x=1;x<w;x++)
+        dst16[y*w+x] = src16[y*w+x] - src16[y*w+x-1];
+    }
+    else {
+      data->delta[y*w] = buf[y*w];
+      for(x=1;x<w;x++)
+        data->delta[y*w+x] = buf[y*w+x] - buf[y*w+x-1];
+    }
+}
+
+static void _tile_write(_Data *data, int scale, int channel, int tx, int ty, uint8_t *buf)
+{
+  Limefile_Entry *entry;
+  uLong len = _tile_bytes(data);
+  uint8_t *src = buf;
+  uint32_t compression = LIMEFILE_RAW;
+
+  if (data->failed)
+    return;
+
+  if (tx >= limefile_tiles_x(&data->header, scale) || ty >= limefile_tiles_y(&data->header, scale))
+    return;
+
+  entry = &data->index[limefile_entry_idx(&data->header, scale, tx, ty, channel)];
+
+  //keep it raw (and mappable) if deflate doesn't gain much
+  if (data->compression) {
+    uLong zlen = data->zbuf_size;
+
+    _delta(data, buf);
+    if (compress2(data->zbuf, &zlen, data->delta, len, 1) == Z_OK && zlen < len - len/8) {
+      src = data->zbuf;
+      len = zlen;
+      compression = LIMEFILE_DEFLATE;
+    }
+  }
+
+  if (_write_at_align(data, src, len)) {
+    printf("savelime: write failed for %s\n", (char*)data->filename->data);
+    data->failed = 1;
+    return;
+  }
+
+  entry->offset = data->pos - len;
+  entry->len = len;
+  entry->compression = compression;
+}
+
+//2x2 box filter of one tile into its quadrant of the parent tile
+static void _downsample(_Data *data, uint8_t *src, _Acc *acc, int tx, int ty)
+{
+  int x, y;
+  int w = data->header.tile_width;
+  int hw = w/2, hh = data->header.tile_height/2;
+  int ox = (tx & 1)*hw, oy = (ty & 1)*hh;
+  uint16_t *src16 = (uint16_t*)src, *dst16 = (uint16_t*)acc->buf;
+
+  if (data->depth16)
+    for(y=0;y<hh;y++)
+      for(x=0;x<hw;x++)
+        dst16[(y+oy)*w+x+ox] = (src16[2*y*w+2*x] + src16[2*y*w+2*x+1]
+                               + src16[(2*y+1)*w+2*x] + src16[(2*y+1)*w+2*x+1] + 2) >> 2;
+  else if (data->colorspace == CS_RGB)
+    for(y=0;y<hh;y++)
+      for(x=0;x<hw;x++)
+        acc->buf[(y+oy)*w+x+ox] = lime_l2g[(lime_g2l[src[2*y*w+2*x]] + lime_g2l[src[2*y*w+2*x+1]]
+                                           + lime_g2l[src[(2*y+1)*w+2*x]] + lime_g2l[src[(2*y+1)*w+2*x+1]] + 2) >> 2];
+  else
+    for(y=0;y<hh;y++)
+      for(x=0;x<hw;x++)
+        acc->buf[(y+oy)*w+x+ox] = (src[2*y*w+2*x] + src[2*y*w+2*x+1]
+                                  + src[(2*y+1)*w+2*x] + src[(2*y+1)*w+2*x+1] + 2) >> 2;
+}
+
+static void _acc_flush(_Data *data, int scale, int channel);
+
+//write a finished tile and propagate it into the next coarser scale
+static void _tile_add(_Data *data, int scale, int channel, int tx, int ty, uint8_t *buf)
+{
+  _Acc *acc;
+
+  _tile_write(data, scale, channel, tx, ty, buf);
+
+  if (scale+1 >= data->header.scales)
+    return;
+
+  acc = &data->acc[scale+1][channel];
+  if (acc->x != tx/2 || acc->y != ty/2) {
+    if (acc->x != -1)
+      _acc_flush(data, scale+1, channel);
+    memset(acc->buf, 0, _tile_bytes(data));
+    acc->x = tx/2;
+    acc->y = ty/2;
+  }
+
+  _downsample(data, buf, acc, tx, ty);
+}
+
+static void _acc_flush(_Data *data, int scale, int channel)
+{
+  _Acc *acc = &data->acc[scale][channel];
+  int x = acc->x, y = acc->y;
+
+  acc->x = -1;
+  acc->y = -1;
+  _tile_add(data, scale, channel, x, y, acc->buf);
+}
+
+static void _buffers_free(_Data *data)
+{
+  int i, ch;
+
+  for(i=0;i<LIMEFILE_SCALES_MAX;i++)
+    for(ch=0;ch<3;ch++) {
+      free(data->acc[i][ch].buf);
+      data->acc[i][ch].buf = NULL;
+    }
+
+  free(data->index);
+  free(data->delta);
+  free(data->zbuf);
+  data->index = NULL;
+  data->delta = NULL;
+  data->zbuf = NULL;
+}
+
+static void _worker(Filter *f, void *in, int channel, Eina_Array *out, Rect *area, int thread_id)
+{
+  Tiledata *tile = in;
+  _Data *data = ea_data(f->data, 0);
+
+  _tile_add(data, 0, channel,
+            tile->area.corner.x/data->header.tile_width,
+            tile->area.corner.y/data->header.tile_height,
+            tile->data);
+}
+
+static void _finish(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+  int i, ch;
+
+  if (!data->file)
+    return;
+
+  for(i=1;i<data->header.scales;i++)
+    for(ch=0;ch<3;ch++)
+      if (data->acc[i][ch].x != -1)
+        _acc_flush(data, i, ch);
+
+  if (!data->failed) {
+    if (_write_at_align(data, data->index, limefile_entry_count(&data->header)*sizeof(Limefile_Entry)))
+      data->failed = 1;
+    data->header.index_offset = data->pos - limefile_entry_count(&data->header)*sizeof(Limefile_Entry);
+  }
+
+  //the header goes last, interrupted writes don't leave valid files
+  if (!data->failed && (fseek(data->file, 0, SEEK_SET) || fwrite(&data->header, sizeof(Limefile_Header), 1, data->file) != 1))
+    data->failed = 1;
+
+  if (fclose(data->file))
+    data->failed = 1;
+  data->file = NULL;
+
+  //a reader mapping the old file keeps its inode, rewriting it in place would fault the reader
+  if (!data->failed && rename(data->tmp_name, data->filename->data))
+    data->failed = 1;
+  if (data->failed) {
+    unlink(data->tmp_name);
+    printf("savelime: could not write %s\n", (char*)data->filename->data);
+  }
+  free(data->tmp_name);
+  data->tmp_name = NULL;
+
+  _buffers_free(data);
+}
+
+//an unfinished file, e.g. after an interrupted render
+static void _file_abort(_Data *data)
+{
+  if (!data->file)
+    return;
+
+  fclose(data->file);
+  data->file = NULL;
+  unlink(data->tmp_name);
+  free(data->tmp_name);
+  data->tmp_name = NULL;
+}
+
+static void _pos_from_counter(uint64_t counter, int *x, int *y)
+{
+  int pos = 1;
+  *x = 0;
+  *y = 0;
+
+  while (counter) {
+    if (counter % 2)
+      *x = *x + pos;
+    counter /= 2;
+    if (counter % 2)
+      *y = *y + pos;
+    pos *= 2;
+    counter /= 2;
+  }
+}
+
+//z-order, so four tiles of a scale finish one tile of the next scale
+static void _iter_next(void *data, Pos *pos, int *channel)
+{
+  _Iter *iter = data;
+
+  (*channel)++;
+  if (*channel < 3)
+    return;
+
+  *channel = 0;
+
+  while (1) {
+    iter->counter++;
+    _pos_from_counter(iter->counter, &pos->x, &pos->y);
+
+    pos->x *= iter->tw;
+    pos->y *= iter->th;
+
+    if (pos->x >= iter->area.width && pos->y >= iter->area.height) {
+      iter->finito = 1;
+      break;
+    }
+
+    if (pos->x < iter->area.width && pos->y < iter->area.height)
+      break;
+  }
+}
+
+static int _iter_eoi(void *data, Pos pos, int channel)
+{
+  _Iter *iter = data;
+
+  return iter->finito;
+}
+
+static void *_iter_new(Filter *f, Rect *area, Eina_Array *f_source, Pos *pos, int *channel)
+{
+  _Iter *iter = calloc(sizeof(_Iter), 1);
+  _Data *data = ea_data(f->data, 0);
+  Limefile_Header *h = &data->header;
+  int i, ch, size, len;
+
+  iter->f = f;
+  iter->f_source = f_source;
+  iter->area.width = data->size.width;
+  iter->area.height = data->size.height;
+  iter->tw = tw_get(ea_data(f_source, 0), 0);
+  iter->th = th_get(ea_data(f_source, 0), 0);
+
+  *channel = 0;
+  pos->x = 0;
+  pos->y = 0;
+  pos->scale = 0;
+
+  _buffers_free(data);
+
+  h->tile_width = iter->tw;
+  h->tile_height = iter->th;
+
+  size = imax(data->size.width, data->size.height);
+  for(h->scales=1;h->scales<LIMEFILE_SCALES_MAX && (size >> (h->scales-1)) > imax(iter->tw, iter->th);h->scales++);
+
+  len = _tile_bytes(data);
+  data->index = calloc(limefile_entry_count(h), sizeof(Limefile_Entry));
+  for(i=0;i<LIMEFILE_SCALES_MAX;i++)
+    for(ch=0;ch<3;ch++) {
+      data->acc[i][ch].x = -1;
+      data->acc[i][ch].y = -1;
+      if (i && i < h->scales)
+        data->acc[i][ch].buf = malloc(len);
+    }
+
+  if (data->compression) {
+    data->delta = malloc(len);
+    data->zbuf_size = compressBound(len);
+    data->zbuf = malloc(data->zbuf_size);
+  }
+
+  return iter;
+}
+
+static int _input_fixed(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+  Limefile_Header *h = &data->header;
+  Limefile_Header empty;
+  int i, fd;
+
+  _file_abort(data);
+
+  data->tmp_name = malloc(strlen(data->filename->data)+8);
+  sprintf(data->tmp_name, "%s.XXXXXX", (char*)data->filename->data);
+  fd = mkstemp(data->tmp_name);
+  if (fd != -1) {
+    fchmod(fd, 0644);
+    data->file = fdopen(fd, "wb");
+    if (!data->file)
+      close(fd);
+  }
+  if (!data->file) {
+    if (fd != -1)
+      unlink(data->tmp_name);
+    free(data->tmp_name);
+    data->tmp_name = NULL;
+    return -1;
+  }
+
+  data->size = *(Dim*)data->m_size->data;
+  data->failed = 0;
+
+  memset(h, 0, sizeof(Limefile_Header));
+  memcpy(h->magic, LIMEFILE_MAGIC, sizeof(LIMEFILE_MAGIC));
+  h->version = LIMEFILE_VERSION;
+  h->width = data->size.width;
+  h->height = data->size.height;
+  h->channels = 3;
+  h->bitdepth = data->depth16 ? BD_U16 : BD_U8;
+  h->layout = LIMEFILE_PLANAR;
+  for(i=0;i<3;i++)
+    h->colors[i] = *(int*)data->color[i]->data;
+
+  //zeroed placeholder, the real header is written by _finish
+  memset(&empty, 0, sizeof(Limefile_Header));
+  if (fwrite(&empty, sizeof(Limefile_Header), 1, data->file) != 1) {
+    _file_abort(data);
+    return -1;
+  }
+  data->pos = sizeof(Limefile_Header);
+
+  return 0;
+}
+
+static int _setting_changed(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+
+  switch (data->colorspace) {
+    case CS_RGB :
+      *(int*)(data->color[0]->data) = CS_RGB_R;
+      *(int*)(data->color[1]->data) = CS_RGB_G;
+      *(int*)(data->color[2]->data) = CS_RGB_B;
+      break;
+    case CS_LAB :
+      *(int*)(data->color[0]->data) = CS_LAB_L;
+      *(int*)(data->color[1]->data) = CS_LAB_A;
+      *(int*)(data->color[2]->data) = CS_LAB_B;
+      break;
+    default :
+      abort();
+  }
+
+  *(int*)(data->bitdepth->data) = data->depth16 ? BD_U16 : BD_U8;
+
+  return 0;
+}
+
+static int _del(Filter *f)
+{
+  _Data *data = ea_data(f->data, 0);
+
+  _file_abort(data);
+  _buffers_free(data);
+  free(data);
+
+  return 0;
+}
+
+static void _setting_add(Filter *filter, const char *name, int *val, int max)
+{
+  Meta *setting, *bound;
+
+  setting = meta_new_data(MT_INT, filter, val);
+  meta_name_set(setting, name);
+  eina_array_push(filter->settings, setting);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = 0;
+  meta_name_set(bound, "PARENT_SETTING_MIN");
+  meta_attach(setting, bound);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = max;
+  meta_name_set(bound, "PARENT_SETTING_MAX");
+  meta_attach(setting, bound);
+}
+
+Filter *filter_savelime_new(void)
+{
+  Filter *filter = filter_new(&filter_core_savelime);
+  Meta *in, *channel, *bitdepth, *size, *fliprot;
+  _Data *data = calloc(sizeof(_Data), 1);
+  data->colorspace = CS_RGB;
+  data->compression = 1;
+  ea_push(filter->data, data);
+
+  filter->mode_iter = filter_mode_iter_new();
+  filter->mode_iter->iter_new = &_iter_new;
+  filter->mode_iter->iter_next = &_iter_next;
+  filter->mode_iter->iter_eoi = &_iter_eoi;
+  filter->mode_iter->worker = &_worker;
+  filter->mode_iter->finish = &_finish;
+
+  filter->del = &_del;
+  filter->input_fixed = &_input_fixed;
+  filter->setting_changed = &_setting_changed;
+
+  bitdepth = meta_new_data(MT_BITDEPTH, filter, malloc(sizeof(int)));
+  *(int*)(bitdepth->data) = BD_U8;
+  data->bitdepth = bitdepth;
+
+  size = meta_new(MT_IMGSIZE, filter);
+  ea_push(filter->core, size);
+  data->m_size = size;
+
+  in = meta_new(MT_BUNDLE, filter);
+  eina_array_push(filter->in, in);
+
+  fliprot = meta_new_data(MT_FLIPROT, filter, malloc(sizeof(int)));
+  *(int*)fliprot->data = 1;
+  meta_attach(in, fliprot);
+
+  channel = meta_new_channel(filter, 1);
+  data->color[0] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[0]->data) = CS_RGB_R;
+  meta_attach(channel, data->color[0]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, size);
+  meta_attach(in, channel);
+
+  channel = meta_new_channel(filter, 2);
+  data->color[1] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[1]->data) = CS_RGB_G;
+  meta_attach(channel, data->color[1]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, size);
+  meta_attach(in, channel);
+
+  channel = meta_new_channel(filter, 3);
+  data->color[2] = meta_new_data(MT_COLOR, filter, malloc(sizeof(int)));
+  *(int*)(data->color[2]->data) = CS_RGB_B;
+  meta_attach(channel, data->color[2]);
+  meta_attach(channel, bitdepth);
+  meta_attach(channel, size);
+  meta_attach(in, channel);
+
+  _setting_add(filter, "colorspace", &data->colorspace, 1);
+  _setting_add(filter, "16bit", &data->depth16, 1);
+  _setting_add(filter, "compression", &data->compression, 1);
+
+  data->filename = meta_new(MT_STRING, filter);
+  meta_name_set(data->filename, "filename");
+  eina_array_push(filter->settings, data->filename);
+
+  return filter;
+}
+
+Filter_Core filter_core_savelime = {
+  "Lime pyramid saver",
+  "savelime",
+  "Saves image to a memory-mappable tiled pyramid file",
+  &filter_savelime_new
+};
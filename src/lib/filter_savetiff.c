@@ -18,13 +18,42 @@
  */
 
 #include "filter_savetiff.h"
+#include "encode_pool.h"
 #include "tiffio.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <jpeglib.h>
+
+enum {
+  SAVETIFF_NONE = 0,
+  SAVETIFF_DEFLATE,
+  SAVETIFF_JPEG
+};
+
+#define SLOTS_PER_THREAD 4
+
+#define IF_FREE(X) if (X) {free(X); X = NULL;}
+
+typedef struct {
+  uint8_t *raw; //256x256 input tile
+  uint8_t *enc;
+  unsigned long enc_size;
+  unsigned long len;
+  uint32_t tile; //tiff tile index
+} _Slot;
+
 typedef struct {
   Meta *m_size;
   Dim size;
   TIFF* file;
+  int tmp; //tiles of the smaller scales, appended on finish
   int scales;
+  uint64_t bytes; //size of the smaller scales and the full scale, uncompressed
+  int *scale_w;
+  int *scale_h;
+  off_t *scale_pos; //start of each scale in tmp
   uint32_t **scale_sums;
   uint64_t counter;
   uint8_t *buf;
@@ -32,6 +61,10 @@ typedef struct {
   int *y_pos;
   Meta *color[3];
   int colorspace;
+  int compression;
+  int quality;
+  //tiles are encoded by the pool and committed in submission order
+  Encode_Pool *pool;
   Meta *filename;
 } _Data;
 
@@ -46,6 +79,316 @@ typedef struct {
   uint64_t counter;
 } _Iter;
 
+//horizontal differencing, tiff predictor 2 for 8 bit samples
+static void _predict(uint8_t *buf)
+{
+  int x, y;
+
+  for(y=0;y<256;y++)
+    for(x=255;x>0;x--)
+      buf[y*256+x] -= buf[y*256+x-1];
+}
+
+static void _encode_jpeg(_Data *data, struct jpeg_compress_struct *cinfo, _Slot *slot)
+{
+  JSAMPROW row_pointer[1];
+  unsigned char *out = slot->enc;
+  unsigned long size = slot->enc_size;
+
+  jpeg_mem_dest(cinfo, &out, &size);
+  cinfo->image_width = 256;
+  cinfo->image_height = 256;
+  cinfo->input_components = 1;
+  cinfo->in_color_space = JCS_GRAYSCALE;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, data->quality, TRUE);
+  jpeg_start_compress(cinfo, TRUE);
+  while (cinfo->next_scanline < cinfo->image_height) {
+    row_pointer[0] = slot->raw + cinfo->next_scanline*256;
+    jpeg_write_scanlines(cinfo, row_pointer, 1);
+  }
+  jpeg_finish_compress(cinfo);
+
+  //libjpeg allocates a larger buffer if ours was too small
+  if (out != slot->enc) {
+    free(slot->enc);
+    slot->enc = out;
+    slot->enc_size = size;
+  }
+  slot->len = size;
+}
+
+/*
+ * zlib stream of stored (uncompressed) blocks, needs no allocation so it
+ * can't fail where compress2() did, a tile is 2 blocks of 32KiB
+ */
+static void _deflate_stored(_Slot *slot)
+{
+  uint8_t *p = slot->enc;
+  uLong adler = adler32(0L, Z_NULL, 0);
+  int i, len = 256*256/2;
+
+  *p++ = 0x78;
+  *p++ = 0x01;
+  for(i=0;i<2;i++) {
+    *p++ = i; //BFINAL on the last block
+    *p++ = len & 0xFF;
+    *p++ = len >> 8;
+    *p++ = ~len & 0xFF;
+    *p++ = (~len >> 8) & 0xFF;
+    memcpy(p, slot->raw + i*len, len);
+    p += len;
+  }
+  adler = adler32(adler, slot->raw, 256*256);
+  *p++ = adler >> 24;
+  *p++ = (adler >> 16) & 0xFF;
+  *p++ = (adler >> 8) & 0xFF;
+  *p++ = adler & 0xFF;
+
+  slot->len = p - slot->enc;
+}
+
+static int _encode(void *data, void *thread, void *slot_ptr)
+{
+  _Data *fdata = data;
+  _Slot *slot = slot_ptr;
+
+  switch (fdata->compression) {
+    case SAVETIFF_DEFLATE :
+      _predict(slot->raw);
+      slot->len = slot->enc_size;
+      if (compress2(slot->enc, &slot->len, slot->raw, 256*256, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        printf("savetiff: deflate failed, storing tile %u uncompressed\n", slot->tile);
+        _deflate_stored(slot);
+      }
+      break;
+    case SAVETIFF_JPEG :
+      _encode_jpeg(fdata, thread, slot);
+      break;
+    default :
+      slot->len = 256*256;
+  }
+
+  return 0;
+}
+
+static void _commit(void *data, void *slot_ptr, int failed)
+{
+  _Data *fdata = data;
+  _Slot *slot = slot_ptr;
+  uint8_t *buf = fdata->compression == SAVETIFF_NONE ? slot->raw : slot->enc;
+
+  if (TIFFWriteRawTile(fdata->file, slot->tile, buf, slot->len) == -1)
+    printf("savetiff: failed to write tile %u\n", slot->tile);
+}
+
+static void _slot_init(void *data, void *slot_ptr)
+{
+  _Slot *slot = slot_ptr;
+
+  slot->raw = malloc(256*256);
+  if (((_Data*)data)->compression != SAVETIFF_NONE) {
+    slot->enc_size = compressBound(256*256);
+    slot->enc = malloc(slot->enc_size);
+  }
+}
+
+static void _slot_del(void *data, void *slot_ptr)
+{
+  _Slot *slot = slot_ptr;
+
+  free(slot->raw);
+  free(slot->enc);
+}
+
+static void *_thread_new(void *data)
+{
+  struct jpeg_compress_struct *cinfo = calloc(sizeof(struct jpeg_compress_struct), 1);
+  struct jpeg_error_mgr *jerr = calloc(sizeof(struct jpeg_error_mgr), 1);
+
+  cinfo->err = jpeg_std_error(jerr);
+  jpeg_create_compress(cinfo);
+
+  return cinfo;
+}
+
+static void _thread_del(void *data, void *thread)
+{
+  struct jpeg_compress_struct *cinfo = thread;
+  struct jpeg_error_mgr *jerr = cinfo->err;
+
+  jpeg_destroy_compress(cinfo);
+  free(jerr);
+  free(cinfo);
+}
+
+static const Encode_Pool_Funcs _pool_funcs = {
+  &_slot_init,
+  &_slot_del,
+  &_thread_new,
+  &_thread_del,
+  &_encode,
+  &_commit
+};
+
+//copies buf, blocks while all slots are in use
+static void _pool_submit(Encode_Pool *pool, uint8_t *buf, uint32_t tile)
+{
+  _Slot *slot = encode_pool_slot_get(pool);
+
+  memcpy(slot->raw, buf, 256*256);
+  slot->tile = tile;
+  encode_pool_submit(pool);
+}
+
+static int _tiles_x(_Data *data, int scale)
+{
+  return (data->scale_w[scale]+255)/256;
+}
+
+static int _tiles_y(_Data *data, int scale)
+{
+  return (data->scale_h[scale]+255)/256;
+}
+
+//tiff tile index, planes are stored one after the other
+static uint32_t _tile_idx(_Data *data, int scale, int x, int y, int channel)
+{
+  return ((uint32_t)channel*_tiles_y(data, scale) + y/256)*_tiles_x(data, scale) + x/256;
+}
+
+static off_t _tmp_pos(_Data *data, int scale, int x, int y, int channel)
+{
+  return data->scale_pos[scale] + (off_t)_tile_idx(data, scale, x, y, channel)*256*256;
+}
+
+/*
+ * the full scale goes to the encoder pool in the order the tiles arrive,
+ * the smaller scales are collected uncompressed in a temporary file and
+ * appended on finish, so every directory is written exactly once
+ */
+static void _tile_write(_Data *data, int scale, int x, int y, int channel, uint8_t *buf)
+{
+  if (!scale)
+    _pool_submit(data->pool, buf, _tile_idx(data, 0, x, y, channel));
+  else if (pwrite(data->tmp, buf, 256*256, _tmp_pos(data, scale, x, y, channel)) != 256*256)
+    printf("savetiff: failed to write temporary tile at %dx%d scale %d\n", x, y, scale);
+}
+
+static void _dir_setup(_Data *data, int scale)
+{
+  if (scale)
+    TIFFSetField(data->file, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+  TIFFSetField(data->file, TIFFTAG_IMAGEWIDTH, data->scale_w[scale]);
+  TIFFSetField(data->file, TIFFTAG_IMAGELENGTH, data->scale_h[scale]);
+  TIFFSetField(data->file, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(data->file, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(data->file, TIFFTAG_TILEWIDTH, 256);
+  TIFFSetField(data->file, TIFFTAG_TILELENGTH, 256);
+  TIFFSetField(data->file, TIFFTAG_PLANARCONFIG, PLANARCONFIG_SEPARATE);
+  switch (data->colorspace) {
+    case CS_RGB :
+      TIFFSetField(data->file, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+      break;
+    case CS_LAB : 
+      TIFFSetField(data->file, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_CIELAB);
+      break;
+  }
+  switch (data->compression) {
+    case SAVETIFF_DEFLATE :
+      TIFFSetField(data->file, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+      TIFFSetField(data->file, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+      break;
+    //every tile is a complete single component jpeg stream
+    case SAVETIFF_JPEG :
+      TIFFSetField(data->file, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
+      break;
+  }
+}
+
+//also drops the output of a render which did not reach finish
+static void _release(_Data *data)
+{
+  if (data->pool)
+    encode_pool_del(data->pool);
+  data->pool = NULL;
+  if (data->file)
+    TIFFClose(data->file);
+  data->file = NULL;
+  if (data->tmp != -1)
+    close(data->tmp);
+  data->tmp = -1;
+}
+
+//opened per render so a reconfigured filter doesn't hold (or leak) the old file
+static int _start(_Data *data)
+{
+  char *tmp_name;
+  
+  //tile data plus generous room for the tile offset tables
+  if (data->bytes + data->bytes/64 + (1u << 20) > UINT32_MAX)
+    data->file = TIFFOpen(data->filename->data, "w8");
+  else
+    data->file = TIFFOpen(data->filename->data, "w");
+  if (!data->file) {
+    printf("savetiff: could not open %s\n", (char*)data->filename->data);
+    return -1;
+  }
+  
+  //next to the output, the smaller scales are a third of the image
+  tmp_name = malloc(strlen(data->filename->data)+8);
+  sprintf(tmp_name, "%s.XXXXXX", (char*)data->filename->data);
+  data->tmp = mkstemp(tmp_name);
+  if (data->tmp != -1)
+    unlink(tmp_name);
+  free(tmp_name);
+  if (data->tmp == -1) {
+    printf("savetiff: could not create a temporary file next to %s\n", (char*)data->filename->data);
+    _release(data);
+    return -1;
+  }
+  
+  data->pool = encode_pool_new(0, SLOTS_PER_THREAD, sizeof(_Slot), &_pool_funcs, data);
+  if (!data->pool) {
+    _release(data);
+    return -1;
+  }
+  
+  memset(data->x_pos, 0, sizeof(int)*data->scales);
+  memset(data->y_pos, 0, sizeof(int)*data->scales);
+  _dir_setup(data, 0);
+  
+  return 0;
+}
+
+//full scale directory, then the smaller scales copied from tmp in tile order
+static void _pyramid_finish(_Data *data)
+{
+  int scale, channel, x, y;
+  ssize_t len;
+
+  encode_pool_drain(data->pool);
+  if (!TIFFWriteDirectory(data->file))
+    printf("savetiff: failed to write directory\n");
+
+  for(scale=1;scale<data->scales;scale++) {
+    _dir_setup(data, scale);
+    for(channel=0;channel<3;channel++)
+      for(y=0;y<_tiles_y(data, scale);y++)
+        for(x=0;x<_tiles_x(data, scale);x++) {
+          len = pread(data->tmp, data->buf, 256*256, _tmp_pos(data, scale, x*256, y*256, channel));
+          if (len < 256*256)
+            memset(data->buf + (len > 0 ? len : 0), 0, 256*256 - (len > 0 ? len : 0));
+          _pool_submit(data->pool, data->buf, _tile_idx(data, scale, x*256, y*256, channel));
+        }
+    encode_pool_drain(data->pool);
+    if (!TIFFWriteDirectory(data->file))
+      printf("savetiff: failed to write directory\n");
+  }
+
+  _release(data);
+}
+
 void _worker_gamma(Filter *f, void *in, int channel, Eina_Array *out, Rect *area, int thread_id)
 {
    uint32_t xc, yc;
@@ -54,12 +397,12 @@ void _worker_gamma(Filter *f, void *in, int channel, Eina_Array *out, Rect *area
    int x, y, sx, sy, ox, oy;
    Tiledata *tile = in;
    _Data *data = ea_data(f->data, 0);
-   int written;
 
-   assert(TIFFSetDirectory(data->file, 0));
-   written = TIFFWriteTile(data->file, tile->data, tile->area.corner.x, tile->area.corner.y, 0, channel);
-   assert(written == 256*256);
-   assert(TIFFRewriteDirectory(data->file));
+   //the output could not be opened
+   if (!data->pool)
+     return;
+   
+   _tile_write(data, 0, tile->area.corner.x, tile->area.corner.y, channel, tile->data);
    
    for(counter=data->counter, scale=1; scale<data->scales; counter/=4,scale++) {
       xc = tile->area.corner.x;
@@ -74,10 +417,7 @@ void _worker_gamma(Filter *f, void *in, int channel, Eina_Array *out, Rect *area
 	    for(x=0;x<256;x++)
 	       data->buf[y*256+x] = lime_l2g[((data->scale_sums[(scale-1)*3+channel])[y*256+x] + (1u<<(2*scale-1))) >> (scale*2)];
 	    
-	    assert(TIFFSetDirectory(data->file, scale));
-	 written = TIFFWriteTile(data->file, data->buf, data->x_pos[scale-1], data->y_pos[scale-1], 0, channel);
-	 assert(written == 256*256);
-	 assert(TIFFRewriteDirectory(data->file));
+	 _tile_write(data, scale, data->x_pos[scale-1], data->y_pos[scale-1], channel, data->buf);
 	 
 	 if (data->x_pos[scale-1] % 512) ox = 128;
 	 else ox = 0;
@@ -133,12 +473,12 @@ void _worker_linear(Filter *f, void *in, int channel, Eina_Array *out, Rect *are
    int x, y, sx, sy, ox, oy;
    Tiledata *tile = in;
    _Data *data = ea_data(f->data, 0);
-   int written;
 
-   assert(TIFFSetDirectory(data->file, 0));
-   written = TIFFWriteTile(data->file, tile->data, tile->area.corner.x, tile->area.corner.y, 0, channel);
-   assert(written == 256*256);
-   assert(TIFFRewriteDirectory(data->file));
+   //the output could not be opened
+   if (!data->pool)
+     return;
+   
+   _tile_write(data, 0, tile->area.corner.x, tile->area.corner.y, channel, tile->data);
    
    for(counter=data->counter, scale=1; scale<data->scales; counter/=4,scale++) {
       xc = tile->area.corner.x;
@@ -153,10 +493,7 @@ void _worker_linear(Filter *f, void *in, int channel, Eina_Array *out, Rect *are
 	    for(x=0;x<256;x++)
 	       data->buf[y*256+x] = ((data->scale_sums[(scale-1)*3+channel])[y*256+x] + (1u<<(2*scale-1))) >> (scale*2);
 	    
-	    assert(TIFFSetDirectory(data->file, scale));
-	 written = TIFFWriteTile(data->file, data->buf, data->x_pos[scale-1], data->y_pos[scale-1], 0, channel);
-	 assert(written == 256*256);
-	 assert(TIFFRewriteDirectory(data->file));
+	 _tile_write(data, scale, data->x_pos[scale-1], data->y_pos[scale-1], channel, data->buf);
 	 
 	 if (data->x_pos[scale-1] % 512) ox = 128;
 	 else ox = 0;
@@ -204,19 +541,40 @@ void _worker_linear(Filter *f, void *in, int channel, Eina_Array *out, Rect *are
       
 }
 
-//TODO open file, get image dimensions etc
+static void _scales_free(_Data *data)
+{
+  int i;
+  
+  if (data->scale_sums)
+    for(i=0;i<data->scales*3;i++)
+      free(data->scale_sums[i]);
+  IF_FREE(data->scale_sums)
+  IF_FREE(data->x_pos)
+  IF_FREE(data->y_pos)
+  IF_FREE(data->scale_w)
+  IF_FREE(data->scale_h)
+  IF_FREE(data->scale_pos)
+  IF_FREE(data->buf)
+}
+
 int _input_fixed(Filter *f)
 {
   _Data *data = ea_data(f->data, 0);
-  int size, w, h;
+  int size;
   int i;
-
-  // Open the TIFF file
-  if((data->file = TIFFOpen(data->filename->data, "w")) == NULL)
-    return -1;
+  
+  //called again on every reconfiguration
+  _release(data);
+  _scales_free(data);
   
   data->size = *(Dim*)data->m_size->data;
   
+  //tiff jpeg is only defined for rgb, ycbcr and gray data
+  if (data->compression == SAVETIFF_JPEG && data->colorspace == CS_LAB) {
+    printf("savetiff: jpeg compression needs colorspace rgb\n");
+    return -1;
+  }
+  
   size = data->size.width;
   if (data->size.height > size)
      size = data->size.height;
@@ -229,41 +587,31 @@ int _input_fixed(Filter *f)
    
    if (data->scales > 8)
       data->scales = 8;
+   //the full scale directory is always needed
+   if (!data->scales)
+      data->scales = 1;
   
   data->scale_sums = calloc(sizeof(uint32_t*)*data->scales*3, 1);
   data->x_pos = calloc(sizeof(int)*data->scales, 1);
   data->y_pos = calloc(sizeof(int)*data->scales, 1);
-  w = data->size.width;
-  h = data->size.height;
+  data->scale_w = calloc(sizeof(int)*data->scales, 1);
+  data->scale_h = calloc(sizeof(int)*data->scales, 1);
+  data->scale_pos = calloc(sizeof(off_t)*data->scales, 1);
+  data->bytes = 0;
+  data->scale_w[0] = data->size.width;
+  data->scale_h[0] = data->size.height;
   
   for(i=0;i<data->scales;i++) {
      data->scale_sums[i*3] = malloc(sizeof(uint32_t)*256*256);
      data->scale_sums[i*3+1] = malloc(sizeof(uint32_t)*256*256);
      data->scale_sums[i*3+2] = malloc(sizeof(uint32_t)*256*256);
      
-     TIFFSetField(data->file, TIFFTAG_IMAGEWIDTH, w);
-     TIFFSetField(data->file, TIFFTAG_IMAGELENGTH, h);
-     TIFFSetField(data->file, TIFFTAG_BITSPERSAMPLE, 8);
-     TIFFSetField(data->file, TIFFTAG_SAMPLESPERPIXEL, 3);
-     TIFFSetField(data->file, TIFFTAG_TILEWIDTH, 256);
-     TIFFSetField(data->file, TIFFTAG_TILELENGTH, 256);
-     TIFFSetField(data->file, TIFFTAG_PLANARCONFIG, PLANARCONFIG_SEPARATE);
-     switch (data->colorspace) {
-       case CS_RGB :
-	 TIFFSetField(data->file, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-	 break;
-       case CS_LAB : 
-	 TIFFSetField(data->file, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_CIELAB);
-	 break;
+     if (i) {
+       data->scale_w[i] = (data->scale_w[i-1]+1)/2;
+       data->scale_h[i] = (data->scale_h[i-1]+1)/2;
+       data->scale_pos[i] = data->bytes;
      }
-     //TIFFSetField(data->file, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
-     //TIFFSetField(data->file, TIFFTAG_JPEGQUALITY, 85);
-     
-     TIFFCheckpointDirectory(data->file);
-     TIFFWriteDirectory(data->file);
-     
-     w = (w+1)/2;
-     h = (h+1)/2;
+     data->bytes += (uint64_t)_tiles_x(data, i)*_tiles_y(data, i)*3*256*256;
   }
   
   data->buf = malloc(256*256);
@@ -278,8 +626,10 @@ void _finish_gamma(Filter *f)
    int x, y, ox, oy;
    int sx, sy;
    int channel;
-   int written;
   _Data *data = ea_data(f->data, 0);
+  
+  if (!data->pool)
+    return;
 
   for(channel=0;channel<3;channel++)
    for(scale=1; scale<data->scales; scale++) {
@@ -287,10 +637,7 @@ void _finish_gamma(Filter *f)
 	       for(x=0;x<256;x++)
 		  data->buf[y*256+x] = lime_l2g[((data->scale_sums[(scale-1)*3+channel])[y*256+x]+(1u<<(2*scale-1))) >> (scale*2)];
 	       
-	       assert(TIFFSetDirectory(data->file, scale));
-	       written = TIFFWriteTile(data->file, data->buf, data->x_pos[scale-1], data->y_pos[scale-1], 0, channel);
-	       assert(written == 256*256);
-	       assert(TIFFRewriteDirectory(data->file));
+	       _tile_write(data, scale, data->x_pos[scale-1], data->y_pos[scale-1], channel, data->buf);
 
 	       if (data->x_pos[scale-1] % 512) ox = 128;
 	       else ox = 0;
@@ -306,7 +653,7 @@ void _finish_gamma(Filter *f)
 		  }   
    }
   
-  TIFFClose(data->file);
+  _pyramid_finish(data);
 }
 
 void _finish_linear(Filter *f)
@@ -315,8 +662,10 @@ void _finish_linear(Filter *f)
    int x, y, ox, oy;
    int sx, sy;
    int channel;
-   int written;
   _Data *data = ea_data(f->data, 0);
+  
+  if (!data->pool)
+    return;
 
   for(channel=0;channel<3;channel++)
    for(scale=1; scale<data->scales; scale++) {
@@ -324,10 +673,7 @@ void _finish_linear(Filter *f)
 	       for(x=0;x<256;x++)
 		  data->buf[y*256+x] = ((data->scale_sums[(scale-1)*3+channel])[y*256+x]+(1u<<(2*scale-1))) >> (scale*2);
 	       
-	       assert(TIFFSetDirectory(data->file, scale));
-	       written = TIFFWriteTile(data->file, data->buf, data->x_pos[scale-1], data->y_pos[scale-1], 0, channel);
-	       assert(written == 256*256);
-	       assert(TIFFRewriteDirectory(data->file));
+	       _tile_write(data, scale, data->x_pos[scale-1], data->y_pos[scale-1], channel, data->buf);
 
 	       if (data->x_pos[scale-1] % 512) ox = 128;
 	       else ox = 0;
@@ -343,7 +689,7 @@ void _finish_linear(Filter *f)
 		  }  
    }
   
-  TIFFClose(data->file);
+  _pyramid_finish(data);
 }
 
 void pos_from_counter(uint64_t counter, int *x, int *y)
@@ -428,6 +774,11 @@ void *_iter_new(Filter *f, Rect *area, Eina_Array *f_source, Pos *pos, int *chan
   iter->counter = 0;
   data->counter = 0;
   
+  //a previous render which never finished still holds its output
+  _release(data);
+  if (_start(data))
+    iter->finito = 1;
+  
   //FIXME calc pos!
   pos->x = iter->area.corner.x;
   pos->y = iter->area.corner.y;
@@ -463,12 +814,34 @@ static int _setting_changed(Filter *f)
   return 0;
 }
 
+static void _setting_add(Filter *filter, const char *name, int *val, int min, int max)
+{
+  Meta *setting, *bound;
+
+  setting = meta_new_data(MT_INT, filter, val);
+  meta_name_set(setting, name);
+  eina_array_push(filter->settings, setting);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = min;
+  meta_name_set(bound, "PARENT_SETTING_MIN");
+  meta_attach(setting, bound);
+
+  bound = meta_new_data(MT_INT, filter, malloc(sizeof(int)));
+  *(int*)bound->data = max;
+  meta_name_set(bound, "PARENT_SETTING_MAX");
+  meta_attach(setting, bound);
+}
+
 Filter *filter_savetiff_new(void)
 {
   Filter *filter = filter_new(&filter_core_savetiff);
   Meta *in, *channel, *bitdepth, *size, *setting, *bound, *fliprot;
   _Data *data = calloc(sizeof(_Data), 1);
   data->colorspace = CS_LAB;
+  data->compression = SAVETIFF_NONE;
+  data->quality = 90;
+  data->tmp = -1;
   ea_push(filter->data, data);
   
   filter->mode_iter = filter_mode_iter_new();
@@ -537,6 +910,11 @@ Filter *filter_savetiff_new(void)
   meta_name_set(data->filename, "filename");
   eina_array_push(filter->settings, data->filename);
   
+  //after the filename, so positional "savetiff=0,out.tif" keeps working
+  //compression 0: none, 1: deflate, 2: jpeg
+  _setting_add(filter, "compression", &data->compression, SAVETIFF_NONE, SAVETIFF_JPEG);
+  _setting_add(filter, "quality", &data->quality, 1, 100);
+  
   return filter;
 }
 
@@ -171,6 +171,7 @@ Filter *filter_sharpen_new(void)
   
   setting = meta_new_data(MT_FLOAT, filter, &data->val);
   meta_name_set(setting, "strength");
+  meta_flag_set(setting, MT_FLAG_SETTING_NOCONFIG);
   eina_array_push(filter->settings, setting);
   
   return filter;
@@ -29,6 +29,8 @@ Eina_Hash *lime_filters;
 #include "filter_loadtiff.h"
 #include "filter_load.h"
 #include "filter_savetiff.h"
+#include "filter_loadlime.h"
+#include "filter_savelime.h"
 #include "filter_comparator.h"
 #include "filter_sharpen.h"
 #include "filter_denoise.h"
@@ -37,6 +39,7 @@ Eina_Hash *lime_filters;
 #include "filter_simplerotate.h"
 #include "filter_interleave.h"
 #include "filter_savejpeg.h"
+#include "filter_savedzi.h"
 #include "filter_rotate.h"
 #include "filter_curves.h"
 //#include "filter_lrdeconv.h"
@@ -59,6 +62,8 @@ void lime_filters_init(void)
   eina_hash_add(lime_filters, filter_core_exposure.shortname, &filter_core_exposure);
   eina_hash_add(lime_filters, filter_core_load.shortname, &filter_core_load);
   eina_hash_add(lime_filters, filter_core_savetiff.shortname, &filter_core_savetiff);
+  eina_hash_add(lime_filters, filter_core_loadlime.shortname, &filter_core_loadlime);
+  eina_hash_add(lime_filters, filter_core_savelime.shortname, &filter_core_savelime);
   eina_hash_add(lime_filters, filter_core_sharpen.shortname, &filter_core_sharpen);
   eina_hash_add(lime_filters, filter_core_denoise.shortname, &filter_core_denoise);
   eina_hash_add(lime_filters, filter_core_pretend.shortname, &filter_core_pretend);
@@ -66,6 +71,7 @@ void lime_filters_init(void)
   eina_hash_add(lime_filters, filter_core_simplerotate.shortname, &filter_core_simplerotate);
   eina_hash_add(lime_filters, filter_core_rotate.shortname, &filter_core_rotate);
   eina_hash_add(lime_filters, filter_core_savejpeg.shortname, &filter_core_savejpeg);
+  eina_hash_add(lime_filters, filter_core_savedzi.shortname, &filter_core_savedzi);
   eina_hash_add(lime_filters, filter_core_curves.shortname, &filter_core_curves);
   //eina_hash_add(lime_filters, filter_core_lrdeconv.shortname, &filter_core_lrdeconv);
   eina_hash_add(lime_filters, filter_core_lensfun.shortname, &filter_core_lensfun);
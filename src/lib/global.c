@@ -24,6 +24,8 @@
 #include <math.h>
 
 #include "filters.h"
+#include "render.h"
+#include "exif_helpers.h"
 
 static int inits = 0;
 
@@ -51,6 +53,8 @@ int lime_init(void)
     abort();
   
   eina_init();
+  //filter graphs may be configured concurrently
+  eina_threads_init();
   
   static const float GAMMA = 2.2;
   int result;
@@ -67,12 +71,18 @@ int lime_init(void)
   }
 
   lime_filters_init();
+  lime_exif_index_init();
   
   return 0;
 }
 
 void lime_shutdown(void)
 {
+  render_async_shutdown();
+  lime_exif_index_shutdown();
+  eina_threads_shutdown();
   eina_shutdown();
   //TODO lime filters shutdown
+  //a later lime_init() starts over
+  inits = 0;
 }
\ No newline at end of file
@@ -33,6 +33,4 @@ void lime_unlock(void);
 int lime_init(void);
 void lime_shutdown(void);
 
-void *global_meta_check;
-
 #endif
\ No newline at end of file
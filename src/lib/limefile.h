@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIMEFILE_H
+#define _LIMEFILE_H
+
+#include <stdint.h>
+
+/*
+ * lime pyramid container (written by savelime, read by loadlime)
+ *
+ * header | tiles | index
+ *
+ * all scales use the same tile size, tiles are always stored full size
+ * (padded at the image border) so a raw tile is exactly one Tiledata,
+ * raw tiles are aligned to LIMEFILE_ALIGN inside the file
+ * the index holds one entry per scale, tile row, tile column and channel
+ * all values are in host byte order
+ */
+
+#define LIMEFILE_MAGIC "LIMEPYR"
+#define LIMEFILE_VERSION 1
+#define LIMEFILE_SCALES_MAX 16
+#define LIMEFILE_ALIGN 64
+
+enum {
+  LIMEFILE_PLANAR = 0, //one plane per channel, like the Tiledata of the loaders
+  LIMEFILE_PACKED //interleaved channels (reserved)
+};
+
+enum {
+  LIMEFILE_RAW = 0,
+  LIMEFILE_DEFLATE //horizontal delta + deflate
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t width, height;
+  uint32_t tile_width, tile_height;
+  uint32_t scales;
+  uint32_t channels;
+  uint32_t bitdepth; //BD_U8 or BD_U16
+  uint32_t layout;
+  int32_t colors[4];
+  uint32_t pad;
+  uint64_t index_offset;
+} Limefile_Header;
+
+typedef struct {
+  uint64_t offset;
+  uint32_t len; //0: tile was never written
+  uint32_t compression;
+} Limefile_Entry;
+
+static inline int limefile_tiles_x(Limefile_Header *h, int scale)
+{
+  int w = (h->width + (1u << scale) - 1) >> scale;
+
+  return (w + h->tile_width - 1)/h->tile_width;
+}
+
+static inline int limefile_tiles_y(Limefile_Header *h, int scale)
+{
+  int hh = (h->height + (1u << scale) - 1) >> scale;
+
+  return (hh + h->tile_height - 1)/h->tile_height;
+}
+
+static inline uint64_t limefile_entry_count(Limefile_Header *h)
+{
+  uint64_t count = 0;
+  int i;
+
+  for(i=0;i<h->scales;i++)
+    count += (uint64_t)limefile_tiles_x(h, i)*limefile_tiles_y(h, i)*h->channels;
+
+  return count;
+}
+
+static inline uint64_t limefile_entry_idx(Limefile_Header *h, int scale, int tx, int ty, int channel)
+{
+  uint64_t idx = 0;
+  int i;
+
+  for(i=0;i<scale;i++)
+    idx += (uint64_t)limefile_tiles_x(h, i)*limefile_tiles_y(h, i)*h->channels;
+
+  return idx + ((uint64_t)ty*limefile_tiles_x(h, scale) + tx)*h->channels + channel;
+}
+
+#endif
@@ -208,7 +208,7 @@ void meta_flag_set(Meta *meta, int flag)
 
 int meta_flag_get(Meta *meta, int flag)
 {
-  return meta->flags = meta->flags & flag;
+  return meta->flags & flag;
 }
 
 void meta_attach(Meta *parent, Meta *child)
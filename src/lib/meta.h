@@ -85,6 +85,8 @@ typedef enum {
 } Meta_Type;
 
 #define MT_FLAG_NOSOURCEREQUIRED 0x01
+//setting does not influence any metas, changing it only needs rehash/prepare, not reconfiguration
+#define MT_FLAG_SETTING_NOCONFIG 0x02
 
 extern Meta_Spec meta_def_list[MT_MAX];
 
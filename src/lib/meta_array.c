@@ -17,6 +17,8 @@
  * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "meta_array.h"
 
 int ma_count(Meta_Array *ar)
@@ -31,24 +33,37 @@ Meta *ma_data(Meta_Array *ar, int pos)
   return ar->data[pos];
 }
 
+//for arrays not allocated by meta_array_new()
+void meta_array_init(Meta_Array *ar)
+{
+  ar->count = 0;
+  ar->max = META_ARRAY_INLINE;
+  ar->data = ar->inline_data;
+}
+
 Meta_Array *meta_array_new(void)
 {
   Meta_Array *ar = malloc(sizeof(Meta_Array));
   
   if (!ar) return NULL;
   
-  ar->count = 0;
-  ar->max = 1;
-  
-  ar->data = malloc(sizeof(Meta*)*ar->max);
+  meta_array_init(ar);
   
   return ar;
 }
 
+//free external storage, but not the array itself
+void meta_array_clear(Meta_Array *ar)
+{
+  if (ar->data != ar->inline_data)
+    free(ar->data);
+  
+  meta_array_init(ar);
+}
 
 void meta_array_del(Meta_Array *ar)
 {
-  free(ar->data);
+  meta_array_clear(ar);
   free(ar);
 }
 
@@ -58,13 +73,18 @@ int meta_array_append(Meta_Array *ar, Meta *meta)
   assert(ar);
   
   if (ar->count == ar->max) {
-    if (ar->max == 1)
-	ar->max = 4;
-    else
-      	ar->max *= 2;
-    ar->data = realloc(ar->data, sizeof(Meta*)*ar->max);
-    if (!ar->data)
-      abort();
+    ar->max *= 2;
+    if (ar->data == ar->inline_data) {
+      ar->data = malloc(sizeof(Meta*)*ar->max);
+      if (!ar->data)
+        abort();
+      memcpy(ar->data, ar->inline_data, sizeof(Meta*)*ar->count);
+    }
+    else {
+      ar->data = realloc(ar->data, sizeof(Meta*)*ar->max);
+      if (!ar->data)
+        abort();
+    }
   }
   
   //TODO mark array as sorted/unsorted!
@@ -25,16 +25,21 @@ typedef struct _Meta_Array Meta_Array;
 
 #include "meta.h"
 
+#define META_ARRAY_INLINE 4
+
 struct _Meta_Array
 {
   int count;
   int max;
   Meta **data;
+  Meta *inline_data[META_ARRAY_INLINE]; //most metas have few childs, avoids extra allocation
 };
 
 int ma_count(Meta_Array *ar);
 Meta *ma_data(Meta_Array *ar, int pos);
 Meta_Array *meta_array_new(void);
+void meta_array_init(Meta_Array *ar);
+void meta_array_clear(Meta_Array *ar);
 void meta_array_del(Meta_Array *ar);
 int meta_array_append(Meta_Array *ar, Meta *meta);
 
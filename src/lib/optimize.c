@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "optimize.h"
+
+#include "meta.h"
+#include "configuration.h"
+#include "filter_convert.h"
+#include "filter_interleave.h"
+
+/*
+ * rule based optimization of the configured (node) filter chain
+ * only filters inserted by the configuration (helpers) are touched,
+ * they stay allocated (and are deleted with the config) but are
+ * removed from the chain
+ */
+
+typedef struct {
+  const char *name;
+  int len; //number of consecutive filters the rule matches
+  int (*apply)(Filter **fs, Filter *prev, Filter *next);
+} Opt_Rule;
+
+static Filter *_next(Filter *f)
+{
+  if (f->node->con_trees_out && ea_count(f->node->con_trees_out))
+    return ((Con*)ea_data(f->node->con_trees_out, 0))->sink->filter;
+
+  return NULL;
+}
+
+static Filter *_prev(Filter *f)
+{
+  if (f->node->con_trees_in && ea_count(f->node->con_trees_in))
+    return ((Con*)ea_data(f->node->con_trees_in, 0))->source->filter;
+
+  return NULL;
+}
+
+static int _is_helper(Filter *f, Eina_Array *helpers)
+{
+  int i;
+
+  for(i=0;i<ea_count(helpers);i++)
+    if (ea_data(helpers, i) == f)
+      return 1;
+
+  return 0;
+}
+
+//pointwise filters which only change the pixel format
+static int _is_format_filter(Filter *f)
+{
+  return f->fc == &filter_core_convert
+      || f->fc == &filter_core_interleave
+      || f->fc == &filter_core_deinterleave;
+}
+
+static int _dim_equal(Dim *a, Dim *b)
+{
+  if (!a || !b)
+    return a == b;
+
+  return a->x == b->x && a->y == b->y
+      && a->width == b->width && a->height == b->height
+      && a->scaledown_max == b->scaledown_max;
+}
+
+static int _data_equal(Meta *a, Meta *b, int type)
+{
+  void *da = meta_child_data_by_type(a, type);
+  void *db = meta_child_data_by_type(b, type);
+
+  if (!da || !db)
+    return da == db;
+
+  return !meta_def_list[type].cmp_data(da, db);
+}
+
+//channel lists carry the same pixel format
+static int _channels_equal(Eina_Array *a, Eina_Array *b)
+{
+  int i;
+  Meta *ma, *mb;
+
+  if (!a || !b || ea_count(a) != ea_count(b))
+    return 0;
+
+  for(i=0;i<ea_count(a);i++) {
+    ma = ea_data(a, i);
+    mb = ea_data(b, i);
+
+    if (!_data_equal(ma, mb, MT_COLOR))
+      return 0;
+    if (!_data_equal(ma, mb, MT_BITDEPTH))
+      return 0;
+    if (!_dim_equal(meta_child_data_by_type(ma, MT_IMGSIZE), meta_child_data_by_type(mb, MT_IMGSIZE)))
+      return 0;
+  }
+
+  return 1;
+}
+
+static Meta *_tune_by_name(Filter *f, const char *name)
+{
+  int i;
+
+  for(i=0;i<ea_count(f->tune);i++)
+    if (!strcmp(((Meta*)ea_data(f->tune, i))->name, name))
+      return ea_data(f->tune, i);
+
+  return NULL;
+}
+
+static void _meta_recalc_rec(Meta *m, Meta *tune)
+{
+  int i;
+
+  if (m != tune && m->dep == tune)
+    meta_data_calc(m);
+
+  if (m->childs)
+    for(i=0;i<ma_count(m->childs);i++)
+      _meta_recalc_rec(ma_data(m->childs, i), tune);
+}
+
+//remove first..last from the chain, connect prev and next directly
+static void _chain_cut(Filter *prev, Filter *first, Filter *last, Filter *next)
+{
+  Filter *f, *f_next;
+
+  f = first;
+  con_del_real(ea_data(first->node->con_trees_in, 0));
+  while (f != last) {
+    f_next = _next(f);
+    con_del_real(ea_data(f->node->con_trees_out, 0));
+    f = f_next;
+  }
+  con_del_real(ea_data(last->node->con_trees_out, 0));
+
+  filter_connect_real(prev, 0, next, 0);
+}
+
+//entry of the tune's own select list equal to value, NULL if there is none
+static void *_select_entry(Meta *tune, void *value)
+{
+  int i;
+
+  if (!tune->select)
+    return NULL;
+
+  for(i=0;i<ea_count(tune->select);i++)
+    if (!meta_def_list[tune->type].cmp_data(ea_data(tune->select, i), value))
+      return ea_data(tune->select, i);
+
+  return NULL;
+}
+
+static Meta *_channel_find(Meta *m, int channel)
+{
+  Meta *found;
+  int i;
+
+  if (m->type == MT_CHANNEL && (uintptr_t)m->data-1 == channel)
+    return m;
+
+  if (m->childs)
+    for(i=0;i<ma_count(m->childs);i++)
+      if ((found = _channel_find(ma_data(m->childs, i), channel)))
+        return found;
+
+  return NULL;
+}
+
+//output channel meta of f by channel number
+static Meta *_out_channel(Filter *f, int channel)
+{
+  Meta *found;
+  int i;
+
+  for(i=0;i<ea_count(f->out);i++)
+    if ((found = _channel_find(ea_data(f->out, i), channel)))
+      return found;
+
+  return NULL;
+}
+
+//convert A->B => convert A with output of B
+static int _rule_convert_merge(Filter **fs, Filter *prev, Filter *next)
+{
+  Meta *bd_a, *color_a, *bd_b, *color_b;
+  void *bd, *color;
+  int i;
+
+  if (fs[0]->fc != &filter_core_convert || fs[1]->fc != &filter_core_convert)
+    return 0;
+
+  bd_a = _tune_by_name(fs[0], "Output Bitdepth");
+  color_a = _tune_by_name(fs[0], "Output CS");
+  bd_b = _tune_by_name(fs[1], "Output Bitdepth");
+  color_b = _tune_by_name(fs[1], "Output CS");
+
+  if (!bd_a || !color_a || !bd_b || !color_b || !bd_b->data || !color_b->data)
+    return 0;
+
+  //A keeps pointing into its own select lists
+  bd = _select_entry(bd_a, bd_b->data);
+  color = _select_entry(color_a, color_b->data);
+  if (!bd || !color)
+    return 0;
+
+  for(i=0;i<ea_count(next->node->con_ch_in);i++)
+    if (!_out_channel(fs[0], i))
+      return 0;
+
+  bd_a->data = bd;
+  color_a->data = color;
+  for(i=0;i<ea_count(fs[0]->out);i++) {
+    _meta_recalc_rec(ea_data(fs[0]->out, i), bd_a);
+    _meta_recalc_rec(ea_data(fs[0]->out, i), color_a);
+  }
+
+  _chain_cut(fs[0], fs[1], fs[1], next);
+  for(i=0;i<ea_count(next->node->con_ch_in);i++)
+    eina_array_data_set(next->node->con_ch_in, i, _out_channel(fs[0], i));
+
+  return 1;
+}
+
+static void _ch_in_replace(Filter *next, Filter *first)
+{
+  int i;
+
+  for(i=0;i<ea_count(next->node->con_ch_in);i++)
+    eina_array_data_set(next->node->con_ch_in, i, ea_data(first->node->con_ch_in, i));
+}
+
+//format filter which outputs what it gets
+static int _rule_identity(Filter **fs, Filter *prev, Filter *next)
+{
+  if (!_is_format_filter(fs[0]))
+    return 0;
+
+  if (!_channels_equal(fs[0]->node->con_ch_in, next->node->con_ch_in))
+    return 0;
+
+  _chain_cut(prev, fs[0], fs[0], next);
+  _ch_in_replace(next, fs[0]);
+
+  return 1;
+}
+
+//two format filters which undo each other (deinterleave->interleave, convert->inverse convert)
+static int _rule_inverse_pair(Filter **fs, Filter *prev, Filter *next)
+{
+  if (!_is_format_filter(fs[0]) || !_is_format_filter(fs[1]))
+    return 0;
+
+  if (!_channels_equal(fs[0]->node->con_ch_in, next->node->con_ch_in))
+    return 0;
+
+  _chain_cut(prev, fs[0], fs[1], next);
+  _ch_in_replace(next, fs[0]);
+
+  return 1;
+}
+
+static Opt_Rule rules[] = {
+  {"merge converts", 2, &_rule_convert_merge},
+  {"identity", 1, &_rule_identity},
+  {"inverse pair", 2, &_rule_inverse_pair},
+  {NULL, 0, NULL}
+};
+
+//try all rules at position f, return applied rule or NULL
+static Opt_Rule *_rules_apply(Filter *f, Eina_Array *helpers, Filter **fs)
+{
+  Opt_Rule *rule;
+  Filter *prev, *next;
+  int i;
+
+  prev = _prev(f);
+  if (!prev)
+    return NULL;
+
+  for(rule=rules;rule->name;rule++) {
+    next = f;
+    for(i=0;i<rule->len && next;i++) {
+      if (!_is_helper(next, helpers))
+        break;
+      fs[i] = next;
+      next = _next(next);
+    }
+
+    //the filter after the match must exist, it gets the new input
+    if (i != rule->len || !next)
+      continue;
+
+    if (rule->apply(fs, prev, next))
+      return rule;
+  }
+
+  return NULL;
+}
+
+static void _vizp_chain(FILE *file, Eina_Array *chain, const char *color)
+{
+  int i;
+
+  for(i=1;i<ea_count(chain);i++)
+    fprintf(file, "\"%p\" -> \"%p\" [color = %s]\n", ea_data(chain, i-1), ea_data(chain, i), color);
+}
+
+/*
+ * f: first filter of the configured chain
+ * helpers: filters inserted by the configuration, only those are changed
+ * returns number of applied rules
+ */
+int config_optimize(Filter *f, Eina_Array *helpers, int write_graph)
+{
+  Filter *cur;
+  Filter *fs[2];
+  Opt_Rule *rule;
+  Eina_Array *orig = NULL;
+  Eina_Array *final;
+  FILE *file = NULL;
+  int i, applied = 0;
+
+  if (!helpers || !ea_count(helpers))
+    return 0;
+
+  if (write_graph) {
+    orig = eina_array_new(8);
+    for(cur=f;cur;cur=_next(cur))
+      ea_push(orig, cur);
+
+    file = vizp_start("optimize.dot");
+    for(i=0;i<ea_count(orig);i++)
+      vizp_filter(file, ea_data(orig, i));
+  }
+
+  cur = f;
+  while (cur) {
+    rule = _rules_apply(cur, helpers, fs);
+
+    if (!rule) {
+      cur = _next(cur);
+      continue;
+    }
+
+    if (write_graph) {
+      fprintf(file, "\"rule_%d\" [label = \"%d: %s\", shape = note]\n", applied, applied, rule->name);
+      for(i=0;i<rule->len;i++)
+        fprintf(file, "\"rule_%d\" -> \"%p\" [color = red]\n", applied, fs[i]);
+    }
+
+    applied++;
+    //removals can create new matches upstream
+    cur = f;
+  }
+
+  if (write_graph) {
+    final = eina_array_new(8);
+    for(cur=f;cur;cur=_next(cur))
+      ea_push(final, cur);
+
+    _vizp_chain(file, orig, "gray");
+    _vizp_chain(file, final, "green");
+    vizp_stop(file);
+
+    eina_array_free(orig);
+    eina_array_free(final);
+  }
+
+  return applied;
+}
@@ -25,6 +25,7 @@
 #include "tile.h"
 #include "cache.h"
 #include "configuration.h"
+#include "filter_memsink.h"
 
 #define MODE_INPUT 0 
 #define MODE_CLOBBER 1
@@ -58,6 +59,7 @@ struct _Render_Node {
   Render_State *state;
   int depth;
   void *iter;
+  int area_idx; //requested area, only for the root nodes (depth 1)
 };
 
 //Problem threading: Was wenn an einem Knoten nicht genug Arbeit anfällt?
@@ -69,6 +71,11 @@ struct _Render_State {
   Eina_Array *currstate; //Render_Nodes
   Eina_Array *ready; //list of tiles which can be processed because all input tiles are available
   int pending; //number of pending jobs
+  Filter *f;
+  Rect *areas; //requested areas, one root node each, NULL: full filter (iterating sinks)
+  int *order; //areas in traversal order
+  int area_count;
+  int area_next; //next root to push once currstate is empty
 };
 
 /*int do_clobber(Eina_Array *f_source, Filter *f, Rect *area)
@@ -434,6 +441,8 @@ int end_of_iteration(Render_Node *node)
     abort();
 }
 
+void render_state_root_push(Render_State *state);
+
 //return 0 on success
 Render_Node *render_state_getjob( Render_State *state)
 {
@@ -450,6 +459,10 @@ Render_Node *render_state_getjob( Render_State *state)
   if (ea_count(state->ready))
     return ea_pop(state->ready);
   
+  //next area, inputs shared with earlier areas are found in the cache (rendered or wanted)
+  if (!ea_count(state->currstate) && state->area_next < state->area_count)
+    render_state_root_push(state);
+  
   if (!ea_count(state->currstate)) {
     
     if (state->pending) {
@@ -595,6 +608,10 @@ Render_Node *render_state_getjob( Render_State *state)
   
   if (ea_count(state->ready))
     return ea_pop(state->ready);
+  
+  //don't wait for pending tiles while there are still areas to traverse
+  if (state->area_next < state->area_count)
+    return render_state_getjob(state);
     
   if (state->pending) {
     lime_unlock();
@@ -622,31 +639,94 @@ void render_state_del(Render_State *state)
   
   eina_array_free(state->currstate);
   eina_array_free(state->ready);
+  free(state->order);
 
   free(state);
 }
 
-//Positionen und Größer immer bezogen auf scale
-//FIXME check if area is already cached!
-Render_State *render_state_new(Rect *area, Filter *f)
+void render_state_root_push(Render_State *state)
 {
-  Render_State *state = calloc(sizeof(Render_State), 1);  
   Tile *tile;
+  Rect *area;
+  Render_Node *node;
+  int idx = state->order[state->area_next++];
   
-  if (area) {
-    tile = tile_new(area, tile_hash_calc(f, area), f, NULL, 1);
+  if (state->areas) {
+    area = &state->areas[idx];
+    tile = tile_new(area, tile_hash_calc(state->f, area), state->f, NULL, 1);
   }
   else
     tile = NULL;
   
-  Render_Node *node =  render_node_new(f, tile, state, 1); 
-  
+  node =  render_node_new(state->f, tile, state, 1); 
+  node->area_idx = idx;
   node->need = 1000;
+  
+  eina_array_push(state->currstate, node);
+}
 
+//interleaved bits of x and y, neighbouring areas stay close in the traversal
+static uint64_t _morton(Rect *area)
+{
+  uint64_t code = 0;
+  uint32_t x, y;
+  int i;
+  
+  x = area->width ? area->corner.x/area->width : 0;
+  y = area->height ? area->corner.y/area->height : 0;
+  
+  for(i=0;i<32;i++)
+    code |= (uint64_t)((x >> i) & 1) << (2*i) | (uint64_t)((y >> i) & 1) << (2*i+1);
+  
+  return code;
+}
+
+static Rect *_order_areas;
+
+static int _order_cmp(const void *a, const void *b)
+{
+  Rect *ra = &_order_areas[*(int*)a];
+  Rect *rb = &_order_areas[*(int*)b];
+  uint64_t ma, mb;
+  
+  if (ra->corner.scale != rb->corner.scale)
+    return ra->corner.scale - rb->corner.scale;
+  
+  ma = _morton(ra);
+  mb = _morton(rb);
+  
+  if (ma < mb)
+    return -1;
+  if (ma > mb)
+    return 1;
+  return 0;
+}
+
+//Positionen und Größer immer bezogen auf scale
+//FIXME check if area is already cached!
+//areas == NULL: single root without tile (count must be 1)
+Render_State *render_state_new(Rect *areas, int count, Filter *f)
+{
+  Render_State *state = calloc(sizeof(Render_State), 1);  
+  int i;
+  
   state->currstate = eina_array_new(64);
   state->ready = eina_array_new(64);
+  state->f = f;
+  state->areas = areas;
+  state->area_count = count;
+  state->order = malloc(sizeof(int)*count);
+  for(i=0;i<count;i++)
+    state->order[i] = i;
+  
+  //called with the lime lock held
+  if (areas && count > 1) {
+    _order_areas = areas;
+    qsort(state->order, count, sizeof(int), &_order_cmp);
+    _order_areas = NULL;
+  }
   
-  eina_array_push(state->currstate, node);
+  render_state_root_push(state);
   
   return state;
 }
@@ -656,6 +736,7 @@ void lime_render(Filter *f)
 {
   Dim *size_ptr;
   Rect area;
+  int thread_id = lime_thread_id_get();
   
   lime_config_test(f);
   
@@ -668,42 +749,59 @@ void lime_render(Filter *f)
     area.width = size_ptr->width;
     area.height = size_ptr->height;
     
-    lime_render_area(&area, f, 0);
+    lime_render_area(&area, f, thread_id);
   }
   else
-    lime_render_area(NULL, f, 0);
+    lime_render_area(NULL, f, thread_id);
   
+  lime_thread_id_put(thread_id);
 }
 
-//render area with external threading
+//render area with external threading, thread_id from lime_thread_id_get()
 void lime_render_area(Rect *area, Filter *f, int thread_id)
 {
-  int j;
+  lime_render_areas(f, area, NULL, 1, thread_id);
+}
+
+//render several areas of f in a single traversal, input tiles shared between
+//areas are scheduled once, areas are traversed in z-order
+//bufs: one output buffer per area if f is a memsink, else NULL
+void lime_render_areas(Filter *f, Rect *areas, uint8_t **bufs, int count, int thread_id)
+{
+  int i, j;
   Render_Node *waiter;
   Render_Node *job;
   Dim *ch_dim;
   
-  if (!f)
+  if (!f || count < 1)
     return;
   
-  lime_lock();
+  assert(!bufs || !strcmp(f->fc->shortname, "memsink"));
   
-  lime_config_test(f);
+  //configuration is per graph, only needs the graph lock
+  if (lime_config_test_ref(f)) {
+    printf("render: configuration of %s failed\n", f->fc->name);
+    return;
+  }
   
-  lime_filter_config_ref(f);
+  lime_lock();
   
   ch_dim = meta_child_data_by_type(ea_data(f->node->con_ch_in, 0), MT_IMGSIZE);
   
-  assert(area->corner.x < DIV_SHIFT_ROUND_UP(ch_dim->width, area->corner.scale));
-  assert(area->corner.y < DIV_SHIFT_ROUND_UP(ch_dim->height, area->corner.scale));
+  for(i=0;areas && i<count;i++) {
+    assert(areas[i].corner.x < DIV_SHIFT_ROUND_UP(ch_dim->width, areas[i].corner.scale));
+    assert(areas[i].corner.y < DIV_SHIFT_ROUND_UP(ch_dim->height, areas[i].corner.scale));
+  }
   
-  Render_State *state = render_state_new(area, f);
+  Render_State *state = render_state_new(areas, count, f);
   
   while ((job = render_state_getjob(state))) {
     assert(job->need == 0);
     
     if (job->mode == MODE_CLOBBER || job->mode == MODE_INPUT) {
       assert(job->tile->refs > 0);
+      if (bufs && job->depth == 1)
+        filter_memsink_buffer_set(f, bufs[job->area_idx], thread_id);
       filter_render_tile(job, thread_id);
     }
     //MODE_ITER
@@ -741,7 +839,7 @@ void lime_render_area(Rect *area, Filter *f, int thread_id)
   
   render_state_del(state);
   
-  lime_filter_config_unref(f);
   lime_unlock();
+  lime_filter_config_unref(f);
 }
 
@@ -18,7 +18,7 @@
  */
 
 #ifndef _RENDER_H
-#define _RENDER_h
+#define _RENDER_H
 
 //entspricht dem Fortschritt an einem Knoten
 #include "common.h"
@@ -26,6 +26,37 @@
 
 void lime_render(Filter *f);
 void lime_render_area(Rect *area, Filter *f, int thread_id);
+void lime_render_areas(Filter *f, Rect *areas, uint8_t **bufs, int count, int thread_id);
 double lime_get_global_stat_thread_blocked(void);
 
+//ids for callers running lime_render_area() on their own threads, required
+//even for a single thread as the render pool and lime_render() share them
+int lime_thread_id_get(void);
+void lime_thread_id_put(int thread_id);
+
+struct _Lime_Future;
+typedef struct _Lime_Future Lime_Future;
+
+//called from a render thread after the area was rendered
+typedef void (*Lime_Render_Cb)(void *data, Lime_Future *future);
+
+#define LIME_RENDER_BACKGROUND 1 //only run if no other request is queued
+
+typedef struct {
+  Filter *f;
+  Rect area;
+  uint8_t *buf; //output buffer if f is a memsink
+  int flags;
+  Lime_Render_Cb cb; //may be NULL
+  void *data;
+} Lime_Render_Request;
+
+int lime_render_submit(Lime_Render_Request *reqs, int count, Lime_Future **futures);
+Lime_Future *lime_render_area_async(Rect *area, Filter *f, uint8_t *buf, Lime_Render_Cb cb, void *data);
+int lime_future_done(Lime_Future *future);
+void lime_future_wait(Lime_Future *future);
+void lime_future_del(Lime_Future *future);
+
+void render_async_shutdown(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "global.h"
+#include "filter.h"
+#include "filter_memsink.h"
+
+/*
+ * asynchronous rendering on a library owned thread pool
+ * each pool thread owns a thread id for its whole lifetime, callers never
+ * see them. pool threads run below the priority of the caller, background
+ * requests run on their own threads (started on first use) with another
+ * priority drop and only if no foreground request is queued
+ * queued requests for the same filter are taken as a batch and rendered in
+ * one traversal with lime_render_areas()
+ */
+
+#define BATCH_MAX 16
+
+struct _Lime_Future {
+  Lime_Render_Request req;
+  int done;
+  int detached; //deleted by the caller before completion
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t job_cond; //new job or shutdown
+  pthread_cond_t done_cond; //a future completed
+  Eina_List *jobs;
+  Eina_List *jobs_bg;
+  int shutdown;
+  int thread_count;
+  pthread_t *threads;
+  int bg_thread_count;
+  pthread_t *bg_threads;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static pthread_mutex_t id_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *ids;
+static int ids_len;
+
+//lowest free id, so per thread filter data stays compact
+//every caller of lime_render_area() must take its id from here, the pool
+//threads and lime_render() do, so ids never collide
+int lime_thread_id_get(void)
+{
+  int i;
+
+  pthread_mutex_lock(&id_lock);
+
+  for(i=0;i<ids_len;i++)
+    if (!ids[i])
+      break;
+
+  if (i == ids_len) {
+    ids_len = ids_len ? ids_len*2 : 16;
+    ids = realloc(ids, ids_len);
+    memset(ids+i, 0, ids_len-i);
+  }
+  ids[i] = 1;
+
+  pthread_mutex_unlock(&id_lock);
+
+  return i;
+}
+
+void lime_thread_id_put(int thread_id)
+{
+  pthread_mutex_lock(&id_lock);
+  assert(thread_id >= 0 && thread_id < ids_len && ids[thread_id]);
+  ids[thread_id] = 0;
+  pthread_mutex_unlock(&id_lock);
+}
+
+static void _render(Lime_Future **batch, int count, int thread_id)
+{
+  Rect areas[BATCH_MAX];
+  uint8_t *bufs[BATCH_MAX];
+  Filter *f = batch[0]->req.f;
+  int i, memsink = !strcmp(f->fc->shortname, "memsink");
+
+  for(i=0;i<count;i++) {
+    areas[i] = batch[i]->req.area;
+    bufs[i] = batch[i]->req.buf;
+  }
+
+  //memsink keeps the buffer per thread id, lime_render_areas() sets it per
+  //area, reset it so no later request of this thread writes to it
+  lime_render_areas(f, areas, memsink ? bufs : NULL, count, thread_id);
+
+  if (memsink) {
+    lime_lock();
+    filter_memsink_buffer_set(f, NULL, thread_id);
+    lime_unlock();
+  }
+}
+
+//called with pool.lock held, takes the first request and following requests
+//of the same filter, but only a fair share of the queue so all threads get work
+static int _batch_take(Eina_List **jobs, Lime_Future **batch, int threads)
+{
+  Eina_List *l, *l_next;
+  Lime_Future *future;
+  int count = 0;
+  int max = (eina_list_count(*jobs) + threads - 1)/threads;
+
+  if (max > BATCH_MAX)
+    max = BATCH_MAX;
+
+  batch[count++] = eina_list_data_get(*jobs);
+  *jobs = eina_list_remove_list(*jobs, *jobs);
+
+  for(l=*jobs;l && count<max;l=l_next) {
+    l_next = eina_list_next(l);
+    future = eina_list_data_get(l);
+    if (future->req.f == batch[0]->req.f) {
+      batch[count++] = future;
+      *jobs = eina_list_remove_list(*jobs, l);
+    }
+  }
+
+  return count;
+}
+
+//called with pool.lock held, on shutdown background requests no longer wait
+static int _runnable(int background)
+{
+  if (background)
+    return pool.jobs_bg && (!pool.jobs || pool.shutdown);
+
+  return pool.jobs != NULL;
+}
+
+static void *_pool_worker(void *arg)
+{
+  Lime_Future *batch[BATCH_MAX];
+  int i, count;
+  int background = (intptr_t)arg;
+  int thread_id = lime_thread_id_get();
+
+  //per thread on linux, background threads drop twice
+  eina_sched_prio_drop();
+  if (background)
+    eina_sched_prio_drop();
+
+  pthread_mutex_lock(&pool.lock);
+
+  while (1) {
+    while (!_runnable(background) && !pool.shutdown)
+      pthread_cond_wait(&pool.job_cond, &pool.lock);
+
+    if (!_runnable(background))
+      break;
+
+    if (background)
+      count = _batch_take(&pool.jobs_bg, batch, pool.bg_thread_count);
+    else {
+      count = _batch_take(&pool.jobs, batch, pool.thread_count);
+      //background threads wait for an empty foreground queue
+      if (!pool.jobs && pool.jobs_bg)
+        pthread_cond_broadcast(&pool.job_cond);
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+
+    _render(batch, count, thread_id);
+
+    for(i=0;i<count;i++)
+      if (batch[i]->req.cb)
+        batch[i]->req.cb(batch[i]->req.data, batch[i]);
+
+    pthread_mutex_lock(&pool.lock);
+    for(i=0;i<count;i++) {
+      batch[i]->done = 1;
+      if (batch[i]->detached)
+        free(batch[i]);
+    }
+    pthread_cond_broadcast(&pool.done_cond);
+  }
+
+  pthread_mutex_unlock(&pool.lock);
+
+  lime_thread_id_put(thread_id);
+
+  return NULL;
+}
+
+//called with pool.lock held
+static int _threads_start(pthread_t **threads, int *thread_count, int background)
+{
+  int i, count;
+
+  if (*thread_count)
+    return 0;
+
+  count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (count <= 0)
+    count = 1;
+
+  *threads = malloc(sizeof(pthread_t)*count);
+
+  for(i=0;i<count;i++) {
+    if (pthread_create(&(*threads)[i], NULL, &_pool_worker, (void*)(intptr_t)background)) {
+      printf("render pool: could only start %d of %d threads\n", i, count);
+      break;
+    }
+    (*thread_count)++;
+  }
+
+  if (!*thread_count) {
+    free(*threads);
+    *threads = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+//called with pool.lock held
+static int _pool_start(int background)
+{
+  if (!pool.thread_count && !pool.bg_thread_count)
+    pool.shutdown = 0;
+
+  if (background)
+    return _threads_start(&pool.bg_threads, &pool.bg_thread_count, 1);
+
+  return _threads_start(&pool.threads, &pool.thread_count, 0);
+}
+
+//queue count requests, futures (may be NULL) receives one future per request
+//returns -1 if no render thread could be started
+int lime_render_submit(Lime_Render_Request *reqs, int count, Lime_Future **futures)
+{
+  Lime_Future *future;
+  int i, background = 0;
+
+  for(i=0;i<count;i++)
+    if (reqs[i].flags & LIME_RENDER_BACKGROUND)
+      background = 1;
+
+  pthread_mutex_lock(&pool.lock);
+
+  if (_pool_start(0) || (background && _pool_start(1))) {
+    pthread_mutex_unlock(&pool.lock);
+    return -1;
+  }
+
+  for(i=0;i<count;i++) {
+    future = calloc(sizeof(Lime_Future), 1);
+    future->req = reqs[i];
+    if (futures)
+      futures[i] = future;
+    else
+      future->detached = 1;
+
+    if (reqs[i].flags & LIME_RENDER_BACKGROUND)
+      pool.jobs_bg = eina_list_append(pool.jobs_bg, future);
+    else
+      pool.jobs = eina_list_append(pool.jobs, future);
+  }
+
+  pthread_cond_broadcast(&pool.job_cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  return 0;
+}
+
+Lime_Future *lime_render_area_async(Rect *area, Filter *f, uint8_t *buf, Lime_Render_Cb cb, void *data)
+{
+  Lime_Render_Request req;
+  Lime_Future *future;
+
+  req.f = f;
+  req.area = *area;
+  req.buf = buf;
+  req.flags = 0;
+  req.cb = cb;
+  req.data = data;
+
+  if (lime_render_submit(&req, 1, &future))
+    return NULL;
+
+  return future;
+}
+
+int lime_future_done(Lime_Future *future)
+{
+  int done;
+
+  pthread_mutex_lock(&pool.lock);
+  done = future->done;
+  pthread_mutex_unlock(&pool.lock);
+
+  return done;
+}
+
+//returns after the completion callback returned
+void lime_future_wait(Lime_Future *future)
+{
+  pthread_mutex_lock(&pool.lock);
+  while (!future->done)
+    pthread_cond_wait(&pool.done_cond, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+//may be called before completion, the request still runs (and calls back)
+void lime_future_del(Lime_Future *future)
+{
+  if (!future)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  if (future->done)
+    free(future);
+  else
+    future->detached = 1;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+//finishes all queued requests first
+void render_async_shutdown(void)
+{
+  int i;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.shutdown = 1;
+  pthread_cond_broadcast(&pool.job_cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  for(i=0;i<pool.thread_count;i++)
+    pthread_join(pool.threads[i], NULL);
+  for(i=0;i<pool.bg_thread_count;i++)
+    pthread_join(pool.bg_threads[i], NULL);
+
+  free(pool.threads);
+  free(pool.bg_threads);
+  pool.threads = NULL;
+  pool.bg_threads = NULL;
+  pool.thread_count = 0;
+  pool.bg_thread_count = 0;
+}
@@ -52,12 +52,23 @@ Tiledata *tiledata_new(Rect *area, int size, Tile *parent)
 }
 
 
+static void _tiledata_data_free(Tiledata *tile)
+{
+  if (tile->release)
+    tile->release(tile->owner);
+  else
+    free(tile->data);
+  
+  tile->release = NULL;
+  tile->owner = NULL;
+}
+
 void hack_tiledata_fixsize(int size, Tiledata *tile)
 {
   if (tile->size == size)
     return;
   
-  free(tile->data);
+  _tiledata_data_free(tile);
     
   if (tile->parent && tile->parent->cached)
     cache_mem_sub(tile->area.width*tile->area.height*tile->size);
@@ -85,6 +96,16 @@ void hack_tiledata_fixsize_mt(int size, Tiledata *tile)
   lime_unlock();
 }
 
+//use external read-only memory (e.g. a file mapping) as tile data, no accounting change
+void tiledata_borrow(Tiledata *tile, void *data, void (*release)(void *owner), void *owner)
+{
+  _tiledata_data_free(tile);
+  
+  tile->data = data;
+  tile->release = release;
+  tile->owner = owner;
+}
+
 void tiledata_del(Tiledata *td)
 {
   if (td->parent && td->parent->cached)
@@ -92,7 +113,7 @@ void tiledata_del(Tiledata *td)
   else
     cache_uncached_sub(td->area.width*td->area.height*td->size);
   
-  free(td->data);
+  _tiledata_data_free(td);
   free(td);
 }
 
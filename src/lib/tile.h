@@ -36,6 +36,8 @@ struct _Tiledata {
   void *data; //actual pixel (or whatever) data
   Rect area; //ref to parent tiles, area
   Tile *parent;
+  void (*release)(void *owner); //data is borrowed, release(owner) instead of free
+  void *owner;
 };
 
 //tiles wissen selber überhaupt nicht was sie speichern, das wissen nur die filter die mit ihnen Arbeiten, tiles werden über den hash identifiziert
@@ -82,6 +84,8 @@ Tiledata *tiledata_new(Rect *area, int size, Tile *parent);
 //calls lime_lock!
 void hack_tiledata_fixsize(int size, Tiledata *tile);
 void hack_tiledata_fixsize_raw(int size, Tiledata *tile);
+void hack_tiledata_fixsize_mt(int size, Tiledata *tile);
+void tiledata_borrow(Tiledata *tile, void *data, void (*release)(void *owner), void *owner);
 Tile *tile_new(Rect *area, Tilehash hash, Filter *f, Filter *f_req, int depth);
 void tile_del(Tile *tile);
 void tiledata_del(Tiledata *td);
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * micro-benchmark of the configuration of the chain limeview builds with
+ * every filter of its filter menu inserted (lensfun needs a lens database
+ * and is left out), every iteration resets the configuration so the whole
+ * graph is configured again
+ * usage: config_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Lime.h"
+#include "test_image.h"
+
+static char path[] = "/tmp/lime_config_bench_XXXXXX";
+
+//the filter menu of limeview, in menu order
+static const char *menu_filters[] = {
+  "exposure", "contrast", "gauss", "sharpen", "denoise", "rotate", "rotate angle", "curves", NULL
+};
+
+static double _now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  Filter *load, *f, *last, *sink;
+  int fd, i, iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  double start, t;
+
+  if (iterations <= 0)
+    return EXIT_FAILURE;
+
+  fd = mkstemp(path);
+  if (fd == -1)
+    return EXIT_FAILURE;
+  close(fd);
+
+  if (test_image_write(path)) {
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  lime_init();
+  lime_cache_set(64, 0);
+
+  //as built by limeview: load, the inserted filters, memsink with alpha
+  load = lime_filter_new("load");
+  lime_setting_string_set(load, "filename", path);
+  last = load;
+  for(i=0;menu_filters[i];i++) {
+    f = lime_filter_new(menu_filters[i]);
+    if (!f) {
+      printf("no filter %s\n", menu_filters[i]);
+      unlink(path);
+      return EXIT_FAILURE;
+    }
+    lime_filter_connect(last, f);
+    last = f;
+  }
+  sink = lime_filter_new("memsink");
+  lime_setting_int_set(sink, "add alpha", 1);
+  lime_filter_connect(last, sink);
+
+  //first configuration also opens the file
+  if (lime_config_test(sink) || !sink->c) {
+    printf("configuration failed\n");
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  start = _now();
+  for(i=0;i<iterations;i++) {
+    //setting changes are mostly NOCONFIG and only rehash, the reset forces
+    //the configuration of the whole chain
+    lime_config_reset(sink);
+    if (sink->c) {
+      printf("configuration %d was not reset\n", i);
+      unlink(path);
+      return EXIT_FAILURE;
+    }
+    if (lime_config_test(sink) || !sink->c) {
+      printf("configuration %d failed\n", i);
+      unlink(path);
+      return EXIT_FAILURE;
+    }
+  }
+  t = _now() - start;
+
+  printf("%d configurations: %.3fms total, %.2fus each\n", iterations, t*1000.0, t*1e6/iterations);
+
+  lime_shutdown();
+  unlink(path);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * configures and renders independent chains from several threads at once,
+ * build with -fsanitize=thread to check configuration and the cache
+ * buffer accounting for races
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Lime.h"
+#include "filter_memsink.h"
+#include "test_image.h"
+
+#define THREADS 8
+#define ITERATIONS 32
+
+static char path[] = "/tmp/lime_config_stress_XXXXXX";
+static int failed;
+
+static void *_run(void *arg)
+{
+  Filter *load, *gauss, *sink;
+  uint32_t *buf = malloc(sizeof(uint32_t)*DEFAULT_TILE_AREA);
+  int thread_id = lime_thread_id_get();
+  Rect area;
+  int i;
+
+  load = lime_filter_new("load");
+  gauss = lime_filter_new("gauss");
+  sink = lime_filter_new("memsink");
+  lime_filter_connect(load, gauss);
+  lime_filter_connect(gauss, sink);
+
+  lime_lock();
+  lime_setting_string_set(load, "filename", path);
+  lime_setting_int_set(sink, "add alpha", 1);
+  lime_unlock();
+
+  for(i=0;i<ITERATIONS;i++) {
+    //sigma is a NOCONFIG setting and only rehashes, the reset forces a new
+    //configuration of this chain only
+    lime_lock();
+    lime_setting_float_set(gauss, "sigma", 0.5*(i%8));
+    lime_unlock();
+    lime_config_reset(sink);
+
+    if (sink->c) {
+      printf("thread %d: configuration %d was not reset\n", thread_id, i);
+      __sync_fetch_and_add(&failed, 1);
+      break;
+    }
+
+    if (lime_config_test(sink) || !sink->c) {
+      printf("thread %d: configuration %d failed\n", thread_id, i);
+      __sync_fetch_and_add(&failed, 1);
+      break;
+    }
+
+    area.corner.x = (i % (TEST_IMAGE_SIZE/DEFAULT_TILE_SIZE))*DEFAULT_TILE_SIZE;
+    area.corner.y = 0;
+    area.corner.scale = 0;
+    area.width = DEFAULT_TILE_SIZE;
+    area.height = DEFAULT_TILE_SIZE;
+
+    lime_lock();
+    filter_memsink_buffer_set(sink, (uint8_t*)buf, thread_id);
+    lime_unlock();
+    lime_render_area(&area, sink, thread_id);
+  }
+
+  lime_lock();
+  filter_memsink_buffer_set(sink, NULL, thread_id);
+  lime_unlock();
+
+  lime_thread_id_put(thread_id);
+  free(buf);
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t threads[THREADS];
+  int fd, i;
+
+  fd = mkstemp(path);
+  if (fd == -1)
+    return EXIT_FAILURE;
+  close(fd);
+
+  if (test_image_write(path)) {
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  lime_init();
+  lime_cache_set(64, 0);
+
+  for(i=0;i<THREADS;i++)
+    pthread_create(&threads[i], NULL, &_run, NULL);
+  for(i=0;i<THREADS;i++)
+    pthread_join(threads[i], NULL);
+
+  lime_shutdown();
+  unlink(path);
+
+  if (failed) {
+    printf("%d of %d threads failed\n", failed, THREADS);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ * This file is part of lime.
+ *
+ * Lime is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Lime is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Lime.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_image.h"
+
+#include <stdint.h>
+#include <tiffio.h>
+
+//small 8 bit rgb tiff, read by the load filter
+int test_image_write(const char *file)
+{
+  TIFF *tiff = TIFFOpen(file, "w");
+  uint8_t row[TEST_IMAGE_SIZE*3];
+  int x, y, fail = 0;
+
+  if (!tiff)
+    return -1;
+
+  TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, TEST_IMAGE_SIZE);
+  TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, TEST_IMAGE_SIZE);
+  TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, 16);
+
+  for(y=0;y<TEST_IMAGE_SIZE;y++) {
+    for(x=0;x<TEST_IMAGE_SIZE*3;x++)
+      row[x] = x ^ y;
+    if (TIFFWriteScanline(tiff, row, y, 0) < 0)
+      fail = 1;
+  }
+
+  TIFFClose(tiff);
+
+  return fail ? -1 : 0;
+}